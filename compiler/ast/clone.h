@@ -0,0 +1,75 @@
+#pragma once
+
+#include "expr.h"
+#include <memory>
+#include <stdexcept>
+
+using namespace std;
+
+// Deep copy of an expression tree, including types and symbols.
+inline unique_ptr<Expr> cloneExpr(const Expr *e) {
+  unique_ptr<Expr> out;
+
+  if (auto n = dynamic_cast<const NumberExpr *>(e))
+    out = n->isFloat ? make_unique<NumberExpr>(n->floatValue)
+                     : make_unique<NumberExpr>(n->intValue);
+
+  else if (auto b = dynamic_cast<const BoolExpr *>(e))
+    out = make_unique<BoolExpr>(b->value);
+
+  else if (auto s = dynamic_cast<const StringExpr *>(e))
+    out = make_unique<StringExpr>(s->value);
+
+  else if (auto v = dynamic_cast<const VariableExpr *>(e)) {
+    auto copy = make_unique<VariableExpr>(v->name);
+    copy->symbol = v->symbol;
+    out = std::move(copy);
+  }
+
+  else if (auto i = dynamic_cast<const IndexExpr *>(e))
+    out = make_unique<IndexExpr>(cloneExpr(i->array.get()),
+                                 cloneExpr(i->index.get()));
+
+  else if (auto u = dynamic_cast<const UnaryExpr *>(e))
+    out = make_unique<UnaryExpr>(u->op, cloneExpr(u->right.get()));
+
+  else if (auto b = dynamic_cast<const BinaryExpr *>(e))
+    out = make_unique<BinaryExpr>(b->op, cloneExpr(b->left.get()),
+                                  cloneExpr(b->right.get()));
+
+  else if (auto c = dynamic_cast<const CallExpr *>(e)) {
+    vector<unique_ptr<Expr>> args;
+    for (auto &a : c->args)
+      args.push_back(cloneExpr(a.get()));
+    auto copy = make_unique<CallExpr>(c->callee, std::move(args));
+    copy->symbol = c->symbol;
+    out = std::move(copy);
+  }
+
+  else
+    throw runtime_error("Unsupported expr clone");
+
+  out->loc = e->loc;
+  out->type = e->type;
+  return out;
+}
+
+// Whether evaluating e twice is the same as evaluating it once: no
+// calls and no assignments anywhere in it. A pure expression may be
+// cloned into a second use.
+inline bool isPure(const Expr *e) {
+  if (dynamic_cast<const CallExpr *>(e))
+    return false;
+
+  if (auto i = dynamic_cast<const IndexExpr *>(e))
+    return isPure(i->array.get()) && isPure(i->index.get());
+
+  if (auto u = dynamic_cast<const UnaryExpr *>(e))
+    return u->op != "++" && u->op != "--" && isPure(u->right.get());
+
+  if (auto b = dynamic_cast<const BinaryExpr *>(e))
+    return b->op != "=" && b->op != "+=" && isPure(b->left.get()) &&
+           isPure(b->right.get());
+
+  return true;
+}
@@ -24,6 +24,22 @@ struct Expr {
   LangType type = LangType::Unknown();
   virtual ~Expr() = default;
   virtual void print(int d) = 0;
+
+  // Moves this node's children into out. Nodes with children call
+  // dismantle() from their destructor, so freeing a long chain of
+  // nodes runs in a loop instead of one destructor frame per node.
+  virtual void releaseChildren(vector<unique_ptr<Expr>> &) {}
+
+  static void dismantle(Expr &root) {
+    vector<unique_ptr<Expr>> work;
+    root.releaseChildren(work);
+    while (!work.empty()) {
+      unique_ptr<Expr> e = std::move(work.back());
+      work.pop_back();
+      if (e) // passes may have moved a child out
+        e->releaseChildren(work);
+    }
+  }
 };
 
 // ============================================================
@@ -105,6 +121,12 @@ struct IndexExpr : Expr {
 
   IndexExpr(unique_ptr<Expr> a, unique_ptr<Expr> i)
       : array(std::move(a)), index(std::move(i)) {}
+  ~IndexExpr() override { dismantle(*this); }
+
+  void releaseChildren(vector<unique_ptr<Expr>> &out) override {
+    out.push_back(std::move(array));
+    out.push_back(std::move(index));
+  }
 
   void print(int d) override {
     cout << string(d, ' ') << "Index\n";
@@ -123,6 +145,11 @@ struct UnaryExpr : Expr {
 
   UnaryExpr(string o, unique_ptr<Expr> r)
       : op(std::move(o)), right(std::move(r)) {}
+  ~UnaryExpr() override { dismantle(*this); }
+
+  void releaseChildren(vector<unique_ptr<Expr>> &out) override {
+    out.push_back(std::move(right));
+  }
 
   void print(int d) override {
     cout << string(d, ' ') << "Unary(" << op << ")\n";
@@ -141,6 +168,12 @@ struct BinaryExpr : Expr {
 
   BinaryExpr(string o, unique_ptr<Expr> l, unique_ptr<Expr> r)
       : op(std::move(o)), left(std::move(l)), right(std::move(r)) {}
+  ~BinaryExpr() override { dismantle(*this); }
+
+  void releaseChildren(vector<unique_ptr<Expr>> &out) override {
+    out.push_back(std::move(left));
+    out.push_back(std::move(right));
+  }
 
   void print(int d) override {
     cout << string(d, ' ') << "Binary(" << op << ")\n";
@@ -160,6 +193,13 @@ struct CallExpr : Expr {
 
   CallExpr(string c, vector<unique_ptr<Expr>> a)
       : callee(std::move(c)), args(std::move(a)) {}
+  ~CallExpr() override { dismantle(*this); }
+
+  void releaseChildren(vector<unique_ptr<Expr>> &out) override {
+    for (auto &a : args)
+      out.push_back(std::move(a));
+    args.clear();
+  }
 
   void print(int d) override {
     cout << string(d, ' ') << "Call(" << callee << ")\n";
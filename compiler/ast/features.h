@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+===========================================
+FEATURE SET
+===========================================
+Bitmap of the source constructs a tree contains.
+The parser records one per function; rewrite passes
+declare which features they act on, so a pass can be
+skipped when its input is absent.
+*/
+
+enum class Feature : uint32_t {
+  For = 1u << 0,
+  IfElse = 1u << 1,
+  IncDec = 1u << 2,
+  CompoundAssign = 1u << 3,
+  BoolLiteral = 1u << 4,
+  Arrays = 1u << 5,
+  Calls = 1u << 6,
+};
+
+struct FeatureSet {
+  uint32_t bits = 0;
+
+  constexpr FeatureSet() = default;
+  constexpr FeatureSet(Feature f) : bits(static_cast<uint32_t>(f)) {}
+
+  static constexpr FeatureSet all() {
+    FeatureSet s;
+    s.bits = ~0u;
+    return s;
+  }
+
+  bool has(Feature f) const { return bits & static_cast<uint32_t>(f); }
+
+  void add(Feature f) { bits |= static_cast<uint32_t>(f); }
+
+  bool empty() const { return bits == 0; }
+
+  bool intersects(FeatureSet o) const { return (bits & o.bits) != 0; }
+
+  FeatureSet &operator|=(FeatureSet o) {
+    bits |= o.bits;
+    return *this;
+  }
+
+  friend FeatureSet operator|(FeatureSet a, FeatureSet b) { return a |= b; }
+};
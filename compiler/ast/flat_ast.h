@@ -0,0 +1,409 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../common/source_location.h"
+#include "expr.h"
+#include "stmt.h"
+
+using namespace std;
+
+/*
+===========================================
+FLAT AST
+===========================================
+A compact copy of the tree, in the style of the Zig and Carbon ASTs.
+
+A node is an index. Its fields live in parallel arrays: a one-byte
+tag, a `main` word (the name, operator or literal), and two child
+words `lhs`/`rhs`. Lists of children (block statements, call
+arguments, parameters) are runs in `extra`. Names, operators and
+string literals are interned in `strings`. Types are a side table:
+types[node] indexes typeTable, which holds each distinct type once.
+
+Nodes are appended after their children, so index order is
+post-order: a forward scan over the arrays visits every child before
+its parent. A node costs 25 bytes plus its share of `extra`, against
+100+ bytes and a separate heap block per node in the tree.
+
+Built from the tree by flatten() once the passes that rewrite it have
+run. IRPass builds the mid-level IR from it; --emit-flat dumps it.
+*/
+
+enum class NodeTag : uint8_t {
+  // expressions
+  Int,    // lhs/rhs: low/high word of the value
+  Float,  // lhs/rhs: low/high word of the double's bits
+  Bool,   // lhs: value
+  String, // main: literal
+  Var,    // main: name
+  Index,  // lhs: array, rhs: index
+  Unary,  // main: op, lhs: operand
+  Binary, // main: op, lhs, rhs: operands
+  Call,   // main: callee, lhs: first argument in extra, rhs: count
+
+  // statements
+  VarDecl,  // main: name, lhs: initializer, rhs: length; type: declared
+  TempDecl, // VarDecl of an ANF temporary
+  ExprStmt, // lhs: expression
+  Print,    // lhs: expression
+  Return,   // lhs: value or None
+  Block,    // lhs: first statement in extra, rhs: count
+  If,       // lhs: condition, rhs: extra -> [then, else or None]
+  While,    // lhs: condition, rhs: body
+  For,      // main: hint | interleave << 8, lhs: extra -> [init, cond, inc,
+            // body], each possibly None
+  Function, // main: name, lhs: body, rhs: extra -> [count, (name, type)...];
+            // type: return type
+  Break,
+  Continue,
+};
+
+struct FlatAST {
+
+  static constexpr uint32_t None = UINT32_MAX;
+
+  // per node
+  vector<NodeTag> tags;
+  vector<uint32_t> main, lhs, rhs;
+  vector<uint32_t> types;
+  vector<SourceLocation> locs;
+
+  // shared
+  vector<uint32_t> extra;
+  vector<string> strings;
+  vector<LangType> typeTable;
+  vector<uint32_t> roots; // top-level statements
+
+  size_t size() const { return tags.size(); }
+
+  // The name, operator or literal of a node.
+  const string &text(uint32_t n) const { return strings[main[n]]; }
+
+  const LangType &type(uint32_t n) const { return typeTable[types[n]]; }
+
+  int64_t intValue(uint32_t n) const {
+    return (int64_t)((uint64_t)rhs[n] << 32 | lhs[n]);
+  }
+
+  double floatValue(uint32_t n) const {
+    uint64_t bits = (uint64_t)rhs[n] << 32 | lhs[n];
+    double d;
+    memcpy(&d, &bits, sizeof d);
+    return d;
+  }
+
+  // Bytes held by the arrays and the interned strings.
+  size_t bytes() const {
+    size_t n = tags.capacity() * sizeof(NodeTag) +
+               (main.capacity() + lhs.capacity() + rhs.capacity() +
+                types.capacity() + extra.capacity() + roots.capacity()) *
+                   sizeof(uint32_t) +
+               locs.capacity() * sizeof(SourceLocation) +
+               typeTable.capacity() * sizeof(LangType);
+    for (auto &s : strings)
+      n += sizeof(string) + (s.capacity() > 15 ? s.capacity() + 1 : 0);
+    return n;
+  }
+
+  void print() const {
+    for (uint32_t i = 0; i < size(); i++) {
+      cout << "%" << i << " = " << tagName(tags[i]);
+
+      switch (tags[i]) {
+      case NodeTag::Int:
+        cout << " " << intValue(i);
+        break;
+      case NodeTag::Float:
+        cout << " " << floatValue(i);
+        break;
+      case NodeTag::Bool:
+        cout << " " << (lhs[i] ? "true" : "false");
+        break;
+      case NodeTag::String:
+        cout << " \"" << text(i) << "\"";
+        break;
+      case NodeTag::Var:
+        cout << " " << text(i);
+        break;
+      case NodeTag::Unary:
+        cout << " " << text(i) << " " << ref(lhs[i]);
+        break;
+      case NodeTag::Binary:
+        cout << " " << ref(lhs[i]) << " " << text(i) << " " << ref(rhs[i]);
+        break;
+      case NodeTag::Index:
+      case NodeTag::While:
+        cout << " " << ref(lhs[i]) << " " << ref(rhs[i]);
+        break;
+      case NodeTag::Call:
+        cout << " " << text(i) << "(" << list(lhs[i], rhs[i]) << ")";
+        break;
+      case NodeTag::VarDecl:
+      case NodeTag::TempDecl:
+        cout << " " << text(i);
+        if (rhs[i] != None)
+          cout << "[" << ref(rhs[i]) << "]";
+        if (lhs[i] != None)
+          cout << " = " << ref(lhs[i]);
+        break;
+      case NodeTag::ExprStmt:
+      case NodeTag::Print:
+      case NodeTag::Return:
+        cout << " " << ref(lhs[i]);
+        break;
+      case NodeTag::Block:
+        cout << " {" << list(lhs[i], rhs[i]) << "}";
+        break;
+      case NodeTag::If:
+        cout << " " << ref(lhs[i]) << " then " << ref(extra[rhs[i]])
+             << " else " << ref(extra[rhs[i] + 1]);
+        break;
+      case NodeTag::For:
+        cout << " (" << list(lhs[i], 3) << ") " << ref(extra[lhs[i] + 3]);
+        break;
+      case NodeTag::Function: {
+        cout << " " << text(i) << "(";
+        uint32_t p = rhs[i];
+        for (uint32_t k = 0; k < extra[p]; k++)
+          cout << (k ? ", " : "") << strings[extra[p + 1 + 2 * k]];
+        cout << ") " << ref(lhs[i]);
+        break;
+      }
+      default:
+        break;
+      }
+
+      if (type(i).kind != LangTypeKind::Unknown)
+        cout << " : " << typeName(type(i));
+      cout << "\n";
+    }
+  }
+
+  static const char *tagName(NodeTag t) {
+    static const char *names[] = {
+        "int",    "float", "bool",     "string", "var",     "index",
+        "unary",  "binary", "call",    "decl",   "temp",    "expr",
+        "print",  "return", "block",   "if",     "while",   "for",
+        "function", "break", "continue"};
+    return names[(size_t)t];
+  }
+
+  static string typeName(const LangType &t) {
+    switch (t.kind) {
+    case LangTypeKind::Integer:
+      return (t.isUnsigned ? "u" : "i") + to_string(t.bitWidth);
+    case LangTypeKind::Floating:
+      return "f" + to_string(t.bitWidth);
+    case LangTypeKind::Bool:
+      return "bool";
+    case LangTypeKind::Char:
+      return "char";
+    case LangTypeKind::String:
+      return "string";
+    case LangTypeKind::Void:
+      return "void";
+    case LangTypeKind::Array:
+      return typeName(*t.element) + "[" +
+             (t.arraySize ? to_string(t.arraySize) : "") + "]";
+    case LangTypeKind::Function:
+      return "fn";
+    default:
+      return "?";
+    }
+  }
+
+private:
+  static string ref(uint32_t n) {
+    return n == None ? "-" : "%" + to_string(n);
+  }
+
+  string list(uint32_t first, uint32_t count) const {
+    string s;
+    for (uint32_t k = 0; k < count; k++)
+      s += (k ? ", " : "") + ref(extra[first + k]);
+    return s;
+  }
+};
+
+/* ================= BUILDER ================= */
+
+struct FlatBuilder {
+
+  FlatAST out;
+
+  unordered_map<string, uint32_t> stringIds;
+
+  FlatAST build(const vector<unique_ptr<Stmt>> &program) {
+    for (auto &s : program)
+      out.roots.push_back(stmt(s.get()));
+    return std::move(out);
+  }
+
+private:
+  uint32_t node(NodeTag tag, SourceLocation loc, uint32_t main, uint32_t lhs,
+                uint32_t rhs, const LangType &type = LangType::Unknown()) {
+    out.tags.push_back(tag);
+    out.main.push_back(main);
+    out.lhs.push_back(lhs);
+    out.rhs.push_back(rhs);
+    out.types.push_back(typeId(type));
+    out.locs.push_back(loc);
+    return (uint32_t)out.tags.size() - 1;
+  }
+
+  uint32_t intern(const string &s) {
+    auto [it, added] = stringIds.emplace(s, (uint32_t)out.strings.size());
+    if (added)
+      out.strings.push_back(s);
+    return it->second;
+  }
+
+  // few distinct types per program: a linear search is enough
+  uint32_t typeId(const LangType &t) {
+    for (uint32_t i = 0; i < out.typeTable.size(); i++)
+      if (out.typeTable[i].kind == t.kind && sameType(out.typeTable[i], t))
+        return i;
+    out.typeTable.push_back(t);
+    return (uint32_t)out.typeTable.size() - 1;
+  }
+
+  // children are built first; the list is then copied to extra
+  uint32_t list(const vector<uint32_t> &items) {
+    uint32_t first = (uint32_t)out.extra.size();
+    out.extra.insert(out.extra.end(), items.begin(), items.end());
+    return first;
+  }
+
+  uint32_t optExpr(Expr *e) { return e ? expr(e) : FlatAST::None; }
+  uint32_t optStmt(Stmt *s) { return s ? stmt(s) : FlatAST::None; }
+
+  /* ----- expressions ----- */
+
+  uint32_t expr(Expr *e) {
+
+    if (auto n = dynamic_cast<NumberExpr *>(e)) {
+      uint64_t bits = (uint64_t)n->intValue;
+      if (n->isFloat)
+        memcpy(&bits, &n->floatValue, sizeof bits);
+      return node(n->isFloat ? NodeTag::Float : NodeTag::Int, e->loc, 0,
+                  (uint32_t)bits, (uint32_t)(bits >> 32), e->type);
+    }
+
+    if (auto b = dynamic_cast<BoolExpr *>(e))
+      return node(NodeTag::Bool, e->loc, 0, b->value, 0, e->type);
+
+    if (auto s = dynamic_cast<StringExpr *>(e))
+      return node(NodeTag::String, e->loc, intern(s->value), 0, 0, e->type);
+
+    if (auto v = dynamic_cast<VariableExpr *>(e))
+      return node(NodeTag::Var, e->loc, intern(v->name), 0, 0, e->type);
+
+    if (auto i = dynamic_cast<IndexExpr *>(e)) {
+      uint32_t array = expr(i->array.get());
+      uint32_t index = expr(i->index.get());
+      return node(NodeTag::Index, e->loc, 0, array, index, e->type);
+    }
+
+    if (auto u = dynamic_cast<UnaryExpr *>(e)) {
+      uint32_t operand = expr(u->right.get());
+      return node(NodeTag::Unary, e->loc, intern(u->op), operand, 0, e->type);
+    }
+
+    if (auto b = dynamic_cast<BinaryExpr *>(e)) {
+      uint32_t l = expr(b->left.get());
+      uint32_t r = expr(b->right.get());
+      return node(NodeTag::Binary, e->loc, intern(b->op), l, r, e->type);
+    }
+
+    if (auto c = dynamic_cast<CallExpr *>(e)) {
+      vector<uint32_t> args;
+      for (auto &a : c->args)
+        args.push_back(expr(a.get()));
+      return node(NodeTag::Call, e->loc, intern(c->callee), list(args),
+                  (uint32_t)args.size(), e->type);
+    }
+
+    throw runtime_error("Unknown expr in flatten");
+  }
+
+  /* ----- statements ----- */
+
+  uint32_t stmt(Stmt *s) {
+
+    if (auto v = dynamic_cast<VarDeclStmt *>(s)) {
+      uint32_t length = optExpr(v->length.get());
+      uint32_t init = optExpr(v->initializer.get());
+      return node(v->isTemp ? NodeTag::TempDecl : NodeTag::VarDecl, s->loc,
+                  intern(v->name), init, length, v->type);
+    }
+
+    if (auto x = dynamic_cast<ExprStmt *>(s))
+      return node(NodeTag::ExprStmt, s->loc, 0, expr(x->e.get()), 0);
+
+    if (auto x = dynamic_cast<PrintStmt *>(s))
+      return node(NodeTag::Print, s->loc, 0, expr(x->e.get()), 0);
+
+    if (auto x = dynamic_cast<ReturnStmt *>(s))
+      return node(NodeTag::Return, s->loc, 0, optExpr(x->value.get()), 0);
+
+    if (auto b = dynamic_cast<BlockStmt *>(s)) {
+      vector<uint32_t> stmts;
+      for (auto &st : b->stmts)
+        stmts.push_back(stmt(st.get()));
+      return node(NodeTag::Block, s->loc, 0, list(stmts),
+                  (uint32_t)stmts.size());
+    }
+
+    if (auto i = dynamic_cast<IfStmt *>(s)) {
+      uint32_t cond = expr(i->condition.get());
+      uint32_t thenB = stmt(i->thenBranch.get());
+      uint32_t elseB = optStmt(i->elseBranch.get());
+      return node(NodeTag::If, s->loc, 0, cond, list({thenB, elseB}));
+    }
+
+    if (auto w = dynamic_cast<WhileStmt *>(s)) {
+      uint32_t cond = expr(w->condition.get());
+      uint32_t body = stmt(w->body.get());
+      return node(NodeTag::While, s->loc, 0, cond, body);
+    }
+
+    if (auto f = dynamic_cast<ForStmt *>(s)) {
+      uint32_t init = optStmt(f->init.get());
+      uint32_t cond = optExpr(f->condition.get());
+      uint32_t inc = optExpr(f->increment.get());
+      uint32_t body = stmt(f->body.get());
+      uint32_t hint = (uint32_t)f->hint | (uint32_t)f->interleave << 8;
+      return node(NodeTag::For, s->loc, hint, list({init, cond, inc, body}),
+                  0);
+    }
+
+    if (auto f = dynamic_cast<FunctionStmt *>(s)) {
+      uint32_t body = stmt(f->body.get());
+      vector<uint32_t> params = {(uint32_t)f->params.size()};
+      for (auto &p : f->params) {
+        params.push_back(intern(p.first));
+        params.push_back(typeId(p.second));
+      }
+      return node(NodeTag::Function, s->loc, intern(f->name), body,
+                  list(params), f->returnType);
+    }
+
+    if (dynamic_cast<BreakStmt *>(s))
+      return node(NodeTag::Break, s->loc, 0, 0, 0);
+
+    if (dynamic_cast<ContinueStmt *>(s))
+      return node(NodeTag::Continue, s->loc, 0, 0, 0);
+
+    throw runtime_error("Unknown stmt in flatten");
+  }
+};
+
+inline FlatAST flatten(const vector<unique_ptr<Stmt>> &program) {
+  return FlatBuilder().build(program);
+}
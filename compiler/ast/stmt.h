@@ -3,6 +3,7 @@
 #include "../common/source_location.h"
 #include "../sema/type.h"
 #include "expr.h"
+#include "features.h"
 #include <cctype> // for isdigit, isalpha, isalnum
 #include <iostream>
 #include <memory>
@@ -19,6 +20,21 @@ struct Stmt {
   SourceLocation loc;
   virtual ~Stmt() = default;
   virtual void print(int d) = 0;
+
+  // As Expr::releaseChildren, for nested statements (long else-if
+  // chains, deeply nested blocks).
+  virtual void releaseChildren(vector<unique_ptr<Stmt>> &) {}
+
+  static void dismantle(Stmt &root) {
+    vector<unique_ptr<Stmt>> work;
+    root.releaseChildren(work);
+    while (!work.empty()) {
+      unique_ptr<Stmt> s = std::move(work.back());
+      work.pop_back();
+      if (s)
+        s->releaseChildren(work);
+    }
+  }
 };
 
 struct VarDeclStmt : Stmt {
@@ -26,6 +42,15 @@ struct VarDeclStmt : Stmt {
   LangType type;
   std::unique_ptr<Expr> initializer;
 
+  // int[n] x: the run-time length
+  std::unique_ptr<Expr> length;
+
+  // ANF temporary: assigned once, by its initializer
+  bool isTemp = false;
+
+  // set by sema; temporaries have none
+  Symbol *symbol = nullptr;
+
   VarDeclStmt(std::string n, LangType t, std::unique_ptr<Expr> init)
       : name(std::move(n)), type(t), initializer(std::move(init)) {}
 
@@ -54,6 +79,16 @@ struct PrintStmt : Stmt {
 
 struct BlockStmt : Stmt {
   vector<unique_ptr<Stmt>> stmts;
+
+  BlockStmt() = default;
+  ~BlockStmt() override { dismantle(*this); }
+
+  void releaseChildren(vector<unique_ptr<Stmt>> &out) override {
+    for (auto &s : stmts)
+      out.push_back(std::move(s));
+    stmts.clear();
+  }
+
   void print(int d) {
     cout << string(d, ' ') << "Block\n";
     for (auto &s : stmts)
@@ -67,6 +102,12 @@ struct IfStmt : Stmt {
   IfStmt(unique_ptr<Expr> c, unique_ptr<Stmt> t, unique_ptr<Stmt> e)
       : condition(std::move(c)), thenBranch(std::move(t)),
         elseBranch(std::move(e)) {}
+  ~IfStmt() override { dismantle(*this); }
+
+  void releaseChildren(vector<unique_ptr<Stmt>> &out) override {
+    out.push_back(std::move(thenBranch));
+    out.push_back(std::move(elseBranch));
+  }
   void print(int d) {
     cout << string(d, ' ') << "If\n";
     condition->print(d + 2);
@@ -85,6 +126,11 @@ struct WhileStmt : Stmt {
 
   WhileStmt(unique_ptr<Expr> c, unique_ptr<Stmt> b)
       : condition(std::move(c)), body(std::move(b)) {}
+  ~WhileStmt() override { dismantle(*this); }
+
+  void releaseChildren(vector<unique_ptr<Stmt>> &out) override {
+    out.push_back(std::move(body));
+  }
 
   void print(int d) {
     cout << string(d, ' ') << "While\n";
@@ -100,10 +146,26 @@ struct FunctionStmt : Stmt {
   vector<pair<string, LangType>> params;
   unique_ptr<BlockStmt> body;
 
+  // constructs used in the body, recorded by the parser
+  FeatureSet features;
+
+  // the parser recovered from an error in the body, which may be
+  // missing statements, or a lowering pass rejected it; sema does
+  // not check it
+  bool hasSyntaxErrors = false;
+
+  // set by sema, one per parameter
+  vector<Symbol *> paramSymbols;
+
   FunctionStmt(string n, LangType r, vector<pair<string, LangType>> p,
                unique_ptr<BlockStmt> b)
       : name(std::move(n)), returnType(r), params(std::move(p)),
         body(std::move(b)) {}
+  ~FunctionStmt() override { dismantle(*this); }
+
+  void releaseChildren(vector<unique_ptr<Stmt>> &out) override {
+    out.push_back(std::move(body));
+  }
 
   void print(int d) override {
     cout << string(d, ' ') << "Function " << name << "\n";
@@ -121,6 +183,12 @@ struct ReturnStmt : Stmt {
   }
 };
 
+// Loop annotation written before `for`, lowered to llvm.loop metadata:
+//   simd for (...)       vectorize
+//   simd(N) for (...)    vectorize, interleave N times
+//   parallel for (...)   iterations are independent
+enum class LoopHint { None, Simd, Parallel };
+
 // added on day 15
 struct ForStmt : Stmt {
   unique_ptr<Stmt> init;
@@ -128,13 +196,27 @@ struct ForStmt : Stmt {
   unique_ptr<Expr> increment;
   unique_ptr<Stmt> body;
 
+  LoopHint hint = LoopHint::None;
+  int interleave = 0; // simd(N); 0 leaves the count to LLVM
+
   ForStmt(unique_ptr<Stmt> i, unique_ptr<Expr> c, unique_ptr<Expr> inc,
           unique_ptr<Stmt> b)
       : init(std::move(i)), condition(std::move(c)), increment(std::move(inc)),
         body(std::move(b)) {}
+  ~ForStmt() override { dismantle(*this); }
+
+  void releaseChildren(vector<unique_ptr<Stmt>> &out) override {
+    out.push_back(std::move(init));
+    out.push_back(std::move(body));
+  }
 
   void print(int d) {
-    cout << string(d, ' ') << "For\n";
+    cout << string(d, ' ') << "For";
+    if (hint == LoopHint::Simd)
+      cout << " (simd)";
+    else if (hint == LoopHint::Parallel)
+      cout << " (parallel)";
+    cout << "\n";
     if (init)
       init->print(d + 2);
     if (condition)
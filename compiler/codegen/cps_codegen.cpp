@@ -0,0 +1,342 @@
+#include "codegen/cps_codegen.h"
+
+using namespace llvm;
+
+/* ================= MODULE ================= */
+
+void CPSCodegen::lowerModule() {
+
+  // Declare everything first: calls may refer to later functions.
+  for (auto &f : m.functions) {
+    std::vector<Type *> params;
+    for (CPSType t : f.paramTypes)
+      params.push_back(lowerType(t));
+
+    auto *fnTy = FunctionType::get(lowerType(f.returnType), params, false);
+    Function::Create(fnTy, Function::ExternalLinkage, m.names[f.name],
+                     cg.module);
+  }
+
+  for (auto &f : m.functions)
+    lowerFunction(f);
+}
+
+/* ================= FUNCTION ================= */
+
+void CPSCodegen::lowerFunction(const CPSFunction &f) {
+
+  function = &f;
+  fn = cg.module->getFunction(m.names[f.name]);
+  cg.currentFunction = fn;
+
+  values.assign(m.names.size(), nullptr);
+  continuations.clear();
+
+  BasicBlock *entry = BasicBlock::Create(cg.ctx, "entry", fn);
+
+  // Parameters enter through phis so self tail calls can loop back.
+  head = Continuation();
+  head.block = BasicBlock::Create(cg.ctx, "head", fn);
+  head.params = &f.params;
+
+  cg.builder.SetInsertPoint(head.block);
+  for (size_t i = 0; i < f.params.size(); i++) {
+    PHINode *phi = cg.builder.CreatePHI(fn->getArg(i)->getType(), 2);
+    phi->addIncoming(fn->getArg(i), entry);
+    head.phis.push_back(phi);
+    values[f.params[i]] = phi;
+  }
+  head.started = true;
+
+  cg.builder.SetInsertPoint(entry);
+  cg.builder.CreateBr(head.block);
+
+  cg.builder.SetInsertPoint(head.block);
+  lowerExpr(f.body.get());
+
+  function = nullptr;
+}
+
+/* ================= EXPRESSIONS ================= */
+
+void CPSCodegen::lowerExpr(CPSExpr *e) {
+
+  if (auto x = dynamic_cast<CPSLet *>(e)) {
+    lowerLet(x);
+    lowerExpr(x->body.get());
+    return;
+  }
+
+  if (auto x = dynamic_cast<CPSCall *>(e)) {
+    lowerTailCall(x);
+    return;
+  }
+
+  if (auto x = dynamic_cast<CPSIf *>(e)) {
+    Value *cond = truth(value(x->cond));
+
+    BasicBlock *thenBB = BasicBlock::Create(cg.ctx, "then", fn);
+    BasicBlock *elseBB = BasicBlock::Create(cg.ctx, "else", fn);
+    cg.builder.CreateCondBr(cond, thenBB, elseBB);
+
+    cg.builder.SetInsertPoint(thenBB);
+    lowerExpr(x->thenE.get());
+
+    cg.builder.SetInsertPoint(elseBB);
+    lowerExpr(x->elseE.get());
+    return;
+  }
+
+  if (auto x = dynamic_cast<CPSLetCont *>(e)) {
+    Continuation &k = continuations[x->k];
+    k.block = BasicBlock::Create(cg.ctx, m.names[x->k], fn);
+    k.params = &x->params;
+
+    // The body first: jumps there fix the parameter types, and it
+    // defines every value the continuation may refer to.
+    lowerExpr(x->body.get());
+
+    cg.builder.SetInsertPoint(k.block);
+    if (!k.started)
+      cg.builder.CreateUnreachable();
+    else
+      lowerExpr(x->contBody.get());
+    return;
+  }
+
+  llvm_unreachable("unhandled CPS expression");
+}
+
+void CPSCodegen::lowerLet(CPSLet *let) {
+
+  if (auto p = dynamic_cast<CPSPrim *>(let->rhs.get())) {
+    values[let->var] = lowerPrim(p);
+    return;
+  }
+
+  if (auto c = dynamic_cast<CPSCall *>(let->rhs.get())) {
+    Function *callee = cg.module->getFunction(m.names[c->func]);
+
+    std::vector<Value *> args;
+    for (size_t i = 0; i < c->args.size(); i++)
+      args.push_back(
+          convert(value(c->args[i]), callee->getArg(i)->getType()));
+
+    values[let->var] = cg.builder.CreateCall(callee, args);
+    return;
+  }
+
+  llvm_unreachable("unhandled CPS let");
+}
+
+/* ================= CONTROL TRANSFER ================= */
+
+void CPSCodegen::lowerTailCall(CPSCall *call) {
+
+  Type *retTy = fn->getReturnType();
+
+  // ----- return -----
+  if (call->func == CPSNames::Return) {
+    if (retTy->isVoidTy())
+      cg.builder.CreateRetVoid();
+    else if (call->args.empty())
+      cg.builder.CreateRet(Constant::getNullValue(retTy));
+    else
+      cg.builder.CreateRet(convert(value(call->args[0]), retTy));
+    return;
+  }
+
+  // ----- continuation: a jump -----
+  auto k = continuations.find(call->func);
+  if (k != continuations.end()) {
+    jump(k->second, call->args);
+    return;
+  }
+
+  // ----- self tail call: a jump back to the head -----
+  if (call->func == function->name) {
+    jump(head, call->args);
+    return;
+  }
+
+  // ----- tail call of another function -----
+  Function *callee = cg.module->getFunction(m.names[call->func]);
+
+  std::vector<Value *> args;
+  for (size_t i = 0; i < call->args.size(); i++)
+    args.push_back(convert(value(call->args[i]), callee->getArg(i)->getType()));
+
+  CallInst *result = cg.builder.CreateCall(callee, args);
+
+  // musttail needs identical prototypes; otherwise it is only a hint
+  bool same = callee->getFunctionType() == fn->getFunctionType();
+  result->setTailCallKind(same ? CallInst::TCK_MustTail : CallInst::TCK_Tail);
+
+  if (retTy->isVoidTy())
+    cg.builder.CreateRetVoid();
+  else if (result->getType()->isVoidTy())
+    cg.builder.CreateRet(Constant::getNullValue(retTy));
+  else
+    cg.builder.CreateRet(same ? result : convert(result, retTy));
+}
+
+void CPSCodegen::jump(Continuation &k, const std::vector<CPSValue> &args) {
+
+  std::vector<Value *> vals;
+  for (auto &a : args)
+    vals.push_back(value(a));
+
+  // The first jump decides the parameter types.
+  if (!k.started) {
+    IRBuilder<> tmp(k.block, k.block->begin());
+    for (size_t i = 0; i < vals.size(); i++) {
+      PHINode *phi = tmp.CreatePHI(vals[i]->getType(), 2,
+                                   m.names[(*k.params)[i]]);
+      k.phis.push_back(phi);
+      values[(*k.params)[i]] = phi;
+    }
+    k.started = true;
+  }
+
+  for (size_t i = 0; i < vals.size(); i++) {
+    Value *v = convert(vals[i], k.phis[i]->getType());
+    k.phis[i]->addIncoming(v, cg.builder.GetInsertBlock());
+  }
+
+  cg.builder.CreateBr(k.block);
+}
+
+/* ================= PRIMITIVES ================= */
+
+Value *CPSCodegen::lowerPrim(CPSPrim *p) {
+
+  auto &b = cg.builder;
+  Type *i32 = Type::getInt32Ty(cg.ctx);
+  Type *f64 = Type::getDoubleTy(cg.ctx);
+
+  if (p->args.size() == 1) {
+    Value *v = value(p->args[0]);
+    bool fp = v->getType()->isDoubleTy();
+
+    switch (p->op) {
+    case CPSPrimOp::Print:
+      if (fp)
+        cg.emitPrintFloat(v);
+      else
+        cg.emitPrintInt(v);
+      return nullptr;
+    case CPSPrimOp::ToFloat:
+      return convert(v, f64);
+    case CPSPrimOp::Neg:
+      return fp ? b.CreateFNeg(v) : b.CreateNeg(v);
+    case CPSPrimOp::Not:
+      return b.CreateZExt(b.CreateNot(truth(v)), i32);
+    default:
+      llvm_unreachable("bad unary CPS primitive");
+    }
+  }
+
+  Value *l = value(p->args[0]);
+  Value *r = value(p->args[1]);
+
+  if (p->op == CPSPrimOp::And)
+    return b.CreateZExt(b.CreateAnd(truth(l), truth(r)), i32);
+  if (p->op == CPSPrimOp::Or)
+    return b.CreateZExt(b.CreateOr(truth(l), truth(r)), i32);
+
+  // int op double  ->  double op double
+  bool fp = l->getType()->isDoubleTy() || r->getType()->isDoubleTy();
+  if (fp) {
+    l = convert(l, f64);
+    r = convert(r, f64);
+  }
+
+  switch (p->op) {
+  case CPSPrimOp::Add:
+    return fp ? b.CreateFAdd(l, r) : b.CreateAdd(l, r);
+  case CPSPrimOp::Sub:
+    return fp ? b.CreateFSub(l, r) : b.CreateSub(l, r);
+  case CPSPrimOp::Mul:
+    return fp ? b.CreateFMul(l, r) : b.CreateMul(l, r);
+  case CPSPrimOp::Div:
+    return fp ? b.CreateFDiv(l, r) : b.CreateSDiv(l, r);
+  case CPSPrimOp::Mod:
+    return fp ? b.CreateFRem(l, r) : b.CreateSRem(l, r);
+  default:
+    break;
+  }
+
+  Value *cmp = nullptr;
+  switch (p->op) {
+  case CPSPrimOp::Lt:
+    cmp = fp ? b.CreateFCmpOLT(l, r) : b.CreateICmpSLT(l, r);
+    break;
+  case CPSPrimOp::Le:
+    cmp = fp ? b.CreateFCmpOLE(l, r) : b.CreateICmpSLE(l, r);
+    break;
+  case CPSPrimOp::Gt:
+    cmp = fp ? b.CreateFCmpOGT(l, r) : b.CreateICmpSGT(l, r);
+    break;
+  case CPSPrimOp::Ge:
+    cmp = fp ? b.CreateFCmpOGE(l, r) : b.CreateICmpSGE(l, r);
+    break;
+  case CPSPrimOp::Eq:
+    cmp = fp ? b.CreateFCmpOEQ(l, r) : b.CreateICmpEQ(l, r);
+    break;
+  case CPSPrimOp::Ne:
+    cmp = fp ? b.CreateFCmpONE(l, r) : b.CreateICmpNE(l, r);
+    break;
+  default:
+    llvm_unreachable("bad binary CPS primitive");
+  }
+
+  // booleans are ints in CPS
+  return b.CreateZExt(cmp, i32);
+}
+
+/* ================= VALUES ================= */
+
+Value *CPSCodegen::value(const CPSValue &v) {
+
+  switch (v.kind) {
+  case CPSValue::Kind::Var:
+    if (!values[v.var])
+      llvm_unreachable("CPS variable used before definition");
+    return values[v.var];
+  case CPSValue::Kind::Int:
+    return ConstantInt::get(Type::getInt32Ty(cg.ctx), v.intValue, true);
+  case CPSValue::Kind::Float:
+    return ConstantFP::get(Type::getDoubleTy(cg.ctx), v.floatValue);
+  }
+
+  llvm_unreachable("unhandled CPS value");
+}
+
+Value *CPSCodegen::truth(Value *v) {
+  if (v->getType()->isDoubleTy())
+    return cg.builder.CreateFCmpONE(v, ConstantFP::get(v->getType(), 0.0));
+  return cg.builder.CreateICmpNE(v, ConstantInt::get(v->getType(), 0));
+}
+
+Value *CPSCodegen::convert(Value *v, Type *to) {
+  Type *from = v->getType();
+  if (from == to)
+    return v;
+  if (from->isIntegerTy() && to->isDoubleTy())
+    return cg.builder.CreateSIToFP(v, to);
+  if (from->isDoubleTy() && to->isIntegerTy())
+    return cg.builder.CreateFPToSI(v, to);
+  return cg.builder.CreateSExtOrTrunc(v, to);
+}
+
+Type *CPSCodegen::lowerType(CPSType t) {
+  switch (t) {
+  case CPSType::Void:
+    return Type::getVoidTy(cg.ctx);
+  case CPSType::Int:
+    return Type::getInt32Ty(cg.ctx);
+  case CPSType::Float:
+    return Type::getDoubleTy(cg.ctx);
+  }
+  llvm_unreachable("unhandled CPS type");
+}
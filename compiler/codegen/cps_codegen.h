@@ -0,0 +1,50 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "codegen/llvm_codegen.h"
+#include "ir/cps.h"
+
+// Lowers shrunk CPS to LLVM. Lets become SSA values, ifs become
+// branches, continuations become basic blocks whose parameters are
+// phi nodes, and a call of a continuation is a jump. Calls in tail
+// position are self-recursive jumps back to the function's head,
+// musttail calls when the prototypes agree, and tail calls otherwise.
+struct CPSCodegen {
+  LLVMCodegen &cg;
+  const CPSModule &m;
+
+  CPSCodegen(LLVMCodegen &cg, const CPSModule &m) : cg(cg), m(m) {}
+
+  void lowerModule();
+
+private:
+  struct Continuation {
+    llvm::BasicBlock *block = nullptr;
+    bool started = false; // parameter types known
+    const std::vector<CPSVarId> *params = nullptr;
+    std::vector<llvm::PHINode *> phis;
+  };
+
+  const CPSFunction *function = nullptr;
+  llvm::Function *fn = nullptr;
+
+  std::vector<llvm::Value *> values;
+  std::unordered_map<CPSVarId, Continuation> continuations;
+
+  // self tail calls jump here
+  Continuation head;
+
+  void lowerFunction(const CPSFunction &f);
+  void lowerExpr(CPSExpr *e);
+  void lowerLet(CPSLet *let);
+  void lowerTailCall(CPSCall *call);
+  void jump(Continuation &k, const std::vector<CPSValue> &args);
+
+  llvm::Value *lowerPrim(CPSPrim *p);
+  llvm::Value *value(const CPSValue &v);
+  llvm::Value *truth(llvm::Value *v);
+  llvm::Value *convert(llvm::Value *v, llvm::Type *to);
+  llvm::Type *lowerType(CPSType t);
+};
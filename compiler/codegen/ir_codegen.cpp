@@ -0,0 +1,221 @@
+#include "codegen/ir_codegen.h"
+
+#include <vector>
+
+using namespace llvm;
+
+/* ================= TYPES ================= */
+
+static Type *irToLLVMType(LLVMCodegen &cg, IRType t) {
+
+  switch (t) {
+  case IRType::Void:
+    return Type::getVoidTy(cg.ctx);
+  case IRType::I1:
+    return Type::getInt1Ty(cg.ctx);
+  case IRType::I32:
+    return Type::getInt32Ty(cg.ctx);
+  case IRType::F64:
+    return Type::getDoubleTy(cg.ctx);
+  case IRType::Str:
+    return PointerType::getUnqual(Type::getInt8Ty(cg.ctx));
+  }
+
+  llvm_unreachable("unhandled IR type");
+}
+
+/* ================= MODULE ================= */
+
+void lowerIRModule(LLVMCodegen &cg, const IRModule &m) {
+
+  // Declare everything first: calls may refer to later functions.
+  for (auto &f : m.functions) {
+    std::vector<Type *> params;
+    for (IRType p : f.params)
+      params.push_back(irToLLVMType(cg, p));
+
+    auto *fnTy =
+        FunctionType::get(irToLLVMType(cg, f.returnType), params, false);
+    Function::Create(fnTy, Function::ExternalLinkage, f.name, cg.module);
+  }
+
+  for (auto &f : m.functions)
+    lowerIRFunction(cg, m, f);
+}
+
+/* ================= INSTRUCTIONS ================= */
+
+static Value *lowerIRBinary(LLVMCodegen &cg, const IRInstr &i, Value *l,
+                            Value *r) {
+
+  auto &b = cg.builder;
+  bool fp = l->getType()->isDoubleTy();
+
+  switch (i.op) {
+  case IROp::Add:
+    return fp ? b.CreateFAdd(l, r) : b.CreateAdd(l, r);
+  case IROp::Sub:
+    return fp ? b.CreateFSub(l, r) : b.CreateSub(l, r);
+  case IROp::Mul:
+    return fp ? b.CreateFMul(l, r) : b.CreateMul(l, r);
+  case IROp::Div:
+    return fp ? b.CreateFDiv(l, r) : b.CreateSDiv(l, r);
+  case IROp::Mod:
+    return fp ? b.CreateFRem(l, r) : b.CreateSRem(l, r);
+  case IROp::And:
+    return b.CreateAnd(l, r);
+  case IROp::Or:
+    return b.CreateOr(l, r);
+  case IROp::Lt:
+    return fp ? b.CreateFCmpOLT(l, r) : b.CreateICmpSLT(l, r);
+  case IROp::Le:
+    return fp ? b.CreateFCmpOLE(l, r) : b.CreateICmpSLE(l, r);
+  case IROp::Gt:
+    return fp ? b.CreateFCmpOGT(l, r) : b.CreateICmpSGT(l, r);
+  case IROp::Ge:
+    return fp ? b.CreateFCmpOGE(l, r) : b.CreateICmpSGE(l, r);
+  case IROp::Eq:
+    return fp ? b.CreateFCmpOEQ(l, r) : b.CreateICmpEQ(l, r);
+  case IROp::Ne:
+    return fp ? b.CreateFCmpUNE(l, r) : b.CreateICmpNE(l, r);
+  default:
+    break;
+  }
+
+  llvm_unreachable("unhandled IR binary op");
+}
+
+/* ================= FUNCTION ================= */
+
+void lowerIRFunction(LLVMCodegen &cg, const IRModule &m, const IRFunction &f) {
+
+  Function *fn = cg.module->getFunction(f.name);
+  cg.currentFunction = fn;
+
+  std::vector<Value *> values(f.instrs.size(), nullptr);
+  std::vector<BasicBlock *> blocks(f.blocks.size(), nullptr);
+
+  auto rpo = f.reversePostOrder();
+  for (BlockId b : rpo)
+    blocks[b] = BasicBlock::Create(cg.ctx, "bb" + std::to_string(b), fn);
+
+  // Constants are function-wide; materialize them up front.
+  for (ValueId v = 0; v < f.instrs.size(); v++) {
+    const IRInstr &i = f.instrs[v];
+    if (i.op != IROp::Const)
+      continue;
+
+    switch (i.type) {
+    case IRType::I1:
+    case IRType::I32:
+      values[v] = ConstantInt::get(irToLLVMType(cg, i.type), i.imm, true);
+      break;
+    case IRType::F64:
+      values[v] = ConstantFP::get(Type::getDoubleTy(cg.ctx), i.fimm);
+      break;
+    case IRType::Str:
+      cg.builder.SetInsertPoint(blocks[0]);
+      values[v] = cg.builder.CreateGlobalStringPtr(m.strings[i.a], "", 0,
+                                                   cg.module);
+      break;
+    default:
+      break;
+    }
+  }
+
+  // Phis first, so back edges can name them before they are filled.
+  for (BlockId b : rpo) {
+    cg.builder.SetInsertPoint(blocks[b]);
+    for (ValueId v : f.blocks[b].phis) {
+      const IRInstr &i = f.instrs[v];
+      values[v] = cg.builder.CreatePHI(irToLLVMType(cg, i.type), i.b);
+    }
+  }
+
+  auto val = [&](ValueId v) { return values[v]; };
+
+  for (BlockId b : rpo) {
+    cg.builder.SetInsertPoint(blocks[b]);
+
+    for (ValueId v : f.blocks[b].instrs) {
+      const IRInstr &i = f.instrs[v];
+
+      switch (i.op) {
+
+      case IROp::Param:
+        values[v] = fn->getArg(i.a);
+        break;
+
+      case IROp::Neg:
+        values[v] = i.type == IRType::F64 ? cg.builder.CreateFNeg(val(i.a))
+                                          : cg.builder.CreateNeg(val(i.a));
+        break;
+
+      case IROp::Not:
+        values[v] = cg.builder.CreateNot(val(i.a));
+        break;
+
+      case IROp::IToF:
+        values[v] =
+            cg.builder.CreateSIToFP(val(i.a), Type::getDoubleTy(cg.ctx));
+        break;
+
+      case IROp::Call: {
+        std::vector<Value *> args;
+        for (uint32_t k = 0; k < i.c; k++)
+          args.push_back(val(f.operands[i.b + k]));
+        Function *callee = cg.module->getFunction(m.functions[i.a].name);
+        values[v] = cg.builder.CreateCall(callee, args);
+        break;
+      }
+
+      case IROp::Print: {
+        switch (f.instrs[i.a].type) {
+        case IRType::I1:
+          cg.emitPrintBool(val(i.a));
+          break;
+        case IRType::F64:
+          cg.emitPrintFloat(val(i.a));
+          break;
+        case IRType::Str:
+          cg.emitPrintStr(val(i.a));
+          break;
+        default:
+          cg.emitPrintInt(val(i.a));
+          break;
+        }
+        break;
+      }
+
+      case IROp::Return:
+        if (i.a == NoValue)
+          cg.builder.CreateRetVoid();
+        else
+          cg.builder.CreateRet(val(i.a));
+        break;
+
+      case IROp::Jump:
+        cg.builder.CreateBr(blocks[i.a]);
+        break;
+
+      case IROp::Branch:
+        cg.builder.CreateCondBr(val(i.a), blocks[i.b], blocks[i.c]);
+        break;
+
+      default:
+        values[v] = lowerIRBinary(cg, i, val(i.a), val(i.b));
+        break;
+      }
+    }
+  }
+
+  for (BlockId b : rpo)
+    for (ValueId v : f.blocks[b].phis) {
+      const IRInstr &i = f.instrs[v];
+      auto *phi = cast<PHINode>(values[v]);
+      for (uint32_t k = 0; k < i.b; k++) {
+        auto &op = f.phiOperands[i.a + k];
+        phi->addIncoming(val(op.value), blocks[op.block]);
+      }
+    }
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "codegen/llvm_codegen.h"
+#include "ir/ir.h"
+
+void lowerIRModule(LLVMCodegen &cg, const IRModule &m);
+void lowerIRFunction(LLVMCodegen &cg, const IRModule &m, const IRFunction &f);
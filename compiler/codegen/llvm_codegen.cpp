@@ -1,5 +1,7 @@
 #include "codegen/llvm_codegen.h"
 
+#include <llvm/IR/CFG.h>
+
 using namespace llvm;
 
 /* ================= TYPE LOWERING ================= */
@@ -29,11 +31,16 @@ Type *LLVMCodegen::toLLVMType(const LangType &t) {
     if (!t.element)
       llvm_unreachable("Array missing element type");
 
+    Type *elemType = toLLVMType(*t.element);
+
+    // passed around as { T*, i32 length }
+    if (t.isDynamicArray())
+      return StructType::get(ctx, {elemType->getPointerTo(),
+                                   Type::getInt32Ty(ctx)});
+
     if (t.arraySize <= 0)
       llvm_unreachable("Array must have positive size");
 
-    Type *elemType = toLLVMType(*t.element);
-
     return ArrayType::get(elemType, t.arraySize);
   }
 
@@ -47,61 +54,275 @@ Type *LLVMCodegen::toLLVMType(const LangType &t) {
   llvm_unreachable("Unsupported type in LLVM lowering");
 }
 
-/* ================= PRINTF SUPPORT ================= */
+/* ================= ARRAYS ================= */
 
-Function *LLVMCodegen::getPrintf() {
+// Fixed arrays are stack slots ([N x T]*); a fixed array parameter
+// points to the caller's slot. Dynamic arrays (int[n] x)
+// live in the runtime's pool allocator; a variable keeps the element
+// pointer and the length, and is passed around as { T*, i32 }.
 
-  Function *printfFn = module->getFunction("printf");
-  if (printfFn)
-    return printfFn;
+// Reference to an array as a value of type `as`.
+Value *LLVMCodegen::arrayRef(VarInfo *info, const LangType &as) {
+  if (!as.isDynamicArray())
+    return info->slot;
 
-  auto *i8ptr = PointerType::getUnqual(Type::getInt8Ty(ctx));
-  auto *fnTy = FunctionType::get(Type::getInt32Ty(ctx), {i8ptr}, true);
+  Value *data = info->slot;
+  Value *length = info->length;
+
+  if (!info->type.isDynamicArray()) {
+    data = builder.CreateConstGEP2_32(toLLVMType(info->type), info->slot, 0, 0);
+    length = builder.getInt32(info->type.arraySize);
+  }
+
+  Value *ref = UndefValue::get(toLLVMType(as));
+  ref = builder.CreateInsertValue(ref, data, 0);
+  return builder.CreateInsertValue(ref, length, 1);
+}
+
+void LLVMCodegen::bindArray(const std::string &name, const LangType &type,
+                            Value *ref) {
+  if (!type.isDynamicArray()) {
+    bind(name, type, ref);
+    return;
+  }
+
+  VarInfo info{type, builder.CreateExtractValue(ref, 0, name)};
+  info.length = builder.CreateExtractValue(ref, 1, name + ".len");
+  scopes.back()[name] = info;
+}
+
+static Value *arrayBytes(LLVMCodegen &cg, const LangType &type,
+                         Value *length) {
+  Type *elemType = cg.toLLVMType(*type.element);
+  uint64_t size = cg.module->getDataLayout().getTypeAllocSize(elemType);
+
+  return cg.builder.CreateMul(
+      cg.builder.CreateZExt(length, cg.builder.getInt64Ty()),
+      cg.builder.getInt64(size));
+}
+
+// int[n] x: zero-filled storage, freed when the declaring scope ends.
+void LLVMCodegen::allocArray(const std::string &name, const LangType &type,
+                             Value *length) {
+  Value *zero = builder.getInt32(0);
+  length = builder.CreateSelect(builder.CreateICmpSLT(length, zero), zero,
+                                length, name + ".len");
+
+  FunctionCallee alloc = module->getOrInsertFunction(
+      "__nano_alloc", builder.getInt8PtrTy(), builder.getInt64Ty());
+
+  Value *raw = builder.CreateCall(alloc, {arrayBytes(*this, type, length)});
+  Type *elemType = toLLVMType(*type.element);
+
+  VarInfo info{type, builder.CreateBitCast(raw, elemType->getPointerTo(), name)};
+  info.length = length;
+  info.owned = true;
+  scopes.back()[name] = info;
+}
+
+// Frees the arrays owned by scopes[depth..]: at the end of a block,
+// or all of them before a return.
+void LLVMCodegen::releaseArrays(size_t depth) {
+  FunctionCallee release = module->getOrInsertFunction(
+      "__nano_free", builder.getVoidTy(), builder.getInt8PtrTy(),
+      builder.getInt64Ty());
+
+  for (size_t d = depth; d < scopes.size(); d++)
+    for (auto &[name, info] : scopes[d])
+      if (info.owned)
+        builder.CreateCall(
+            release, {builder.CreateBitCast(info.slot, builder.getInt8PtrTy()),
+                      arrayBytes(*this, info.type, info.length)});
+}
+
+void LLVMCodegen::returnAfterFailure() {
+  releaseArrays(0);
+
+  if (parallelFailed) {
+    builder.CreateStore(builder.getInt32(1), parallelFailed)
+        ->setAtomic(AtomicOrdering::Monotonic);
+    builder.CreateRetVoid();
+    return;
+  }
+
+  Type *ret = currentFunction->getReturnType();
+  if (ret->isVoidTy())
+    builder.CreateRetVoid();
+  else
+    builder.CreateRet(Constant::getNullValue(ret));
+}
+
+/* ================= SSA CONSTRUCTION ================= */
+
+// Scalars never touch memory. Each variable's current value is tracked
+// per block and phis are placed on demand, following Braun et al.,
+// "Simple and Efficient SSA Construction". A block is sealed once all
+// of its predecessors exist; until then a read that misses gets an
+// operandless phi, completed by sealBlock.
+
+unsigned LLVMCodegen::declareScalar(const std::string &name,
+                                    const LangType &type) {
+  unsigned var = ssaTypes.size();
+  ssaTypes.push_back(toLLVMType(type));
+  scopes.back()[name] = VarInfo{type, nullptr, nullptr, (int)var};
+  return var;
+}
 
-  printfFn =
-      Function::Create(fnTy, Function::ExternalLinkage, "printf", module);
+void LLVMCodegen::writeVariable(unsigned var, BasicBlock *bb, Value *v) {
+  currentDef[bb][var] = v;
+}
 
-  return printfFn;
+Value *LLVMCodegen::readVariable(unsigned var, BasicBlock *bb) {
+  auto &defs = currentDef[bb];
+  auto it = defs.find(var);
+  if (it != defs.end())
+    return it->second;
+  return readVariableRecursive(var, bb);
+}
+
+Value *LLVMCodegen::readVariableRecursive(unsigned var, BasicBlock *bb) {
+  Value *v;
+
+  if (!sealed.count(bb)) {
+    IRBuilder<> tmp(bb, bb->begin());
+    PHINode *phi = tmp.CreatePHI(ssaTypes[var], 2);
+    incompletePhis[bb].push_back({var, phi});
+    v = phi;
+  } else if (pred_empty(bb)) {
+    // entry block (read before any write) or unreachable code
+    v = UndefValue::get(ssaTypes[var]);
+  } else if (BasicBlock *pred = bb->getSinglePredecessor()) {
+    v = readVariable(var, pred);
+  } else {
+    // the phi is the definition while its operands are read: breaks
+    // the recursion around loops
+    IRBuilder<> tmp(bb, bb->begin());
+    PHINode *phi = tmp.CreatePHI(ssaTypes[var], 2);
+    writeVariable(var, bb, phi);
+    v = addPhiOperands(var, phi);
+  }
+
+  writeVariable(var, bb, v);
+  return v;
+}
+
+Value *LLVMCodegen::addPhiOperands(unsigned var, PHINode *phi) {
+  for (BasicBlock *pred : predecessors(phi->getParent()))
+    phi->addIncoming(readVariable(var, pred), pred);
+  return tryRemoveTrivialPhi(phi);
+}
+
+Value *LLVMCodegen::tryRemoveTrivialPhi(PHINode *phi) {
+  Value *same = nullptr;
+
+  for (Value *op : phi->incoming_values()) {
+    if (op == same || op == phi)
+      continue;
+    if (same)
+      return phi; // merges two values
+    same = op;
+  }
+
+  if (!same)
+    same = UndefValue::get(phi->getType());
+
+  SmallVector<WeakVH, 4> users;
+  for (User *u : phi->users())
+    if (u != phi && isa<PHINode>(u))
+      users.push_back(u);
+
+  phi->replaceAllUsesWith(same);
+  phi->eraseFromParent();
+
+  // same may itself turn out trivial below; the handle follows it
+  WeakTrackingVH result = same;
+
+  // removing this phi may have made phis using it trivial; phis of
+  // unsealed blocks are still incomplete and are left alone
+  for (auto &u : users)
+    if (auto *p = dyn_cast_or_null<PHINode>(u))
+      if (sealed.count(p->getParent()))
+        tryRemoveTrivialPhi(p);
+
+  return result;
+}
+
+void LLVMCodegen::sealBlock(BasicBlock *bb) {
+  // completing a phi can add more incomplete phis to this block
+  for (size_t i = 0; i < incompletePhis[bb].size(); i++) {
+    auto [var, phi] = incompletePhis[bb][i];
+    addPhiOperands(var, phi);
+  }
+
+  incompletePhis.erase(bb);
+  sealed.insert(bb);
+}
+
+void LLVMCodegen::finishFunction() {
+  ssaTypes.clear();
+  currentDef.clear();
+  incompletePhis.clear();
+  sealed.clear();
+}
+
+/* ================= RUNTIME SUPPORT ================= */
+
+// Print entry points live in the nano_rt library (runtime/nano_rt.h).
+Function *LLVMCodegen::getRuntimeFunction(const std::string &name,
+                                          Type *paramType) {
+
+  Function *fn = module->getFunction(name);
+  if (fn)
+    return fn;
+
+  auto *fnTy = FunctionType::get(Type::getVoidTy(ctx), {paramType}, false);
+
+  fn = Function::Create(fnTy, Function::ExternalLinkage, name, module);
+  fn->setDoesNotThrow();
+
+  return fn;
 }
 
 /* ================= PRINT INT ================= */
 
-void LLVMCodegen::emitPrintfInt(Value *v) {
+void LLVMCodegen::emitPrintInt(Value *v) {
 
   if (!v->getType()->isIntegerTy(32))
     v = builder.CreateSExtOrTrunc(v, Type::getInt32Ty(ctx));
 
-  Value *fmt = builder.CreateGlobalStringPtr("%d\n");
-  builder.CreateCall(getPrintf(), {fmt, v});
+  builder.CreateCall(
+      getRuntimeFunction("__nano_print_i32", Type::getInt32Ty(ctx)), {v});
 }
 
 /* ================= PRINT FLOAT ================= */
 
-void LLVMCodegen::emitPrintfFloat(Value *val) {
+void LLVMCodegen::emitPrintFloat(Value *val) {
 
   if (val->getType()->isFloatTy())
     val = builder.CreateFPExt(val, Type::getDoubleTy(ctx));
 
-  Value *formatStr = builder.CreateGlobalStringPtr("%f\n");
-  builder.CreateCall(getPrintf(), {formatStr, val});
+  builder.CreateCall(
+      getRuntimeFunction("__nano_print_f64", Type::getDoubleTy(ctx)), {val});
 }
 
 /* ================= PRINT BOOL ================= */
 
-void LLVMCodegen::emitPrintfBool(Value *val) {
+void LLVMCodegen::emitPrintBool(Value *val) {
 
   if (!val->getType()->isIntegerTy(1))
     val = builder.CreateICmpNE(val, ConstantInt::get(val->getType(), 0));
 
   val = builder.CreateZExt(val, Type::getInt32Ty(ctx));
 
-  emitPrintfInt(val);
+  builder.CreateCall(
+      getRuntimeFunction("__nano_print_bool", Type::getInt32Ty(ctx)), {val});
 }
 
 /* ================= PRINT STRING ================= */
 
-void LLVMCodegen::emitPrintfStr(Value *v) {
+void LLVMCodegen::emitPrintStr(Value *v) {
+
+  auto *i8ptr = PointerType::getUnqual(Type::getInt8Ty(ctx));
 
-  Value *fmt = builder.CreateGlobalStringPtr("%s\n");
-  builder.CreateCall(getPrintf(), {fmt, v});
+  builder.CreateCall(getRuntimeFunction("__nano_print_str", i8ptr), {v});
 }
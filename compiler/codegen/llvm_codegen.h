@@ -1,19 +1,41 @@
 #pragma once
 
+#include <deque>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/ValueHandle.h>
 
+#include "../ast/expr.h"
 #include "../sema/type.h"
 
 struct VarInfo {
   LangType type;
-  llvm::Value *slot;
+  llvm::Value *slot; // arrays live in memory; dynamic ones: element pointer
+
+  // set instead of slot for ANF temporaries, which are never stored to
+  llvm::Value *value = nullptr;
+
+  // scalars: SSA variable number for readVariable / writeVariable
+  int ssa = -1;
+
+  // dynamic arrays: i32 length, and whether this scope frees the storage
+  llvm::Value *length = nullptr;
+  bool owned = false;
+
+  // declaration this binds (see LLVMCodegen::link), and the binding
+  // it had before
+  Symbol *symbol = nullptr;
+  VarInfo *shadowed = nullptr;
+
+  // toLLVMType(type), filled in on first use
+  llvm::Type *llvmType = nullptr;
 };
 
 struct LLVMCodegen {
@@ -23,7 +45,13 @@ struct LLVMCodegen {
 
   llvm::Function *currentFunction = nullptr;
 
-  std::vector<std::unordered_map<std::string, VarInfo>> scopes;
+  // While lowering the outlined body of a parallel for: its i32
+  // failure flag in the loop's env. See returnAfterFailure.
+  llvm::Value *parallelFailed = nullptr;
+
+  // Bindings by name. A deque, so a VarInfo stays put while inner
+  // scopes come and go and Symbol::var can point at it.
+  std::deque<std::unordered_map<std::string, VarInfo>> scopes;
 
   LLVMCodegen(llvm::LLVMContext &c, llvm::Module *m)
       : ctx(c), module(m), builder(c) {
@@ -32,12 +60,40 @@ struct LLVMCodegen {
 
   void enterScope() { scopes.emplace_back(); }
 
-  void exitScope() { scopes.pop_back(); }
+  void exitScope() {
+    for (auto &[name, info] : scopes.back())
+      if (info.symbol)
+        info.symbol->var = info.shadowed;
+    scopes.pop_back();
+  }
+
+  // Makes sym resolve to the innermost binding of name until that
+  // binding's scope exits. Variable references then find their
+  // binding through VariableExpr::symbol without a name lookup.
+  void link(Symbol *sym, const std::string &name) {
+    if (!sym)
+      return;
+    VarInfo &info = scopes.back()[name];
+    info.symbol = sym;
+    info.shadowed = sym->var;
+    sym->var = &info;
+  }
 
   void bind(const std::string &name, const LangType &type, llvm::Value *slot) {
     scopes.back()[name] = VarInfo{type, slot};
   }
 
+  void bindValue(const std::string &name, const LangType &type,
+                 llvm::Value *value) {
+    scopes.back()[name] = VarInfo{type, nullptr, value};
+  }
+
+  VarInfo *lookupVar(VariableExpr *v) {
+    if (v->symbol && v->symbol->var)
+      return v->symbol->var;
+    return lookupVar(v->name); // ANF temporaries
+  }
+
   VarInfo *lookupVar(const std::string &name) {
     for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
       auto f = it->find(name);
@@ -47,16 +103,64 @@ struct LLVMCodegen {
     return nullptr;
   }
 
+  llvm::Type *typeOf(VarInfo *info) {
+    if (!info->llvmType)
+      info->llvmType = toLLVMType(info->type);
+    return info->llvmType;
+  }
+
   LangType *lookupType(const std::string &name) {
     VarInfo *info = lookupVar(name);
     return info ? &info->type : nullptr;
   }
 
-  llvm::Function *getPrintf();
-  void emitPrintfInt(llvm::Value *v);
-  void emitPrintfFloat(llvm::Value *v);
-  void emitPrintfBool(llvm::Value *v);
-  void emitPrintfStr(llvm::Value *v);
+  /* ----- arrays ----- */
+
+  llvm::Value *arrayRef(VarInfo *info, const LangType &as);
+  void bindArray(const std::string &name, const LangType &type,
+                 llvm::Value *ref);
+  void allocArray(const std::string &name, const LangType &type,
+                  llvm::Value *length);
+  void releaseArrays(size_t depth);
+
+  // Leaves the function after a run-time error has been reported. An
+  // outlined parallel body sets its failure flag instead of returning
+  // a value; the function running the loop checks the flag after it
+  // and leaves in turn.
+  void returnAfterFailure();
+
+  /* ----- SSA construction for scalars ----- */
+
+  unsigned declareScalar(const std::string &name, const LangType &type);
+  void writeVariable(unsigned var, llvm::BasicBlock *bb, llvm::Value *v);
+  llvm::Value *readVariable(unsigned var, llvm::BasicBlock *bb);
+  void sealBlock(llvm::BasicBlock *bb);
+
+  // Drops the SSA bookkeeping of the functions lowered so far; only
+  // valid between top-level functions.
+  void finishFunction();
+
+  std::vector<llvm::Type *> ssaTypes;
+
+  // RAUW of a removed trivial phi updates these handles in place
+  std::unordered_map<llvm::BasicBlock *,
+                     std::unordered_map<unsigned, llvm::WeakTrackingVH>>
+      currentDef;
+  std::unordered_map<llvm::BasicBlock *,
+                     std::vector<std::pair<unsigned, llvm::PHINode *>>>
+      incompletePhis;
+  std::unordered_set<llvm::BasicBlock *> sealed;
+
+  llvm::Value *readVariableRecursive(unsigned var, llvm::BasicBlock *bb);
+  llvm::Value *addPhiOperands(unsigned var, llvm::PHINode *phi);
+  llvm::Value *tryRemoveTrivialPhi(llvm::PHINode *phi);
+
+  llvm::Function *getRuntimeFunction(const std::string &name,
+                                     llvm::Type *paramType);
+  void emitPrintInt(llvm::Value *v);
+  void emitPrintFloat(llvm::Value *v);
+  void emitPrintBool(llvm::Value *v);
+  void emitPrintStr(llvm::Value *v);
 
   llvm::Type *toLLVMType(const LangType &type);
 };
@@ -1,5 +1,6 @@
 #include "ast/expr.h"
 #include "codegen/llvm_codegen.h"
+#include "codegen/lower_expr.h"
 
 using namespace llvm;
 
@@ -20,14 +21,11 @@ static Value *toBool(LLVMCodegen &cg, Value *v) {
 
 /* ===== BOUNDS CHECK ===== */
 
-static void emitBoundsCheck(LLVMCodegen &cg, Value *index, int size) {
+static void emitBoundsCheck(LLVMCodegen &cg, Value *index, Value *upper) {
 
   Function *fn = cg.currentFunction;
 
-  BasicBlock *currentBB = cg.builder.GetInsertBlock();
-
   Value *zero = ConstantInt::get(index->getType(), 0);
-  Value *upper = ConstantInt::get(index->getType(), size);
 
   Value *lowerCheck = cg.builder.CreateICmpSGE(index, zero);
   Value *upperCheck = cg.builder.CreateICmpSLT(index, upper);
@@ -37,23 +35,99 @@ static void emitBoundsCheck(LLVMCodegen &cg, Value *index, int size) {
   BasicBlock *errBB = BasicBlock::Create(cg.ctx, "bounds.err", fn);
 
   cg.builder.CreateCondBr(cond, okBB, errBB);
+  cg.sealBlock(okBB);
+  cg.sealBlock(errBB);
 
   // ----- ERROR BLOCK -----
   cg.builder.SetInsertPoint(errBB);
 
-  cg.builder.CreateCall(cg.getPrintf(), {cg.builder.CreateGlobalStringPtr(
-                                            "Array index out of bounds\n")});
-
-  if (fn->getReturnType()->isVoidTy()) {
-    cg.builder.CreateRetVoid();
+  // chunks of a parallel loop can fail at the same time; only the
+  // first one to set the flag reports
+  if (cg.parallelFailed) {
+    Value *was = cg.builder.CreateAtomicRMW(
+        AtomicRMWInst::Xchg, cg.parallelFailed, cg.builder.getInt32(1),
+        MaybeAlign(4), AtomicOrdering::Monotonic);
+
+    BasicBlock *reportBB = BasicBlock::Create(cg.ctx, "bounds.report", fn);
+    BasicBlock *leaveBB = BasicBlock::Create(cg.ctx, "bounds.leave", fn);
+    cg.builder.CreateCondBr(cg.builder.CreateICmpEQ(was, cg.builder.getInt32(0)),
+                            reportBB, leaveBB);
+    cg.sealBlock(reportBB);
+
+    cg.builder.SetInsertPoint(reportBB);
+    cg.emitPrintStr(
+        cg.builder.CreateGlobalStringPtr("Array index out of bounds"));
+    cg.builder.CreateBr(leaveBB);
+    cg.sealBlock(leaveBB);
+
+    cg.builder.SetInsertPoint(leaveBB);
   } else {
-    cg.builder.CreateRet(Constant::getNullValue(fn->getReturnType()));
+    cg.emitPrintStr(
+        cg.builder.CreateGlobalStringPtr("Array index out of bounds"));
   }
 
+  cg.returnAfterFailure();
+
   // ----- OK BLOCK -----
   cg.builder.SetInsertPoint(okBB);
 }
 
+/* ===== ELEMENT ADDRESS ===== */
+
+// Bounds-checked address of arr[index].
+static Value *elementPtr(LLVMCodegen &cg, VarInfo *info, Value *index) {
+
+  const LangType &t = info->type;
+
+  if (t.isDynamicArray()) {
+    emitBoundsCheck(cg, index, info->length);
+    return cg.builder.CreateGEP(cg.toLLVMType(*t.element), info->slot, index);
+  }
+
+  emitBoundsCheck(cg, index, ConstantInt::get(index->getType(), t.arraySize));
+
+  Value *zero = ConstantInt::get(Type::getInt32Ty(cg.ctx), 0);
+
+  return cg.builder.CreateGEP(cg.typeOf(info), // FULL ARRAY TYPE
+                              info->slot, {zero, index});
+}
+
+/* ===== SHORT-CIRCUIT && / || ===== */
+
+// The right operand is only evaluated when the left one does not
+// decide the result; the two paths meet in a phi.
+static Value *lowerLogical(LLVMCodegen &cg, BinaryExpr *b) {
+
+  bool isAnd = b->op == "&&";
+  Function *fn = cg.currentFunction;
+
+  Value *L = toBool(cg, lowerExpr(cg, b->left.get()));
+  BasicBlock *lhsBB = cg.builder.GetInsertBlock();
+
+  BasicBlock *rhsBB =
+      BasicBlock::Create(cg.ctx, isAnd ? "land.rhs" : "lor.rhs", fn);
+  BasicBlock *endBB =
+      BasicBlock::Create(cg.ctx, isAnd ? "land.end" : "lor.end", fn);
+
+  if (isAnd)
+    cg.builder.CreateCondBr(L, rhsBB, endBB);
+  else
+    cg.builder.CreateCondBr(L, endBB, rhsBB);
+  cg.sealBlock(rhsBB);
+
+  cg.builder.SetInsertPoint(rhsBB);
+  Value *R = toBool(cg, lowerExpr(cg, b->right.get()));
+  BasicBlock *rhsEndBB = cg.builder.GetInsertBlock();
+  cg.builder.CreateBr(endBB);
+  cg.sealBlock(endBB);
+
+  cg.builder.SetInsertPoint(endBB);
+  PHINode *phi = cg.builder.CreatePHI(Type::getInt1Ty(cg.ctx), 2);
+  phi->addIncoming(ConstantInt::get(Type::getInt1Ty(cg.ctx), !isAnd), lhsBB);
+  phi->addIncoming(R, rhsEndBB);
+  return phi;
+}
+
 Value *lowerExpr(LLVMCodegen &cg, Expr *e) {
 
   /* ===== NUMBER ===== */
@@ -69,14 +143,27 @@ Value *lowerExpr(LLVMCodegen &cg, Expr *e) {
   if (auto *b = dynamic_cast<BoolExpr *>(e))
     return ConstantInt::get(Type::getInt1Ty(cg.ctx), b->value);
 
+  /* ===== STRING ===== */
+  if (auto *s = dynamic_cast<StringExpr *>(e))
+    return cg.builder.CreateGlobalStringPtr(s->value);
+
   /* ===== VARIABLE ===== */
   if (auto *v = dynamic_cast<VariableExpr *>(e)) {
 
-    VarInfo *info = cg.lookupVar(v->name);
+    VarInfo *info = cg.lookupVar(v);
     if (!info)
       llvm_unreachable("undefined variable");
 
-    return cg.builder.CreateLoad(cg.toLLVMType(info->type), info->slot);
+    if (info->value)
+      return info->value;
+
+    if (info->ssa >= 0)
+      return cg.readVariable(info->ssa, cg.builder.GetInsertBlock());
+
+    if (info->type.isDynamicArray())
+      return cg.arrayRef(info, info->type);
+
+    return cg.builder.CreateLoad(cg.typeOf(info), info->slot);
   }
 
   /* ===== ARRAY ACCESS ===== */
@@ -87,20 +174,32 @@ Value *lowerExpr(LLVMCodegen &cg, Expr *e) {
     if (!var)
       llvm_unreachable("array base must be variable");
 
-    VarInfo *info = cg.lookupVar(var->name);
+    VarInfo *info = cg.lookupVar(var);
     if (!info)
       llvm_unreachable("undefined array");
 
     Value *index = lowerExpr(cg, a->index.get());
 
-    emitBoundsCheck(cg, index, info->type.arraySize);
+    Value *ptr = elementPtr(cg, info, index);
 
-    Value *zero = ConstantInt::get(Type::getInt32Ty(cg.ctx), 0);
+    return cg.builder.CreateLoad(cg.toLLVMType(*info->type.element), ptr);
+  }
 
-    Value *ptr = cg.builder.CreateGEP(cg.toLLVMType(info->type), info->slot,
-                                      {zero, index});
+  /* ===== UNARY ===== */
+  if (auto *u = dynamic_cast<UnaryExpr *>(e)) {
 
-    return cg.builder.CreateLoad(cg.toLLVMType(*info->type.element), ptr);
+    Value *v = lowerExpr(cg, u->right.get());
+
+    if (u->op == "!")
+      return cg.builder.CreateNot(toBool(cg, v));
+
+    if (u->op == "-") {
+      if (v->getType()->isFloatingPointTy())
+        return cg.builder.CreateFNeg(v);
+      return cg.builder.CreateNeg(v);
+    }
+
+    llvm_unreachable("unhandled unary operator");
   }
 
   /* ===== BINARY ===== */
@@ -114,18 +213,21 @@ Value *lowerExpr(LLVMCodegen &cg, Expr *e) {
 
         Value *rhs = lowerExpr(cg, b->right.get());
 
-        VarInfo *info = cg.lookupVar(lhs->name);
+        VarInfo *info = cg.lookupVar(lhs);
         if (!info)
           llvm_unreachable("assignment to undeclared");
 
-        Type *declType = cg.toLLVMType(info->type);
+        Type *declType = cg.typeOf(info);
 
         if (rhs->getType() != declType) {
           if (rhs->getType()->isIntegerTy() && declType->isDoubleTy())
             rhs = cg.builder.CreateSIToFP(rhs, declType);
         }
 
-        cg.builder.CreateStore(rhs, info->slot);
+        if (info->ssa >= 0)
+          cg.writeVariable(info->ssa, cg.builder.GetInsertBlock(), rhs);
+        else
+          cg.builder.CreateStore(rhs, info->slot);
         return rhs;
       }
 
@@ -136,18 +238,14 @@ Value *lowerExpr(LLVMCodegen &cg, Expr *e) {
         if (!var)
           llvm_unreachable("invalid array assignment");
 
-        VarInfo *info = cg.lookupVar(var->name);
+        VarInfo *info = cg.lookupVar(var);
         if (!info)
           llvm_unreachable("undeclared array");
 
         Value *index = lowerExpr(cg, a->index.get());
         Value *rhs = lowerExpr(cg, b->right.get());
 
-        Value *zero = ConstantInt::get(Type::getInt32Ty(cg.ctx), 0);
-
-        Value *ptr =
-            cg.builder.CreateGEP(cg.toLLVMType(info->type), // FULL ARRAY TYPE
-                                 info->slot, {zero, index});
+        Value *ptr = elementPtr(cg, info, index);
 
         cg.builder.CreateStore(rhs, ptr);
         return rhs;
@@ -156,9 +254,19 @@ Value *lowerExpr(LLVMCodegen &cg, Expr *e) {
       llvm_unreachable("Invalid assignment target");
     }
 
+    if (b->op == "&&" || b->op == "||")
+      return lowerLogical(cg, b);
+
     Value *L = lowerExpr(cg, b->left.get());
     Value *R = lowerExpr(cg, b->right.get());
 
+    // bool compared with int: compare as int
+    if (L->getType()->isIntegerTy(1) && R->getType()->isIntegerTy(32))
+      L = cg.builder.CreateZExt(L, R->getType());
+
+    if (R->getType()->isIntegerTy(1) && L->getType()->isIntegerTy(32))
+      R = cg.builder.CreateZExt(R, L->getType());
+
     if (L->getType()->isDoubleTy() && R->getType()->isIntegerTy())
       R = cg.builder.CreateSIToFP(R, L->getType());
 
@@ -177,6 +285,21 @@ Value *lowerExpr(LLVMCodegen &cg, Expr *e) {
         return cg.builder.CreateFMul(L, R);
       if (b->op == "/")
         return cg.builder.CreateFDiv(L, R);
+      if (b->op == "%")
+        return cg.builder.CreateFRem(L, R);
+
+      if (b->op == "<")
+        return cg.builder.CreateFCmpOLT(L, R);
+      if (b->op == "<=")
+        return cg.builder.CreateFCmpOLE(L, R);
+      if (b->op == ">")
+        return cg.builder.CreateFCmpOGT(L, R);
+      if (b->op == ">=")
+        return cg.builder.CreateFCmpOGE(L, R);
+      if (b->op == "==")
+        return cg.builder.CreateFCmpOEQ(L, R);
+      if (b->op == "!=")
+        return cg.builder.CreateFCmpUNE(L, R);
     }
 
     if (type->isIntegerTy()) {
@@ -189,7 +312,24 @@ Value *lowerExpr(LLVMCodegen &cg, Expr *e) {
         return cg.builder.CreateMul(L, R);
       if (b->op == "/")
         return cg.builder.CreateSDiv(L, R);
+      if (b->op == "%")
+        return cg.builder.CreateSRem(L, R);
+
+      if (b->op == "<")
+        return cg.builder.CreateICmpSLT(L, R);
+      if (b->op == "<=")
+        return cg.builder.CreateICmpSLE(L, R);
+      if (b->op == ">")
+        return cg.builder.CreateICmpSGT(L, R);
+      if (b->op == ">=")
+        return cg.builder.CreateICmpSGE(L, R);
+      if (b->op == "==")
+        return cg.builder.CreateICmpEQ(L, R);
+      if (b->op == "!=")
+        return cg.builder.CreateICmpNE(L, R);
     }
+
+    llvm_unreachable("unhandled binary operator");
   }
 
   /* ===== CALL ===== */
@@ -198,8 +338,20 @@ Value *lowerExpr(LLVMCodegen &cg, Expr *e) {
     Function *fn = cg.module->getFunction(call->callee);
 
     std::vector<Value *> args;
-    for (auto &a : call->args)
-      args.push_back(lowerExpr(cg, a.get()));
+    for (size_t i = 0; i < call->args.size(); i++) {
+      Expr *arg = call->args[i].get();
+
+      // arrays are passed by reference: their address, or a
+      // (data, length) pair for int[] parameters
+      auto *var = dynamic_cast<VariableExpr *>(arg);
+      VarInfo *info = var ? cg.lookupVar(var) : nullptr;
+      if (info && info->type.isArray() && call->symbol) {
+        args.push_back(cg.arrayRef(info, call->symbol->paramTypes[i]));
+        continue;
+      }
+
+      args.push_back(lowerExpr(cg, arg));
+    }
 
     return cg.builder.CreateCall(fn, args);
   }
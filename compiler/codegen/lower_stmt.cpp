@@ -1,8 +1,12 @@
 #include "codegen/lower_stmt.h"
 #include "codegen/lower_expr.h"
+#include "common/error.h"
+#include "passes/rewrite_pass.h"
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/Metadata.h>
 #include <llvm/Support/ErrorHandling.h>
+#include <set>
 
 using namespace llvm;
 
@@ -15,6 +19,8 @@ static void lowerBlock(LLVMCodegen &cg, BlockStmt *blk) {
       break;
     lowerStmt(cg, s.get());
   }
+  if (!cg.builder.GetInsertBlock()->getTerminator())
+    cg.releaseArrays(cg.scopes.size() - 1);
   cg.exitScope();
 }
 
@@ -39,6 +45,10 @@ void lowerIfStmt(LLVMCodegen &cg, IfStmt *stmt) {
   else
     cg.builder.CreateCondBr(condVal, thenBB, mergeBB);
 
+  cg.sealBlock(thenBB);
+  if (elseBB)
+    cg.sealBlock(elseBB);
+
   cg.builder.SetInsertPoint(thenBB);
   lowerStmt(cg, stmt->thenBranch.get());
   if (!cg.builder.GetInsertBlock()->getTerminator())
@@ -51,6 +61,7 @@ void lowerIfStmt(LLVMCodegen &cg, IfStmt *stmt) {
       cg.builder.CreateBr(mergeBB);
   }
 
+  cg.sealBlock(mergeBB);
   cg.builder.SetInsertPoint(mergeBB);
 }
 
@@ -74,12 +85,17 @@ void lowerWhileStmt(LLVMCodegen &cg, WhileStmt *stmt) {
         condVal, ConstantInt::get(condVal->getType(), 0), "whilecond");
 
   cg.builder.CreateCondBr(condVal, bodyBB, exitBB);
+  cg.sealBlock(bodyBB);
+  cg.sealBlock(exitBB);
 
   cg.builder.SetInsertPoint(bodyBB);
   lowerStmt(cg, stmt->body.get());
   if (!cg.builder.GetInsertBlock()->getTerminator())
     cg.builder.CreateBr(condBB);
 
+  // the back edge exists now
+  cg.sealBlock(condBB);
+
   cg.builder.SetInsertPoint(exitBB);
 }
 
@@ -88,16 +104,419 @@ void lowerWhileStmt(LLVMCodegen &cg, WhileStmt *stmt) {
 void lowerReturnStmt(LLVMCodegen &cg, ReturnStmt *stmt) {
   if (stmt->value) {
     Value *retVal = lowerExpr(cg, stmt->value.get());
+    cg.releaseArrays(0);
     cg.builder.CreateRet(retVal);
   } else {
+    cg.releaseArrays(0);
     cg.builder.CreateRet(ConstantInt::get(Type::getInt32Ty(cg.ctx), 0));
   }
 }
 
 /* ================= FOR ================= */
 
+static MDNode *loopProperty(LLVMContext &ctx, const char *name,
+                            Metadata *value) {
+  return MDNode::get(ctx, {MDString::get(ctx, name), value});
+}
+
+// Tags every memory access with the loop's access group. Accesses in
+// nested parallel loops belong to several groups.
+static void addAccessGroup(Instruction *inst, MDNode *group) {
+  MDNode *old = inst->getMetadata(LLVMContext::MD_access_group);
+
+  if (!old) {
+    inst->setMetadata(LLVMContext::MD_access_group, group);
+    return;
+  }
+
+  SmallVector<Metadata *, 4> groups;
+  if (old->getNumOperands() == 0)
+    groups.push_back(old);
+  else
+    for (auto &op : old->operands())
+      groups.push_back(op.get());
+  groups.push_back(group);
+
+  inst->setMetadata(LLVMContext::MD_access_group,
+                    MDNode::get(inst->getContext(), groups));
+}
+
+// llvm.loop metadata for an annotated loop, attached to its back edge.
+static void annotateLoop(LLVMCodegen &cg, ForStmt *stmt, BranchInst *latch,
+                         const std::vector<BasicBlock *> &blocks) {
+
+  if (stmt->hint == LoopHint::None)
+    return;
+
+  LLVMContext &ctx = cg.ctx;
+  auto *i32 = Type::getInt32Ty(ctx);
+
+  // operand 0 is the loop id itself
+  SmallVector<Metadata *, 4> props = {nullptr};
+
+  props.push_back(loopProperty(ctx, "llvm.loop.vectorize.enable",
+                               ConstantAsMetadata::get(ConstantInt::getTrue(ctx))));
+
+  if (stmt->interleave > 0)
+    props.push_back(loopProperty(
+        ctx, "llvm.loop.interleave.count",
+        ConstantAsMetadata::get(ConstantInt::get(i32, stmt->interleave))));
+
+  if (stmt->hint == LoopHint::Parallel) {
+    MDNode *group = MDNode::getDistinct(ctx, {});
+
+    for (BasicBlock *bb : blocks)
+      for (Instruction &inst : *bb)
+        if (inst.mayReadOrWriteMemory())
+          addAccessGroup(&inst, group);
+
+    props.push_back(loopProperty(ctx, "llvm.loop.parallel_accesses", group));
+  }
+
+  MDNode *loopID = MDNode::getDistinct(ctx, props);
+  loopID->replaceOperandWith(0, loopID);
+  latch->setMetadata(LLVMContext::MD_loop, loopID);
+}
+
+/* ================= REFERENCES ================= */
+
+// Variables an expression refers to. When stored is given it also
+// gets the variables the expression may write: assignment targets,
+// and arrays handed to a call.
+static void collectRefs(Expr *e, std::set<std::string> &names,
+                        std::set<std::string> *stored = nullptr) {
+  if (auto *v = dynamic_cast<VariableExpr *>(e)) {
+    names.insert(v->name);
+  } else if (auto *i = dynamic_cast<IndexExpr *>(e)) {
+    collectRefs(i->array.get(), names, stored);
+    collectRefs(i->index.get(), names, stored);
+  } else if (auto *u = dynamic_cast<UnaryExpr *>(e)) {
+    collectRefs(u->right.get(), names, stored);
+  } else if (auto *b = dynamic_cast<BinaryExpr *>(e)) {
+    if (stored && b->op == "=") {
+      Expr *target = b->left.get();
+      if (auto *i = dynamic_cast<IndexExpr *>(target))
+        target = i->array.get();
+      if (auto *v = dynamic_cast<VariableExpr *>(target))
+        stored->insert(v->name);
+    }
+    collectRefs(b->left.get(), names, stored);
+    collectRefs(b->right.get(), names, stored);
+  } else if (auto *c = dynamic_cast<CallExpr *>(e)) {
+    for (auto &a : c->args) {
+      if (auto *v = dynamic_cast<VariableExpr *>(a.get());
+          v && stored && a->type.isArray())
+        stored->insert(v->name);
+      collectRefs(a.get(), names, stored);
+    }
+  }
+}
+
+// Variables a statement refers to; hasReturn is set if it can leave
+// the function.
+static void collectRefs(Stmt *s, std::set<std::string> &names, bool &hasReturn,
+                        std::set<std::string> *stored = nullptr) {
+  if (auto *x = dynamic_cast<ExprStmt *>(s)) {
+    collectRefs(x->e.get(), names, stored);
+  } else if (auto *x = dynamic_cast<PrintStmt *>(s)) {
+    collectRefs(x->e.get(), names, stored);
+  } else if (auto *x = dynamic_cast<VarDeclStmt *>(s)) {
+    if (x->length)
+      collectRefs(x->length.get(), names, stored);
+    if (x->initializer)
+      collectRefs(x->initializer.get(), names, stored);
+  } else if (auto *x = dynamic_cast<BlockStmt *>(s)) {
+    for (auto &st : x->stmts)
+      collectRefs(st.get(), names, hasReturn, stored);
+  } else if (auto *x = dynamic_cast<IfStmt *>(s)) {
+    collectRefs(x->condition.get(), names, stored);
+    collectRefs(x->thenBranch.get(), names, hasReturn, stored);
+    if (x->elseBranch)
+      collectRefs(x->elseBranch.get(), names, hasReturn, stored);
+  } else if (auto *x = dynamic_cast<WhileStmt *>(s)) {
+    collectRefs(x->condition.get(), names, stored);
+    collectRefs(x->body.get(), names, hasReturn, stored);
+  } else if (auto *x = dynamic_cast<ForStmt *>(s)) {
+    if (x->init)
+      collectRefs(x->init.get(), names, hasReturn, stored);
+    if (x->condition)
+      collectRefs(x->condition.get(), names, stored);
+    if (x->increment)
+      collectRefs(x->increment.get(), names, stored);
+    collectRefs(x->body.get(), names, hasReturn, stored);
+  } else if (auto *x = dynamic_cast<ReturnStmt *>(s)) {
+    if (x->value)
+      collectRefs(x->value.get(), names, stored);
+    hasReturn = true;
+  }
+}
+
+/* ================= PARALLEL FOR ================= */
+
+static bool isVar(const std::unique_ptr<Expr> &e, const std::string &name) {
+  auto *v = dynamic_cast<VariableExpr *>(e.get());
+  return v && v->name == name;
+}
+
+static bool isInt32(const LangType &t) { return t.isInt() && t.bitWidth == 32; }
+
+// Variables a loop body assigns, by symbol (by name for targets sema
+// did not bind).
+struct AssignedVars : RewritePass {
+  std::set<Symbol *> symbols;
+  std::set<std::string> unbound;
+
+  const char *name() const override { return "assigned-vars"; }
+  FeatureSet matches() const override { return FeatureSet::all(); }
+
+  unique_ptr<Expr> rewriteExpr(unique_ptr<Expr> expr) override {
+    auto *b = dynamic_cast<BinaryExpr *>(expr.get());
+    auto *v = b && b->op == "=" ? dynamic_cast<VariableExpr *>(b->left.get())
+                                : nullptr;
+    if (v && v->symbol)
+      symbols.insert(v->symbol);
+    else if (v)
+      unbound.insert(v->name);
+    return expr;
+  }
+
+  bool has(Symbol *sym, const std::string &name) const {
+    return (sym && symbols.count(sym)) || unbound.count(name);
+  }
+};
+
+/*
+    parallel for (i = a; i < b; i = i + 1) body
+
+    The body is outlined into `void f.parallel(i32 begin, i32 end, i8*
+    env)` running its own [begin, end) loop, and the loop itself
+    becomes a call to __nano_parallel_for(a, b, f.parallel, env).
+    env holds the variables the body uses: arrays by address (shared),
+    scalars by value (each chunk gets a private copy), and a failure
+    flag. b is evaluated once, and i holds the final bound afterwards.
+
+    A write to a captured scalar would only reach the chunk's copy, so
+    a body assigning one is rejected. An out-of-bounds index in a chunk
+    sets the flag, and the caller leaves the function after the loop
+    as the serial loop would have. Chunks that start after that skip
+    their iterations.
+
+    Returns false, leaving the loop to run serially, when it is not of
+    that form, its body contains a return or it assigns i.
+*/
+static bool lowerParallelFor(LLVMCodegen &cg, ForStmt *stmt) {
+
+  // ---- recognise the loop ----
+  auto *init = dynamic_cast<ExprStmt *>(stmt->init.get());
+  auto *start = init ? dynamic_cast<BinaryExpr *>(init->e.get()) : nullptr;
+  if (!start || start->op != "=")
+    return false;
+
+  auto *iv = dynamic_cast<VariableExpr *>(start->left.get());
+  VarInfo *ivInfo = iv ? cg.lookupVar(iv) : nullptr;
+  if (!ivInfo || ivInfo->ssa < 0 || !isInt32(ivInfo->type) ||
+      !isInt32(start->right->type))
+    return false;
+
+  const std::string &name = iv->name;
+
+  auto *cond = dynamic_cast<BinaryExpr *>(stmt->condition.get());
+  if (!cond || (cond->op != "<" && cond->op != "<=") ||
+      !isVar(cond->left, name) || !isInt32(cond->right->type))
+    return false;
+
+  auto *inc = dynamic_cast<BinaryExpr *>(stmt->increment.get());
+  auto *step = inc ? dynamic_cast<BinaryExpr *>(inc->right.get()) : nullptr;
+  auto *one = step ? dynamic_cast<NumberExpr *>(step->right.get()) : nullptr;
+  if (!inc || inc->op != "=" || !isVar(inc->left, name) || step->op != "+" ||
+      !isVar(step->left, name) || !one || one->isFloat || one->intValue != 1)
+    return false;
+
+  std::set<std::string> refs;
+  bool hasReturn = false;
+  collectRefs(stmt->body.get(), refs, hasReturn);
+  if (hasReturn)
+    return false;
+
+  AssignedVars assigned;
+  stmt->body = RewriteWalker({&assigned}).walkStmt(std::move(stmt->body));
+  if (assigned.has(ivInfo->symbol, name))
+    return false;
+
+  for (auto &ref : refs) {
+    VarInfo *info = cg.lookupVar(ref);
+    if (info && ref != name && !info->type.isArray() &&
+        assigned.has(info->symbol, ref))
+      throw CompileError("parallel for assigns '" + ref +
+                             "', declared outside the loop; each chunk "
+                             "would only update its own copy",
+                         stmt->loc.line, stmt->loc.col);
+  }
+
+  LLVMContext &ctx = cg.ctx;
+  Type *i32 = Type::getInt32Ty(ctx);
+  Type *i8ptr = Type::getInt8PtrTy(ctx);
+  Function *outer = cg.currentFunction;
+
+  // ---- captures ----
+  struct Capture {
+    std::string name;
+    LangType type;
+    Value *value;
+    Symbol *symbol;
+  };
+  std::vector<Capture> captures;
+  std::vector<Type *> fields;
+
+  for (auto &ref : refs) {
+    VarInfo *info = cg.lookupVar(ref);
+    if (!info || ref == name)
+      continue; // declared in the body, or the induction variable
+
+    Value *v = info->value ? info->value
+               : info->ssa >= 0
+                   ? cg.readVariable(info->ssa, cg.builder.GetInsertBlock())
+                   : cg.arrayRef(info, info->type);
+    captures.push_back({ref, info->type, v, info->symbol});
+    fields.push_back(v->getType());
+  }
+
+  unsigned failedField = fields.size();
+  fields.push_back(i32);
+
+  StructType *envTy = StructType::create(ctx, fields, "parallel.env");
+
+  // ---- call site ----
+  Value *begin = lowerExpr(cg, start->right.get());
+  Value *end = lowerExpr(cg, cond->right.get());
+  if (cond->op == "<=")
+    end = cg.builder.CreateAdd(end, ConstantInt::get(i32, 1));
+
+  IRBuilder<> tmp(&outer->getEntryBlock(), outer->getEntryBlock().begin());
+  AllocaInst *env = tmp.CreateAlloca(envTy, nullptr, "parallel.env");
+
+  for (unsigned k = 0; k < captures.size(); k++)
+    cg.builder.CreateStore(captures[k].value,
+                           cg.builder.CreateStructGEP(envTy, env, k));
+  Value *failed = cg.builder.CreateStructGEP(envTy, env, failedField);
+  cg.builder.CreateStore(ConstantInt::get(i32, 0), failed);
+
+  FunctionType *bodyTy =
+      FunctionType::get(Type::getVoidTy(ctx), {i32, i32, i8ptr}, false);
+  Function *bodyFn = Function::Create(bodyTy, Function::InternalLinkage,
+                                      outer->getName() + ".parallel",
+                                      cg.module);
+
+  FunctionCallee runtime = cg.module->getOrInsertFunction(
+      "__nano_parallel_for",
+      FunctionType::get(Type::getVoidTy(ctx),
+                        {i32, i32, bodyTy->getPointerTo(), i8ptr}, false));
+
+  cg.builder.CreateCall(runtime,
+                        {begin, end, bodyFn,
+                         cg.builder.CreateBitCast(env, i8ptr)});
+
+  BasicBlock *failBB = BasicBlock::Create(ctx, "parallel.failed", outer);
+  BasicBlock *after = BasicBlock::Create(ctx, "parallel.done", outer);
+  cg.builder.CreateCondBr(
+      cg.builder.CreateICmpNE(cg.builder.CreateLoad(i32, failed),
+                              ConstantInt::get(i32, 0)),
+      failBB, after);
+  cg.sealBlock(failBB);
+  cg.sealBlock(after);
+
+  cg.builder.SetInsertPoint(failBB);
+  cg.returnAfterFailure();
+
+  cg.builder.SetInsertPoint(after);
+  cg.writeVariable(ivInfo->ssa, after,
+                   cg.builder.CreateSelect(cg.builder.CreateICmpSLT(begin, end),
+                                           end, begin));
+
+  // ---- outlined body ----
+  auto outerScopes = std::move(cg.scopes);
+  cg.scopes.clear();
+  cg.scopes.emplace_back();
+  cg.currentFunction = bodyFn;
+  Value *outerFailed = cg.parallelFailed;
+
+  BasicBlock *entry = BasicBlock::Create(ctx, "entry", bodyFn);
+  cg.builder.SetInsertPoint(entry);
+  cg.sealBlock(entry);
+
+  Value *envArg =
+      cg.builder.CreateBitCast(bodyFn->getArg(2), envTy->getPointerTo());
+  cg.parallelFailed = cg.builder.CreateStructGEP(envTy, envArg, failedField);
+
+  for (unsigned k = 0; k < captures.size(); k++) {
+    auto &c = captures[k];
+    Value *v = cg.builder.CreateLoad(
+        fields[k], cg.builder.CreateStructGEP(envTy, envArg, k), c.name);
+
+    if (c.type.isArray())
+      cg.bindArray(c.name, c.type, v);
+    else
+      cg.writeVariable(cg.declareScalar(c.name, c.type), entry, v);
+    cg.link(c.symbol, c.name);
+  }
+
+  unsigned i = cg.declareScalar(name, ivInfo->type);
+  cg.writeVariable(i, entry, bodyFn->getArg(0));
+  cg.link(ivInfo->symbol, name);
+
+  BasicBlock *condBB = BasicBlock::Create(ctx, "for.cond", bodyFn);
+  BasicBlock *bodyBB = BasicBlock::Create(ctx, "for.body", bodyFn);
+  BasicBlock *incBB = BasicBlock::Create(ctx, "for.inc", bodyFn);
+  BasicBlock *exitBB = BasicBlock::Create(ctx, "for.exit", bodyFn);
+
+  // another chunk has already failed
+  LoadInst *skip = cg.builder.CreateLoad(i32, cg.parallelFailed);
+  skip->setAtomic(AtomicOrdering::Monotonic);
+  cg.builder.CreateCondBr(
+      cg.builder.CreateICmpNE(skip, ConstantInt::get(i32, 0)), exitBB, condBB);
+
+  cg.builder.SetInsertPoint(condBB);
+  cg.builder.CreateCondBr(
+      cg.builder.CreateICmpSLT(cg.readVariable(i, condBB), bodyFn->getArg(1)),
+      bodyBB, exitBB);
+  cg.sealBlock(bodyBB);
+  cg.sealBlock(exitBB);
+
+  cg.builder.SetInsertPoint(bodyBB);
+  lowerStmt(cg, stmt->body.get());
+  if (!cg.builder.GetInsertBlock()->getTerminator())
+    cg.builder.CreateBr(incBB);
+
+  cg.sealBlock(incBB);
+  cg.builder.SetInsertPoint(incBB);
+  cg.writeVariable(i, incBB,
+                   cg.builder.CreateAdd(cg.readVariable(i, incBB),
+                                        ConstantInt::get(i32, 1)));
+  BranchInst *latch = cg.builder.CreateBr(condBB);
+  cg.sealBlock(condBB);
+
+  std::vector<BasicBlock *> loopBlocks = {condBB, bodyBB, incBB};
+  for (auto it = std::next(exitBB->getIterator()); it != bodyFn->end(); ++it)
+    loopBlocks.push_back(&*it);
+  annotateLoop(cg, stmt, latch, loopBlocks);
+
+  cg.builder.SetInsertPoint(exitBB);
+  cg.builder.CreateRetVoid();
+
+  while (!cg.scopes.empty())
+    cg.exitScope();
+  cg.scopes = std::move(outerScopes);
+  cg.currentFunction = outer;
+  cg.parallelFailed = outerFailed;
+  cg.builder.SetInsertPoint(after);
+  return true;
+}
+
 void lowerForStmt(LLVMCodegen &cg, ForStmt *stmt) {
 
+  if (stmt->hint == LoopHint::Parallel && lowerParallelFor(cg, stmt))
+    return;
+
   cg.enterScope();
 
   if (stmt->init)
@@ -125,17 +544,30 @@ void lowerForStmt(LLVMCodegen &cg, ForStmt *stmt) {
   }
 
   cg.builder.CreateCondBr(condVal, bodyBB, exitBB);
+  cg.sealBlock(bodyBB);
+  cg.sealBlock(exitBB);
 
   cg.builder.SetInsertPoint(bodyBB);
   lowerStmt(cg, stmt->body.get());
   if (!cg.builder.GetInsertBlock()->getTerminator())
     cg.builder.CreateBr(incBB);
 
+  cg.sealBlock(incBB);
   cg.builder.SetInsertPoint(incBB);
   if (stmt->increment)
     lowerExpr(cg, stmt->increment.get());
 
-  cg.builder.CreateBr(condBB);
+  BranchInst *latch = cg.builder.CreateBr(condBB);
+
+  // the back edge exists now
+  cg.sealBlock(condBB);
+
+  // the loop: its own blocks and every block made while lowering it
+  std::vector<BasicBlock *> loopBlocks = {condBB, bodyBB, incBB};
+  for (auto it = std::next(exitBB->getIterator()); it != fn->end(); ++it)
+    loopBlocks.push_back(&*it);
+
+  annotateLoop(cg, stmt, latch, loopBlocks);
 
   cg.builder.SetInsertPoint(exitBB);
 
@@ -144,43 +576,106 @@ void lowerForStmt(LLVMCodegen &cg, ForStmt *stmt) {
 
 /* ================= FUNCTION ================= */
 
-void lowerFunctionStmt(LLVMCodegen &cg, FunctionStmt *stmt) {
+/*
+    A fixed array parameter is a pointer to the caller's array. It is
+    never captured and always points to the whole array. It is also
+    noalias, unless the caller could pass one array for two parameters
+    and the function writes to one of them.
+*/
+static void addArrayParamAttrs(LLVMCodegen &cg, FunctionStmt *stmt,
+                               Function *fn) {
 
-  Function *oldFunction = cg.currentFunction;
-  BasicBlock *oldInsertBlock = cg.builder.GetInsertBlock();
+  int arrays = 0;
+  for (auto &p : stmt->params)
+    arrays += p.second.isArray();
+  if (arrays == 0)
+    return;
 
-  std::vector<Type *> paramTypes;
+  std::set<std::string> refs, stored;
+  bool hasReturn = false;
+  collectRefs(stmt->body.get(), refs, hasReturn, &stored);
+
+  bool writes = false;
   for (auto &p : stmt->params)
-    paramTypes.push_back(cg.toLLVMType(p.second));
+    writes |= p.second.isArray() && stored.count(p.first);
+
+  const DataLayout &dl = cg.module->getDataLayout();
+
+  for (unsigned i = 0; i < stmt->params.size(); i++) {
+    const LangType &t = stmt->params[i].second;
+    if (!t.isArray() || t.isDynamicArray())
+      continue;
+
+    fn->addParamAttr(i, Attribute::NoCapture);
+    fn->addDereferenceableParamAttr(
+        i, dl.getTypeAllocSize(cg.toLLVMType(t)).getFixedSize());
+    if (arrays == 1 || !writes)
+      fn->addParamAttr(i, Attribute::NoAlias);
+  }
+}
+
+// The function's prototype, created on first use so that calls can
+// precede the definition.
+Function *declareFunction(LLVMCodegen &cg, FunctionStmt *stmt) {
+
+  if (Function *fn = cg.module->getFunction(stmt->name))
+    return fn;
+
+  // fixed arrays are passed by address
+  std::vector<Type *> paramTypes;
+  for (auto &p : stmt->params) {
+    Type *t = cg.toLLVMType(p.second);
+    if (p.second.isArray() && !p.second.isDynamicArray())
+      t = t->getPointerTo();
+    paramTypes.push_back(t);
+  }
 
   Type *retType = cg.toLLVMType(stmt->returnType);
 
   FunctionType *fnType = FunctionType::get(retType, paramTypes, false);
 
-  Function *fn = Function::Create(fnType, Function::ExternalLinkage, stmt->name,
-                                  cg.module);
+  return Function::Create(fnType, Function::ExternalLinkage, stmt->name,
+                          cg.module);
+}
+
+void lowerFunctionStmt(LLVMCodegen &cg, FunctionStmt *stmt) {
+
+  Function *oldFunction = cg.currentFunction;
+  BasicBlock *oldInsertBlock = cg.builder.GetInsertBlock();
+
+  Function *fn = declareFunction(cg, stmt);
+  Type *retType = fn->getReturnType();
+
+  // from the body, which the prototype may have been declared without
+  addArrayParamAttrs(cg, stmt, fn);
 
   cg.currentFunction = fn;
 
   BasicBlock *entry = BasicBlock::Create(cg.ctx, "entry", fn);
   cg.builder.SetInsertPoint(entry);
+  cg.sealBlock(entry);
 
   cg.enterScope();
 
   unsigned idx = 0;
   for (auto &arg : fn->args()) {
 
+    Symbol *paramSymbol =
+        idx < stmt->paramSymbols.size() ? stmt->paramSymbols[idx] : nullptr;
     auto &paramPair = stmt->params[idx++];
     const std::string &paramName = paramPair.first;
     LangType paramType = paramPair.second;
 
-    IRBuilder<> tmp(&fn->getEntryBlock(), fn->getEntryBlock().begin());
-
-    AllocaInst *slot = tmp.CreateAlloca(arg.getType(), nullptr, paramName);
+    arg.setName(paramName);
 
-    cg.builder.CreateStore(&arg, slot);
+    if (!paramType.isArray())
+      cg.writeVariable(cg.declareScalar(paramName, paramType), entry, &arg);
+    else if (paramType.isDynamicArray())
+      cg.bindArray(paramName, paramType, &arg);
+    else
+      cg.bind(paramName, paramType, &arg);
 
-    cg.bind(paramName, paramType, slot);
+    cg.link(paramSymbol, paramName);
   }
 
   lowerBlock(cg, stmt->body.get());
@@ -204,30 +699,50 @@ void lowerFunctionStmt(LLVMCodegen &cg, FunctionStmt *stmt) {
 
 void lowerVarDeclStmt(LLVMCodegen &cg, VarDeclStmt *stmt) {
 
-  Type *llvmType = cg.toLLVMType(stmt->type);
-
-  IRBuilder<> tmp(&cg.currentFunction->getEntryBlock(),
-                  cg.currentFunction->getEntryBlock().begin());
+  // ANF temporary: the initializer's value is used directly
+  if (stmt->isTemp) {
+    cg.bindValue(stmt->name, stmt->type,
+                 lowerExpr(cg, stmt->initializer.get()));
+    return;
+  }
 
-  AllocaInst *slot = tmp.CreateAlloca(llvmType, nullptr, stmt->name);
+  if (stmt->type.isDynamicArray()) {
+    cg.allocArray(stmt->name, stmt->type, lowerExpr(cg, stmt->length.get()));
+    cg.link(stmt->symbol, stmt->name);
+    return;
+  }
 
-  cg.bind(stmt->name, stmt->type, slot);
+  Type *llvmType = cg.toLLVMType(stmt->type);
 
-  if (stmt->initializer) {
+  // scalars are SSA values; they start out as zero
+  if (!stmt->type.isArray()) {
+    unsigned var = cg.declareScalar(stmt->name, stmt->type);
 
-    Value *initVal = lowerExpr(cg, stmt->initializer.get());
+    Value *initVal = Constant::getNullValue(llvmType);
 
-    if (initVal->getType() != llvmType) {
+    if (stmt->initializer) {
+      initVal = lowerExpr(cg, stmt->initializer.get());
 
-      if (initVal->getType()->isIntegerTy(32) && llvmType->isDoubleTy()) {
-        initVal = cg.builder.CreateSIToFP(initVal, llvmType);
-      } else {
-        llvm_unreachable("Type mismatch in variable declaration");
+      if (initVal->getType() != llvmType) {
+        if (initVal->getType()->isIntegerTy(32) && llvmType->isDoubleTy())
+          initVal = cg.builder.CreateSIToFP(initVal, llvmType);
+        else
+          llvm_unreachable("Type mismatch in variable declaration");
       }
     }
 
-    cg.builder.CreateStore(initVal, slot);
+    cg.writeVariable(var, cg.builder.GetInsertBlock(), initVal);
+    cg.link(stmt->symbol, stmt->name);
+    return;
   }
+
+  IRBuilder<> tmp(&cg.currentFunction->getEntryBlock(),
+                  cg.currentFunction->getEntryBlock().begin());
+
+  AllocaInst *slot = tmp.CreateAlloca(llvmType, nullptr, stmt->name);
+
+  cg.bind(stmt->name, stmt->type, slot);
+  cg.link(stmt->symbol, stmt->name);
 }
 
 /* ================= DISPATCH ================= */
@@ -245,11 +760,13 @@ void lowerStmt(LLVMCodegen &cg, Stmt *stmt) {
     Type *ty = v->getType();
 
     if (ty->isIntegerTy(32)) {
-      cg.emitPrintfInt(v);
+      cg.emitPrintInt(v);
     } else if (ty->isDoubleTy() || ty->isFloatTy()) {
-      cg.emitPrintfFloat(v);
+      cg.emitPrintFloat(v);
     } else if (ty->isIntegerTy(1)) {
-      cg.emitPrintfBool(v);
+      cg.emitPrintBool(v);
+    } else if (ty->isPointerTy()) {
+      cg.emitPrintStr(v);
     } else {
       llvm_unreachable("Unsupported print type");
     }
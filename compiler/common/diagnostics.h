@@ -0,0 +1,84 @@
+#pragma once
+#include <algorithm>
+#include <exception>
+#include <ostream>
+#include <vector>
+
+#include "error.h"
+
+/*
+    The errors of one compilation, so that a run reports all of them
+    instead of stopping at the first.
+
+    The lexer, the parser and the semantic passes report an error and
+    carry on from their next recovery point: the next character, the
+    next statement, the next function body. Without an engine (null)
+    they throw the first error as before.
+
+    After `limit` errors report() throws TooManyErrors; past that point
+    most errors are follow-ons of the earlier ones.
+*/
+struct TooManyErrors : std::exception {
+  const char *what() const noexcept override { return "too many errors"; }
+};
+
+class DiagnosticEngine {
+  std::vector<CompileError> errors;
+  size_t limit;
+
+public:
+  explicit DiagnosticEngine(size_t limit = 20) : limit(limit) {}
+
+  void report(const CompileError &e) {
+    errors.push_back(e);
+    if (errors.size() >= limit)
+      throw TooManyErrors();
+  }
+
+  // Appends other's errors after this engine's own.
+  void merge(const DiagnosticEngine &other) {
+    for (auto &e : other.errors)
+      report(e);
+  }
+
+  bool hasErrors() const { return !errors.empty(); }
+  size_t count() const { return errors.size(); }
+
+  static void print(std::ostream &os, const CompileError &e) {
+    os << "Error at line " << e.line << ", column " << e.col << ": "
+       << e.message << "\n";
+  }
+
+  // In source order: the lexer reports all of its errors before the
+  // parser reports any.
+  void print(std::ostream &os) const {
+    auto sorted = errors;
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const CompileError &a, const CompileError &b) {
+                       return a.line != b.line ? a.line < b.line
+                                               : a.col < b.col;
+                     });
+    for (auto &e : sorted)
+      print(os, e);
+    if (errors.size() >= limit)
+      os << "Too many errors, stopping\n";
+    else if (errors.size() > 1)
+      os << errors.size() << " errors\n";
+  }
+};
+
+// Runs f. With an engine, a CompileError from f is reported instead of
+// thrown; returns false if there was one.
+template <class F> bool recover(DiagnosticEngine *diag, F &&f) {
+  if (!diag) {
+    f();
+    return true;
+  }
+  try {
+    f();
+    return true;
+  } catch (const CompileError &e) {
+    diag->report(e);
+    return false;
+  }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+
+using namespace std;
+
+/*
+===========================================
+LARGE STACKS
+===========================================
+Every pass walks the AST recursively, so nesting depth costs C++
+stack. A machine-generated 100k-term sum is 100k frames deep in
+the parser, sema, the rewrites and codegen, far past the default
+8 MB. Work that walks the AST runs on a thread whose stack is
+reserved large up front; pages are only committed as they are
+touched, so depth is limited by memory instead.
+*/
+
+constexpr size_t kLargeStackBytes = size_t(1) << 30; // 1 GiB
+
+// Runs fn on its own thread with a large stack. If that thread
+// cannot be created, join() runs fn on the calling thread.
+class LargeStackThread {
+  pthread_t thread;
+  bool started = false;
+  function<void()> fn;
+  exception_ptr error;
+
+  static void *entry(void *self) {
+    auto *t = static_cast<LargeStackThread *>(self);
+    try {
+      t->fn();
+    } catch (...) {
+      t->error = current_exception();
+    }
+    return nullptr;
+  }
+
+public:
+  explicit LargeStackThread(function<void()> f,
+                            size_t bytes = kLargeStackBytes)
+      : fn(std::move(f)) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (pthread_attr_setstacksize(&attr, bytes) == 0)
+      started = pthread_create(&thread, &attr, entry, this) == 0;
+    pthread_attr_destroy(&attr);
+  }
+
+  LargeStackThread(const LargeStackThread &) = delete;
+  LargeStackThread &operator=(const LargeStackThread &) = delete;
+
+  // Waits for fn and rethrows what it threw.
+  void join() {
+    if (!started) {
+      fn();
+      return;
+    }
+    pthread_join(thread, nullptr);
+    if (error)
+      rethrow_exception(error);
+  }
+};
+
+inline void runOnLargeStack(function<void()> fn) {
+  LargeStackThread t(std::move(fn));
+  t.join();
+}
@@ -1,23 +1,82 @@
 #pragma once
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 using namespace std;
 
+// ================= CPS VARIABLES =================
+// Variables are dense indices; names are kept on the side
+// for printing and debugging only.
+using CPSVarId = uint32_t;
+
+struct CPSNames {
+  // the enclosing function's return continuation
+  static constexpr CPSVarId Return = 0;
+
+  vector<string> names = {"_return"};
+
+  CPSVarId add(string name) {
+    names.push_back(std::move(name));
+    return (CPSVarId)names.size() - 1;
+  }
+
+  // Compiler temporary; its name is only made up when printed.
+  CPSVarId fresh() { return add(string()); }
+
+  string operator[](CPSVarId v) const {
+    return names[v].empty() ? "_k" + to_string(v) : names[v];
+  }
+
+  size_t size() const { return names.size(); }
+};
+
 // ================= CPS VALUES =================
+// An atom: a variable or a literal, stored inline.
 struct CPSValue {
-  virtual ~CPSValue() = default;
-};
+  enum class Kind : uint8_t { Var, Int, Float };
+
+  Kind kind;
+  union {
+    CPSVarId var;
+    long long intValue;
+    double floatValue;
+  };
+
+  static CPSValue variable(CPSVarId v) {
+    CPSValue x(Kind::Var);
+    x.var = v;
+    return x;
+  }
+
+  static CPSValue integer(long long v) {
+    CPSValue x(Kind::Int);
+    x.intValue = v;
+    return x;
+  }
 
-struct CPSVar : CPSValue {
-  string name;
-  CPSVar(string n) : name(std::move(n)) {}
+  static CPSValue floating(double v) {
+    CPSValue x(Kind::Float);
+    x.floatValue = v;
+    return x;
+  }
+
+  bool isVar() const { return kind == Kind::Var; }
+
+private:
+  CPSValue(Kind k) : kind(k), intValue(0) {}
 };
 
-struct CPSInt : CPSValue {
-  int value;
-  CPSInt(int v) : value(v) {}
+// ================= PRIMITIVES =================
+enum class CPSPrimOp : uint8_t {
+  Add, Sub, Mul, Div, Mod,
+  Lt, Le, Gt, Ge, Eq, Ne,
+  And, Or,
+  Neg, Not,
+  ToFloat, // int to float; a float passes through unchanged
+  Print    // side effect only; the bound result is unused
 };
 
 // ================= CPS EXPRESSIONS =================
@@ -25,32 +84,79 @@ struct CPSExpr {
   virtual ~CPSExpr() = default;
 };
 
+// Call of a function or continuation. As a let right-hand side it is
+// an ordinary call of a function; in tail position it jumps to a
+// continuation, returns (CPSNames::Return) or tail-calls a function.
 struct CPSCall : CPSExpr {
-  string func;
-  vector<string> args;
-  CPSCall(string f, vector<string> a)
-      : func(std::move(f)), args(std::move(a)) {}
+  CPSVarId func;
+  vector<CPSValue> args;
+  CPSCall(CPSVarId f, vector<CPSValue> a) : func(f), args(std::move(a)) {}
+};
+
+// Primitive operation; only appears as the right-hand side of a let.
+struct CPSPrim : CPSExpr {
+  CPSPrimOp op;
+  vector<CPSValue> args;
+  CPSPrim(CPSPrimOp o, vector<CPSValue> a) : op(o), args(std::move(a)) {}
 };
 
 struct CPSLet : CPSExpr {
-  string var;
+  CPSVarId var;
   unique_ptr<CPSExpr> rhs;
   unique_ptr<CPSExpr> body;
 
-  CPSLet(string v, unique_ptr<CPSExpr> r, unique_ptr<CPSExpr> b)
-      : var(std::move(v)), rhs(std::move(r)), body(std::move(b)) {}
+  CPSLet(CPSVarId v, unique_ptr<CPSExpr> r, unique_ptr<CPSExpr> b)
+      : var(v), rhs(std::move(r)), body(std::move(b)) {}
 };
 
 struct CPSIf : CPSExpr {
-  string cond;
+  CPSValue cond;
   unique_ptr<CPSExpr> thenE;
   unique_ptr<CPSExpr> elseE;
 
-  CPSIf(string c, unique_ptr<CPSExpr> t, unique_ptr<CPSExpr> e)
-      : cond(std::move(c)), thenE(std::move(t)), elseE(std::move(e)) {}
+  CPSIf(CPSValue c, unique_ptr<CPSExpr> t, unique_ptr<CPSExpr> e)
+      : cond(c), thenE(std::move(t)), elseE(std::move(e)) {}
+};
+
+// letcont k(params) = contBody in body
+// Continuations are local and only ever called directly; k is in
+// scope in both contBody (loops) and body.
+struct CPSLetCont : CPSExpr {
+  CPSVarId k;
+  vector<CPSVarId> params;
+  unique_ptr<CPSExpr> contBody;
+  unique_ptr<CPSExpr> body;
+
+  CPSLetCont(CPSVarId k, vector<CPSVarId> p, unique_ptr<CPSExpr> c,
+             unique_ptr<CPSExpr> b)
+      : k(k), params(std::move(p)), contBody(std::move(c)),
+        body(std::move(b)) {}
 };
 
 struct CPSReturn : CPSExpr {
-  string value;
-  CPSReturn(string v) : value(std::move(v)) {}
+  CPSValue value;
+  CPSReturn(CPSValue v) : value(v) {}
+};
+
+// ================= CPS PROGRAM =================
+// Booleans are ints (0 / 1) in CPS.
+enum class CPSType : uint8_t { Void, Int, Float };
+
+struct CPSFunction {
+  CPSVarId name;
+  vector<CPSVarId> params;
+  unique_ptr<CPSExpr> body;
+
+  CPSType returnType = CPSType::Void;
+  vector<CPSType> paramTypes;
+};
+
+struct CPSModule {
+  CPSNames names;
+  vector<CPSFunction> functions;
+
+  // function name id -> index into functions
+  unordered_map<CPSVarId, size_t> functionIndex;
+
+  bool isFunction(CPSVarId v) const { return functionIndex.count(v) != 0; }
 };
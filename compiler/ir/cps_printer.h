@@ -9,32 +9,67 @@ using namespace std;
 
 struct CPSPrinter {
 
+    const CPSNames& names;
+
+    CPSPrinter(const CPSNames& n) : names(n) {}
+
+    void print(const CPSModule& m) {
+        for (auto& f : m.functions) {
+            cout << "function " << names[f.name] << "(";
+            for (size_t i = 0; i < f.params.size(); i++) {
+                cout << names[f.params[i]];
+                if (i + 1 < f.params.size()) cout << ", ";
+            }
+            cout << "):\n";
+            print(f.body.get(), 2);
+        }
+    }
+
     void print(CPSExpr* e, int indent = 0) {
         string pad(indent, ' ');
 
         // -------- CALL --------
         if (auto x = dynamic_cast<CPSCall*>(e)) {
-            cout << pad << "call " << x->func << "(";
-            for (size_t i = 0; i < x->args.size(); i++) {
-                cout << x->args[i];
-                if (i + 1 < x->args.size()) cout << ", ";
-            }
+            cout << pad << "call " << names[x->func] << "(";
+            printArgs(x->args);
+            cout << ")\n";
+            return;
+        }
+
+        // -------- PRIMITIVE --------
+        if (auto x = dynamic_cast<CPSPrim*>(e)) {
+            cout << pad << opName(x->op) << "(";
+            printArgs(x->args);
             cout << ")\n";
             return;
         }
 
         // -------- LET --------
         if (auto x = dynamic_cast<CPSLet*>(e)) {
-            cout << pad << "let " << x->var << " =\n";
+            cout << pad << "let " << names[x->var] << " =\n";
             print(x->rhs.get(), indent + 2);
             cout << pad << "in\n";
             print(x->body.get(), indent + 2);
             return;
         }
 
+        // -------- LETCONT --------
+        if (auto x = dynamic_cast<CPSLetCont*>(e)) {
+            cout << pad << "letcont " << names[x->k] << "(";
+            for (size_t i = 0; i < x->params.size(); i++) {
+                cout << names[x->params[i]];
+                if (i + 1 < x->params.size()) cout << ", ";
+            }
+            cout << ") =\n";
+            print(x->contBody.get(), indent + 2);
+            cout << pad << "in\n";
+            print(x->body.get(), indent + 2);
+            return;
+        }
+
         // -------- IF --------
         if (auto x = dynamic_cast<CPSIf*>(e)) {
-            cout << pad << "if " << x->cond << " then\n";
+            cout << pad << "if " << value(x->cond) << " then\n";
             print(x->thenE.get(), indent + 2);
             cout << pad << "else\n";
             print(x->elseE.get(), indent + 2);
@@ -43,4 +78,45 @@ struct CPSPrinter {
 
         cout << pad << "<unknown cps expr>\n";
     }
+
+    string value(const CPSValue& v) const {
+        switch (v.kind) {
+        case CPSValue::Kind::Var:   return names[v.var];
+        case CPSValue::Kind::Int:   return to_string(v.intValue);
+        case CPSValue::Kind::Float: return to_string(v.floatValue);
+        }
+        return "?";
+    }
+
+    static const char* opName(CPSPrimOp op) {
+        switch (op) {
+        case CPSPrimOp::Add: return "+";
+        case CPSPrimOp::Sub: return "-";
+        case CPSPrimOp::Mul: return "*";
+        case CPSPrimOp::Div: return "/";
+        case CPSPrimOp::Mod: return "%";
+        case CPSPrimOp::Lt:  return "<";
+        case CPSPrimOp::Le:  return "<=";
+        case CPSPrimOp::Gt:  return ">";
+        case CPSPrimOp::Ge:  return ">=";
+        case CPSPrimOp::Eq:  return "==";
+        case CPSPrimOp::Ne:  return "!=";
+        case CPSPrimOp::And: return "&&";
+        case CPSPrimOp::Or:  return "||";
+        case CPSPrimOp::Neg: return "neg";
+        case CPSPrimOp::Not: return "not";
+        case CPSPrimOp::ToFloat: return "tofloat";
+        case CPSPrimOp::Print: return "print";
+        }
+        return "?";
+    }
+
+private:
+
+    void printArgs(const vector<CPSValue>& args) {
+        for (size_t i = 0; i < args.size(); i++) {
+            cout << value(args[i]);
+            if (i + 1 < args.size()) cout << ", ";
+        }
+    }
 };
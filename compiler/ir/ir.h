@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+/*
+===========================================
+MID-LEVEL IR
+===========================================
+Three-address SSA form. Every function owns one
+contiguous pool of instructions; a value is named
+by the index of the instruction that defines it.
+Blocks list the instructions they contain, phis
+first. Constants belong to no block: they are
+function-wide and interned once per value.
+Variable-length operand lists (phi inputs, call
+arguments) live in side arrays of the function.
+*/
+
+using ValueId = uint32_t;
+using BlockId = uint32_t;
+
+constexpr ValueId NoValue = UINT32_MAX;
+
+enum class IRType : uint8_t { Void, I1, I32, F64, Str };
+
+enum class IROp : uint8_t {
+  Const,  // imm / fimm, or a = string index for Str
+  Param,  // a = parameter index
+  Assign, // copy of a; removed by copy propagation
+
+  Add, Sub, Mul, Div, Mod,
+  Neg, Not,
+  And, Or,
+  Lt, Le, Gt, Ge, Eq, Ne,
+  IToF,
+
+  Phi,  // a = first entry in phiOperands, b = count, c = block
+  Call, // a = callee function index, b = first arg in operands, c = count
+  Print,
+
+  // terminators
+  Return, // a = value or NoValue
+  Jump,   // a = target block
+  Branch  // a = condition, b = block if true, c = block if false
+};
+
+struct IRInstr {
+  IROp op;
+  IRType type = IRType::Void;
+
+  uint32_t a = NoValue;
+  uint32_t b = NoValue;
+  uint32_t c = NoValue;
+
+  union {
+    int64_t imm;
+    double fimm;
+  };
+
+  IRInstr(IROp o, IRType t) : op(o), type(t), imm(0) {}
+
+  bool isTerminator() const {
+    return op == IROp::Return || op == IROp::Jump || op == IROp::Branch;
+  }
+
+  // Instructions that must stay even if their value is unused.
+  bool hasSideEffects() const {
+    return isTerminator() || op == IROp::Call || op == IROp::Print;
+  }
+};
+
+struct IRPhiOperand {
+  BlockId block;
+  ValueId value;
+};
+
+struct IRBlock {
+  vector<ValueId> phis;
+  vector<ValueId> instrs;
+  vector<BlockId> preds;
+
+  ValueId terminator() const {
+    return instrs.empty() ? NoValue : instrs.back();
+  }
+};
+
+struct IRFunction {
+  string name;
+  IRType returnType = IRType::Void;
+  vector<IRType> params;
+
+  vector<IRInstr> instrs;
+  vector<IRBlock> blocks;
+
+  vector<ValueId> operands;
+  vector<IRPhiOperand> phiOperands;
+
+  BlockId newBlock() {
+    blocks.emplace_back();
+    return (BlockId)blocks.size() - 1;
+  }
+
+  ValueId add(IRInstr i) {
+    instrs.push_back(i);
+    return (ValueId)instrs.size() - 1;
+  }
+
+  // Calls fn(ValueId &) on every value operand of instruction v.
+  template <class F> void forEachOperand(ValueId v, F fn) {
+    IRInstr &i = instrs[v];
+
+    switch (i.op) {
+    case IROp::Const:
+    case IROp::Param:
+    case IROp::Jump:
+      return;
+
+    case IROp::Phi:
+      for (uint32_t k = 0; k < i.b; k++)
+        fn(phiOperands[i.a + k].value);
+      return;
+
+    case IROp::Call:
+      for (uint32_t k = 0; k < i.c; k++)
+        fn(operands[i.b + k]);
+      return;
+
+    case IROp::Assign:
+    case IROp::Neg:
+    case IROp::Not:
+    case IROp::IToF:
+    case IROp::Print:
+    case IROp::Branch:
+      fn(i.a);
+      return;
+
+    case IROp::Return:
+      if (i.a != NoValue)
+        fn(i.a);
+      return;
+
+    default:
+      fn(i.a);
+      fn(i.b);
+      return;
+    }
+  }
+
+  // Successors of a block, read off its terminator.
+  vector<BlockId> successors(BlockId b) const {
+    ValueId t = blocks[b].terminator();
+    if (t == NoValue)
+      return {};
+    const IRInstr &i = instrs[t];
+    if (i.op == IROp::Jump)
+      return {i.a};
+    if (i.op == IROp::Branch)
+      return {i.b, i.c};
+    return {};
+  }
+
+  // Blocks reachable from the entry, in reverse post-order.
+  vector<BlockId> reversePostOrder() const {
+    vector<BlockId> order;
+    vector<uint8_t> state(blocks.size(), 0);
+    vector<pair<BlockId, size_t>> stack;
+
+    if (blocks.empty())
+      return order;
+
+    stack.push_back({0, 0});
+    state[0] = 1;
+
+    while (!stack.empty()) {
+      auto &[b, next] = stack.back();
+      auto succ = successors(b);
+      if (next < succ.size()) {
+        BlockId s = succ[next++];
+        if (!state[s]) {
+          state[s] = 1;
+          stack.push_back({s, 0});
+        }
+        continue;
+      }
+      order.push_back(b);
+      stack.pop_back();
+    }
+
+    return vector<BlockId>(order.rbegin(), order.rend());
+  }
+};
+
+struct IRModule {
+  vector<IRFunction> functions;
+  vector<string> strings;
+
+  unordered_map<string, uint32_t> functionIndex;
+
+  uint32_t internString(const string &s) {
+    strings.push_back(s);
+    return (uint32_t)strings.size() - 1;
+  }
+};
@@ -4,82 +4,160 @@
 #include <vector>
 #include <string>
 
-using namespace std;
-
-enum class IROp {
-    Assign,
-    Add, Sub, Mul, Div, Mod,
-    Print,
-    Return,
-    Label,
-    Jump,
-    JumpIfFalse
-};
+#include "ir.h"
 
-struct IRInstr {
-    IROp op;
-    string dst;
-    string src1;
-    string src2;
-};
+using namespace std;
 
 struct IRPrinter {
 
-    static void print(const vector<IRInstr>& ir) {
+    static void print(const IRModule& m) {
         cout << "\n===== IR DUMP =====\n";
-        for (auto& i : ir)
-            printInstr(i);
+        for (auto& f : m.functions)
+            printFunction(m, f);
         cout << "===================\n";
     }
 
+    static void printFunction(const IRModule& m, const IRFunction& f) {
+        cout << "function " << f.name << "(";
+        for (size_t i = 0; i < f.params.size(); i++) {
+            cout << typeName(f.params[i]);
+            if (i + 1 < f.params.size()) cout << ", ";
+        }
+        cout << ") : " << typeName(f.returnType) << "\n";
+
+        for (ValueId v = 0; v < f.instrs.size(); v++)
+            if (f.instrs[v].op == IROp::Const)
+                printInstr(m, f, v);
+
+        for (BlockId b = 0; b < f.blocks.size(); b++) {
+            auto& blk = f.blocks[b];
+
+            // blocks emptied by unreachable-code removal
+            if (b != 0 && blk.instrs.empty() && blk.phis.empty())
+                continue;
+
+            cout << "bb" << b << ":";
+            if (!blk.preds.empty()) {
+                cout << "  ; preds";
+                for (auto p : blk.preds) cout << " bb" << p;
+            }
+            cout << "\n";
+
+            for (auto v : blk.phis)
+                printInstr(m, f, v);
+            for (auto v : blk.instrs)
+                printInstr(m, f, v);
+        }
+        cout << "\n";
+    }
+
+    static const char* typeName(IRType t) {
+        switch (t) {
+        case IRType::Void: return "void";
+        case IRType::I1:   return "i1";
+        case IRType::I32:  return "i32";
+        case IRType::F64:  return "f64";
+        case IRType::Str:  return "str";
+        }
+        return "?";
+    }
+
 private:
 
-    static void printInstr(const IRInstr& i) {
+    static string val(ValueId v) {
+        return v == NoValue ? "undef" : "%" + to_string(v);
+    }
+
+    static const char* opName(IROp op) {
+        switch (op) {
+        case IROp::Add: return "add";
+        case IROp::Sub: return "sub";
+        case IROp::Mul: return "mul";
+        case IROp::Div: return "div";
+        case IROp::Mod: return "mod";
+        case IROp::And: return "and";
+        case IROp::Or:  return "or";
+        case IROp::Lt:  return "lt";
+        case IROp::Le:  return "le";
+        case IROp::Gt:  return "gt";
+        case IROp::Ge:  return "ge";
+        case IROp::Eq:  return "eq";
+        case IROp::Ne:  return "ne";
+        case IROp::Neg: return "neg";
+        case IROp::Not: return "not";
+        case IROp::IToF: return "itof";
+        default: return "?";
+        }
+    }
+
+    static void printInstr(const IRModule& m, const IRFunction& f, ValueId v) {
+        const IRInstr& i = f.instrs[v];
+        cout << "  ";
+
+        if (i.type != IRType::Void && !i.isTerminator() && i.op != IROp::Print)
+            cout << val(v) << " = ";
+
         switch (i.op) {
 
-        case IROp::Assign:
-            cout << i.dst << " = " << i.src1 << "\n";
+        case IROp::Const:
+            cout << typeName(i.type) << " ";
+            if (i.type == IRType::F64) cout << i.fimm;
+            else if (i.type == IRType::Str) cout << "\"" << m.strings[i.a] << "\"";
+            else cout << i.imm;
             break;
 
-        case IROp::Add:
-            cout << i.dst << " = " << i.src1 << " + " << i.src2 << "\n";
+        case IROp::Param:
+            cout << "param " << i.a;
             break;
 
-        case IROp::Sub:
-            cout << i.dst << " = " << i.src1 << " - " << i.src2 << "\n";
+        case IROp::Assign:
+            cout << val(i.a);
             break;
 
-        case IROp::Mul:
-            cout << i.dst << " = " << i.src1 << " * " << i.src2 << "\n";
+        case IROp::Neg:
+        case IROp::Not:
+        case IROp::IToF:
+            cout << opName(i.op) << " " << val(i.a);
             break;
 
-        case IROp::Div:
-            cout << i.dst << " = " << i.src1 << " / " << i.src2 << "\n";
+        case IROp::Phi:
+            cout << "phi " << typeName(i.type);
+            for (uint32_t k = 0; k < i.b; k++) {
+                auto& p = f.phiOperands[i.a + k];
+                cout << (k ? ", " : " ") << "[bb" << p.block << ": " << val(p.value) << "]";
+            }
             break;
 
-        case IROp::Mod:
-            cout << i.dst << " = " << i.src1 << " % " << i.src2 << "\n";
+        case IROp::Call:
+            cout << "call " << m.functions[i.a].name << "(";
+            for (uint32_t k = 0; k < i.c; k++)
+                cout << (k ? ", " : "") << val(f.operands[i.b + k]);
+            cout << ")";
             break;
-    
+
         case IROp::Print:
-            cout << "print " << i.src1 << "\n";
+            cout << "print " << val(i.a);
             break;
 
         case IROp::Return:
-            cout << "return " << i.src1 << "\n";
+            cout << "return";
+            if (i.a != NoValue) cout << " " << val(i.a);
             break;
 
-        case IROp::Label:
-            cout << i.dst << ":\n";
+        case IROp::Jump:
+            cout << "goto bb" << i.a;
             break;
 
-        case IROp::Jump:
-            cout << "goto " << i.dst << "\n";
+        case IROp::Branch:
+            cout << "if " << val(i.a) << " goto bb" << i.b << " else bb" << i.c;
             break;
 
-        case IROp::JumpIfFalse:
-            cout << "ifFalse " << i.src1 << " goto " << i.dst << "\n";
+        default:
+            cout << opName(i.op) << " " << typeName(i.type) << " "
+                 << val(i.a) << ", " << val(i.b);
             break;
         }
+
+        cout << "\n";
     }
 };
@@ -1,14 +1,17 @@
 #pragma once
 
+#include "../common/diagnostics.h"
 #include "../lexer/token.h"
 #include <cctype>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 class Lexer {
-  std::string src;
+  // not owned; the caller keeps the source alive while tokens are scanned
+  std::string_view src;
   size_t start = 0;
   size_t current = 0;
   int line = 1;
@@ -16,8 +19,12 @@ class Lexer {
 
   std::unordered_map<std::string, TokenType> kw;
 
+  // bad characters are reported here and skipped
+  DiagnosticEngine *diag;
+
 public:
-  Lexer(std::string s) : src(std::move(s)) {
+  Lexer(std::string_view s, DiagnosticEngine *diag = nullptr)
+      : src(s), diag(diag) {
 
     // language keywords
     kw["let"] = TokenType::LET;
@@ -26,6 +33,8 @@ public:
     kw["else"] = TokenType::ELSE;
     kw["while"] = TokenType::WHILE;
     kw["for"] = TokenType::FOR;
+    kw["parallel"] = TokenType::PARALLEL;
+    kw["simd"] = TokenType::SIMD;
     kw["print"] = TokenType::PRINT;
     kw["return"] = TokenType::RETURN;
 
@@ -46,8 +55,17 @@ public:
 
   std::vector<Token> scanTokens() {
     std::vector<Token> tokens;
+    while (scanToken(tokens)) {
+    }
+    return tokens;
+  }
+
+  // Appends the next token to tokens, skipping whitespace and comments.
+  // Returns false once it has appended END_OF_FILE.
+  bool scanToken(std::vector<Token> &tokens) {
+    size_t before = tokens.size();
 
-    while (!isAtEnd()) {
+    while (!isAtEnd() && tokens.size() == before) {
       start = current;
       char c = advance();
 
@@ -64,11 +82,17 @@ public:
         break;
 
       case '+':
-        tokens.push_back(makeToken(TokenType::PLUS));
+        if (match('+'))
+          tokens.push_back(makeToken(TokenType::PLUS_PLUS));
+        else if (match('='))
+          tokens.push_back(makeToken(TokenType::PLUS_EQUAL));
+        else
+          tokens.push_back(makeToken(TokenType::PLUS));
         break;
 
       case '-':
-        tokens.push_back(makeToken(TokenType::MINUS));
+        tokens.push_back(makeToken(match('-') ? TokenType::MINUS_MINUS
+                                              : TokenType::MINUS));
         break;
 
       case '*':
@@ -83,14 +107,14 @@ public:
         if (match('&'))
           tokens.push_back(makeToken(TokenType::AND_AND));
         else
-          throw std::runtime_error("Unexpected character '&'");
+          error("Unexpected character '&'");
         break;
 
       case '|':
         if (match('|'))
           tokens.push_back(makeToken(TokenType::OR_OR));
         else
-          throw std::runtime_error("Unexpected character '|'");
+          error("Unexpected character '|'");
         break;
 
       case '/':
@@ -172,7 +196,7 @@ public:
 
       case '"': {
         int stringLine = line;
-        int stringCol = col;
+        int stringCol = startCol();
 
         while (peek() != '"' && !isAtEnd()) {
           if (peek() == '\n') {
@@ -182,12 +206,14 @@ public:
           advance();
         }
 
-        if (isAtEnd())
-          throw std::runtime_error("Unterminated string literal");
+        if (isAtEnd()) {
+          error("Unterminated string literal", stringLine, stringCol);
+          break;
+        }
 
         advance();
 
-        std::string value = src.substr(start + 1, current - start - 2);
+        std::string value(src.substr(start + 1, current - start - 2));
         tokens.push_back(
             Token{TokenType::STRING, value, stringLine, stringCol});
         break;
@@ -199,17 +225,32 @@ public:
         } else if (isAlpha(c)) {
           identifier(tokens);
         } else {
-          throw std::runtime_error(std::string("Unexpected character: ") + c);
+          error(std::string("Unexpected character: ") + c);
         }
         break;
       }
     }
 
+    if (tokens.size() != before)
+      return true;
+
     tokens.push_back(Token{TokenType::END_OF_FILE, "", line, col});
-    return tokens;
+    return false;
   }
 
 private:
+  // at the start of the current token by default
+  void error(const std::string &msg) { error(msg, line, startCol()); }
+
+  void error(const std::string &msg, int l, int c) {
+    CompileError e(msg, l, c);
+    if (!diag)
+      throw e;
+    diag->report(e);
+  }
+
+  int startCol() const { return col - (int)(current - start); }
+
   bool isAtEnd() const { return current >= src.size(); }
 
   char advance() {
@@ -235,8 +276,8 @@ private:
   }
 
   Token makeToken(TokenType type) {
-    std::string lex = src.substr(start, current - start);
-    return Token{type, lex, line, col};
+    std::string lex(src.substr(start, current - start));
+    return Token{type, lex, line, startCol()};
   }
 
   bool isAlpha(char c) const {
@@ -264,12 +305,12 @@ private:
     while (isAlphaNum(peek()))
       advance();
 
-    std::string text = src.substr(start, current - start);
+    std::string text(src.substr(start, current - start));
 
     auto it = kw.find(text);
     if (it != kw.end())
-      tokens.push_back(Token{it->second, text, line, col});
+      tokens.push_back(Token{it->second, text, line, startCol()});
     else
-      tokens.push_back(Token{TokenType::IDENTIFIER, text, line, col});
+      tokens.push_back(Token{TokenType::IDENTIFIER, text, line, startCol()});
   }
 };
@@ -25,6 +25,8 @@ enum class TokenType {
   ELSE,
   WHILE,
   FOR,
+  PARALLEL,
+  SIMD,
   PRINT,
   RETURN,
 
@@ -41,7 +43,10 @@ enum class TokenType {
 
   // Operators
   PLUS,
+  PLUS_PLUS,
+  PLUS_EQUAL,
   MINUS,
+  MINUS_MINUS,
   STAR,
   SLASH,
   MOD,
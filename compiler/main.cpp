@@ -1,3 +1,4 @@
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <memory>
@@ -7,22 +8,178 @@
 #include <llvm/IR/Verifier.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include "ast/flat_ast.h"
+#include "codegen/cps_codegen.h"
+#include "common/large_stack.h"
+#include "codegen/ir_codegen.h"
 #include "codegen/llvm_codegen.h"
+#include "common/diagnostics.h"
 #include "lexer/lexer.h"
 #include "parser/parser.h"
+#include "ir/cps_printer.h"
+#include "ir/ir_printer.h"
+#include "passes/anf_pass.h"
+#include "passes/cps_pass.h"
+#include "passes/cps_shrink.h"
+#include "passes/ir_opt.h"
+#include "passes/ir_pass.h"
+#include "passes/pass_manager.h"
 #include "sema/resolve_scopes.h"
+#include "sema/sema_pass.h"
 #include "sema/type_check.h"
 
 extern void lowerStmt(LLVMCodegen &, Stmt *);
+extern llvm::Function *declareFunction(LLVMCodegen &, FunctionStmt *);
+
+// Rewrites a function body into A-normal form. ANF does not look
+// into for loop headers, so plain for loops are desugared to while
+// loops first; parallel/simd loops keep their header for codegen.
+static void toANF(ANFPass &anf, FunctionStmt *fn) {
+  fn->body = unique_ptr<BlockStmt>(static_cast<BlockStmt *>(
+      DesugarForPass(true).transform(std::move(fn->body)).release()));
+  anf.transformBlock(fn->body.get());
+}
+
+static void toANF(std::vector<std::unique_ptr<Stmt>> &program) {
+  ANFPass anf;
+
+  for (auto &stmt : program)
+    if (auto *fn = dynamic_cast<FunctionStmt *>(stmt.get()))
+      toANF(anf, fn);
+}
+
+static int verifyAndPrint(llvm::Module &module) {
+  if (llvm::verifyModule(module, &llvm::errs())) {
+    llvm::errs() << "LLVM verification failed\n";
+    return 1;
+  }
+
+  module.print(llvm::outs(), nullptr);
+  return 0;
+}
+
+// --stream: compiles one top-level function at a time. A first scan
+// only collects the signatures, skipping bodies, so that calls may
+// precede their callee. The second parses, checks and lowers each
+// function, then frees its tokens, AST and symbols before reading
+// the next. Memory is then bounded by the largest function plus the
+// module being built, instead of the whole program's tokens and AST.
+//
+// Errors go to diag; after the first one, functions are still parsed
+// and checked but no longer lowered.
+static void compileStreaming(std::string_view source, DiagnosticEngine &diag,
+                             bool useANF, LLVMCodegen &cg) {
+
+  // ---------------- signatures ----------------
+  std::vector<std::unique_ptr<Stmt>> signatures;
+  {
+    // syntax errors are reported by the second scan
+    DiagnosticEngine ignored(SIZE_MAX);
+    Lexer lexer(source, &ignored);
+    Parser parser(&lexer, &ignored);
+    parser.skipBodies = true;
+
+    while (!parser.done())
+      if (auto stmt = parser.nextStatement())
+        if (dynamic_cast<FunctionStmt *>(stmt.get()))
+          signatures.push_back(std::move(stmt));
+  }
+
+  SemaPass globals(&diag);
+  for (auto &stmt : signatures) {
+    auto *fn = static_cast<FunctionStmt *>(stmt.get());
+    if (recover(&diag, [&] { globals.declareFunction(fn); }))
+      declareFunction(cg, fn);
+  }
+  recover(&diag, [&] { globals.checkMain(signatures); });
+
+  // ---------------- bodies ----------------
+  Lexer lexer(source, &diag);
+  Parser parser(&lexer, &diag);
+  PassManager lowering = PassManager::lowering();
+  PassManager folding = PassManager::typedFolding();
+  ANFPass anf;
+
+  while (!parser.done()) {
+    std::unique_ptr<Stmt> stmt = parser.nextStatement();
+    if (!stmt)
+      continue;
+
+    auto *fn = dynamic_cast<FunctionStmt *>(stmt.get());
+    if (!fn) {
+      diag.report(CompileError("Only function declarations allowed at top level",
+                               stmt->loc.line, stmt->loc.col));
+      continue;
+    }
+    lowering.run(fn, &diag);
+    if (fn->hasSyntaxErrors)
+      continue;
+
+    auto symbols = globals.checkFunction(fn, &diag);
+
+    if (diag.hasErrors())
+      continue;
+
+    folding.run(fn);
+
+    if (useANF)
+      toANF(anf, fn);
+
+    lowerStmt(cg, fn);
+    cg.finishFunction();
+  }
+}
 
 int main(int argc, char **argv) {
 
-  if (argc < 2) {
-    std::cerr << "Usage: compiler <file>\n";
+  bool emitCPS = false;
+  bool useIR = false;
+  bool emitIR = false;
+  bool useCPS = false;
+  bool useANF = false;
+  bool splitSema = false;
+  bool emitFlat = false;
+  bool stream = false;
+  const char *path = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--emit-cps")
+      emitCPS = true;
+    else if (arg == "--ir")
+      useIR = true;
+    else if (arg == "--emit-ir")
+      emitIR = true;
+    else if (arg == "--cps")
+      useCPS = true;
+    else if (arg == "--anf")
+      useANF = true;
+    else if (arg == "--split-sema")
+      splitSema = true;
+    else if (arg == "--emit-flat")
+      emitFlat = true;
+    else if (arg == "--stream")
+      stream = true;
+    else
+      path = argv[i];
+  }
+
+  if (!path) {
+    std::cerr << "Usage: compiler [--emit-cps] [--emit-ir] [--ir] [--cps] [--anf] [--split-sema] [--emit-flat] [--stream] <file>\n";
     return 1;
   }
 
-  std::ifstream file(argv[1]);
+  if (stream && (emitCPS || useIR || emitIR || useCPS || splitSema || emitFlat)) {
+    std::cerr << "--stream only combines with --anf\n";
+    return 1;
+  }
+
+  if (useCPS && (useIR || emitIR)) {
+    std::cerr << "--cps does not combine with --ir or --emit-ir\n";
+    return 1;
+  }
+
+  std::ifstream file(path);
   if (!file) {
     std::cerr << "Could not open file\n";
     return 1;
@@ -32,79 +189,208 @@ int main(int argc, char **argv) {
   buffer << file.rdbuf();
   std::string source = buffer.str();
 
-  try {
+  // Errors up to the end of sema are collected, not fatal.
+  DiagnosticEngine diag;
 
-    // -------------------------
-    // LEX
-    // -------------------------
-    Lexer lexer(source);
-    auto tokens = lexer.scanTokens();
+  auto failed = [&] {
+    std::cerr << "Compilation failed:\n";
+    diag.print(std::cerr);
+    return 1;
+  };
 
-    // -------------------------
-    // PARSE
-    // -------------------------
-    Parser parser(tokens);
-    auto program = parser.parseProgram();
+  // Nesting depth is stack depth in every pass; see large_stack.h.
+  auto compile = [&]() -> int {
+    try {
 
-    // --------------------------------
-    // SEMANTIC ANALYSIS
-    // --------------------------------
-    ResolveScopesPass resolver;
-    resolver.resolve(program);
+      if (stream) {
+        llvm::LLVMContext ctx;
+        llvm::Module module("nano_module", ctx);
+        LLVMCodegen cg(ctx, &module);
 
-    TypeCheckPass typeChecker;
-    typeChecker.check(program);
+        compileStreaming(source, diag, useANF, cg);
+        if (diag.hasErrors())
+          return failed();
+        return verifyAndPrint(module);
+      }
 
-    // --------------------------------
-    // LLVM SETUP (Only if semantic OK)
-    // --------------------------------
-    llvm::LLVMContext ctx;
-    llvm::Module module("nano_module", ctx);
-    LLVMCodegen cg(ctx, &module);
+      // -------------------------
+      // LEX
+      // -------------------------
+      Lexer lexer(source, &diag);
+      auto tokens = lexer.scanTokens();
 
-    bool foundMain = false;
+      // -------------------------
+      // PARSE
+      // -------------------------
+      Parser parser(tokens, &diag);
+      auto program = parser.parseProgram();
 
-    for (auto &stmt : program) {
+      // --------------------------------
+      // CPS DUMP (debugging path)
+      // --------------------------------
+      if (emitCPS) {
+        PassManager::cpsLowering().run(program, &diag);
+        if (diag.hasErrors())
+          return failed();
 
-      auto *fn = dynamic_cast<FunctionStmt *>(stmt.get());
+        toANF(program);
 
-      if (!fn) {
-        std::cerr
-            << "Error: Only function declarations allowed at top level.\n";
-        return 1;
+        CPSModule cps = CPSPass().convert(program);
+        CPSShrinkPass().run(cps);
+        CPSPrinter(cps.names).print(cps);
+        return 0;
       }
 
-      if (fn->name == "main")
-        foundMain = true;
+      // --------------------------------
+      // DESUGARING + FOLDING
+      // --------------------------------
+      PassManager::lowering().run(program, &diag);
 
-      lowerStmt(cg, stmt.get());
-    }
+      // --------------------------------
+      // SEMANTIC ANALYSIS
+      // --------------------------------
+      // One fused walk; --split-sema runs the two passes separately.
+      // The symbol tables own the Symbols the AST points to. Syntax
+      // errors do not stop sema: functions the parser recovered in
+      // are skipped, the rest are checked.
+      ResolveScopesPass resolver(&diag);
+      SemaPass sema(&diag);
 
-    if (!foundMain) {
-      std::cerr << "Error: No 'main' function defined.\n";
-      return 1;
-    }
+      if (splitSema) {
+        resolver.resolve(program);
+
+        // type errors on unresolved names would repeat the resolver's
+        if (!diag.hasErrors()) {
+          TypeCheckPass types;
+          types.diag = &diag;
+          types.check(program);
+        }
+      } else {
+        sema.check(program);
+      }
+
+      if (diag.hasErrors())
+        return failed();
+
+      PassManager::typedFolding().run(program);
+
+      // --------------------------------
+      // FLAT AST DUMP (debugging path)
+      // --------------------------------
+      if (emitFlat) {
+        FlatAST flat = flatten(program);
+        flat.print();
+        std::cout << "; " << flat.size() << " nodes, " << flat.bytes()
+                  << " bytes\n";
+        return 0;
+      }
+
+      // CPS takes a reduced core; reduce before ANF so the result
+      // is still in ANF.
+      if (useCPS) {
+        PassManager::cpsLowering().run(program, &diag);
+        if (diag.hasErrors())
+          return failed();
+      }
+
+      // --------------------------------
+      // A-NORMAL FORM (optional path)
+      // --------------------------------
+      // Typed temporaries lower straight to SSA values. The IR and
+      // CPS backends require it; the tree is converted once.
+      if (useANF || useIR || emitIR || useCPS)
+        toANF(program);
+
+      // --------------------------------
+      // MID-LEVEL IR (optional path)
+      // --------------------------------
+      IRModule ir;
+
+      if (useIR || emitIR) {
+        ir = IRPass().build(flatten(program));
+        IROptimizer().run(ir);
+
+        if (emitIR) {
+          IRPrinter::print(ir);
+          return 0;
+        }
+      }
+
+      // --------------------------------
+      // CPS BACKEND (optional path)
+      // --------------------------------
+      CPSModule cps;
+
+      if (useCPS) {
+        cps = CPSPass().convert(program);
+        CPSShrinkPass().run(cps);
+      }
+
+      // --------------------------------
+      // LLVM SETUP (Only if semantic OK)
+      // --------------------------------
+      llvm::LLVMContext ctx;
+      llvm::Module module("nano_module", ctx);
+      LLVMCodegen cg(ctx, &module);
 
-    // -------------------------
-    // VERIFY
-    // -------------------------
-    if (llvm::verifyModule(module, &llvm::errs())) {
-      llvm::errs() << "LLVM verification failed\n";
+      bool foundMain = false;
+
+      // prototypes first: a call may come before its callee
+      if (!useIR && !useCPS)
+        for (auto &stmt : program)
+          if (auto *fn = dynamic_cast<FunctionStmt *>(stmt.get()))
+            declareFunction(cg, fn);
+
+      for (auto &stmt : program) {
+
+        auto *fn = dynamic_cast<FunctionStmt *>(stmt.get());
+
+        if (!fn) {
+          std::cerr
+              << "Error: Only function declarations allowed at top level.\n";
+          return 1;
+        }
+
+        if (fn->name == "main")
+          foundMain = true;
+
+        if (!useIR && !useCPS) {
+          lowerStmt(cg, stmt.get());
+          cg.finishFunction();
+        }
+      }
+
+      if (useIR)
+        lowerIRModule(cg, ir);
+      else if (useCPS)
+        CPSCodegen(cg, cps).lowerModule();
+
+      if (!foundMain) {
+        std::cerr << "Error: No 'main' function defined.\n";
+        return 1;
+      }
+
+      // -------------------------
+      // VERIFY
+      // -------------------------
+      return verifyAndPrint(module);
+
+    } catch (const TooManyErrors &) {
+      return failed();
+    } catch (const CompileError &e) {
+      failed();
+      DiagnosticEngine::print(std::cerr, e);
+      return 1;
+    } catch (const std::exception &e) {
+      std::cerr << "Internal compiler error:\n";
+      std::cerr << e.what() << "\n";
       return 1;
     }
 
-    module.print(llvm::outs(), nullptr);
-
-  } catch (const CompileError &e) {
-    std::cerr << "Compilation failed:\n";
-    std::cerr << "Error at line " << e.line << ", column " << e.col << ": "
-              << e.message << "\n";
-    return 1;
-  } catch (const std::exception &e) {
-    std::cerr << "Internal compiler error:\n";
-    std::cerr << e.what() << "\n";
-    return 1;
-  }
+    return 0;
+  };
 
-  return 0;
+  int status = 1;
+  runOnLargeStack([&] { status = compile(); });
+  return status;
 }
@@ -2,6 +2,8 @@
 
 #include "../ast/expr.h"
 #include "../ast/stmt.h"
+#include "../common/diagnostics.h"
+#include "../lexer/lexer.h"
 #include "../lexer/token.h"
 #include <memory>
 #include <stdexcept>
@@ -15,19 +17,61 @@ class Parser {
   vector<Token> tokens;
   int current = 0;
 
+  // constructs seen in the function being parsed
+  FeatureSet features;
+
+  // syntax errors are reported here and parsing resumes at the next
+  // statement; see synchronize()
+  DiagnosticEngine *diag;
+
+  // streaming: tokens are scanned from here as the parser reaches them
+  Lexer *lexer = nullptr;
+  bool scannedAll = true;
+
 public:
-  Parser(vector<Token> t) : tokens(std::move(t)) {}
+  // Function bodies are skipped and left empty: a first streaming scan
+  // only collects signatures.
+  bool skipBodies = false;
+
+  Parser(vector<Token> t, DiagnosticEngine *diag = nullptr)
+      : tokens(std::move(t)), diag(diag) {}
+
+  Parser(Lexer *lexer, DiagnosticEngine *diag)
+      : diag(diag), lexer(lexer), scannedAll(false) {}
 
   vector<unique_ptr<Stmt>> parseProgram() {
     vector<unique_ptr<Stmt>> program;
     while (!isAtEnd()) {
-      program.push_back(statement());
+      if (auto s = listedStatement())
+        program.push_back(std::move(s));
     }
     return program;
   }
 
+  // ============================================================
+  // STREAMING
+  // ============================================================
+
+  // One top-level statement at a time, for a caller that is done with
+  // each before asking for the next. The tokens of earlier statements
+  // are freed. Null after a syntax error (reported to diag).
+  unique_ptr<Stmt> nextStatement() {
+    tokens.erase(tokens.begin(), tokens.begin() + current);
+    current = 0;
+    return listedStatement();
+  }
+
+  bool done() { return isAtEnd(); }
+
 private:
-  Token &peek() { return tokens[current]; }
+  // The token `ahead` places after the current one, or END_OF_FILE.
+  Token &peek(int ahead = 0) {
+    size_t i = current + ahead;
+    while (!scannedAll && tokens.size() <= i)
+      scannedAll = !lexer->scanToken(tokens);
+    return tokens[min(i, tokens.size() - 1)];
+  }
+
   Token &previous() { return tokens[current - 1]; }
   bool isAtEnd() { return peek().type == TokenType::END_OF_FILE; }
 
@@ -50,7 +94,88 @@ private:
   Token consume(TokenType type, const string &msg) {
     if (check(type))
       return tokens[current++];
-    throw runtime_error(msg);
+    throw error(msg);
+  }
+
+  // an error at the current token
+  CompileError error(const string &msg) { return error(peek(), msg); }
+
+  static CompileError error(const Token &at, const string &msg) {
+    return CompileError(msg, at.line, at.col);
+  }
+
+  // ============================================================
+  // ERROR RECOVERY
+  // ============================================================
+
+  static bool startsStatement(TokenType t) {
+    switch (t) {
+    case TokenType::INT:
+    case TokenType::FLOAT:
+    case TokenType::DOUBLE:
+    case TokenType::BOOL:
+    case TokenType::CHAR:
+    case TokenType::VOID:
+    case TokenType::IF:
+    case TokenType::WHILE:
+    case TokenType::FOR:
+    case TokenType::PARALLEL:
+    case TokenType::SIMD:
+    case TokenType::PRINT:
+    case TokenType::RETURN:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // A statement of a block or of the program. After a syntax error it
+  // returns null, with the error reported and the rest of the
+  // statement skipped.
+  unique_ptr<Stmt> listedStatement() {
+    int start = current;
+    unique_ptr<Stmt> stmt;
+
+    if (recover(diag, [&] { stmt = statement(); }))
+      return stmt;
+
+    if (current == start && !isAtEnd())
+      current++; // the statement cannot begin here at all
+    synchronize();
+    return nullptr;
+  }
+
+  // Skips the rest of a block whose '{' has been consumed.
+  void skipBlock() {
+    for (int depth = 1; depth > 0 && !isAtEnd(); current++) {
+      if (check(TokenType::LBRACE))
+        depth++;
+      else if (check(TokenType::RBRACE))
+        depth--;
+    }
+  }
+
+  // Panic mode: skips tokens to where the next statement can start,
+  // i.e. past a ';' or a braced group, or up to a '}' closing the
+  // enclosing block or a keyword that begins a statement.
+  void synchronize() {
+    int depth = 0;
+
+    while (!isAtEnd()) {
+      TokenType t = peek().type;
+
+      if (depth == 0 && (t == TokenType::RBRACE || startsStatement(t)))
+        return;
+
+      current++;
+
+      if (t == TokenType::LBRACE)
+        depth++;
+      else if (t == TokenType::RBRACE && --depth == 0)
+        return;
+      else if (t == TokenType::SEMICOLON && depth == 0)
+        return;
+    }
   }
 
   // ============================================================
@@ -58,6 +183,14 @@ private:
   // ============================================================
 
   unique_ptr<Stmt> statement() {
+    Token start = peek();
+    auto stmt = statementAt();
+    if (stmt->loc.line < 0)
+      stmt->loc = {start.line, start.col};
+    return stmt;
+  }
+
+  unique_ptr<Stmt> statementAt() {
 
     if (check(TokenType::INT) || check(TokenType::FLOAT) ||
         check(TokenType::DOUBLE) || check(TokenType::BOOL) ||
@@ -67,8 +200,7 @@ private:
       LangType type = parseType();
 
       if (check(TokenType::IDENTIFIER)) {
-        if (current + 1 < tokens.size() &&
-            tokens[current + 1].type == TokenType::LPAREN) {
+        if (peek(1).type == TokenType::LPAREN) {
           current = save;
           return functionStatement();
         }
@@ -84,6 +216,8 @@ private:
       return whileStatement();
     if (match({TokenType::FOR}))
       return forStatement();
+    if (match({TokenType::PARALLEL, TokenType::SIMD}))
+      return annotatedFor();
     if (match({TokenType::PRINT}))
       return printStatement();
     if (match({TokenType::LBRACE}))
@@ -106,10 +240,20 @@ private:
     LangType baseType = parseType();
 
     int arraySize = -1;
+    unique_ptr<Expr> length;
 
+    // int[5] x: fixed size, on the stack; int[n] x: sized at run time
     if (match({TokenType::LBRACKET})) {
-      Token sizeTok = consume(TokenType::NUMBER, "Expected array size");
-      arraySize = stoi(sizeTok.lexeme);
+      features.add(Feature::Arrays);
+      if (check(TokenType::NUMBER) &&
+          peek(1).type == TokenType::RBRACKET) {
+        Token sizeTok = consume(TokenType::NUMBER, "Expected array size");
+        arraySize = stoi(sizeTok.lexeme);
+        if (arraySize <= 0)
+          throw error(sizeTok, "Array size must be positive");
+      } else {
+        length = expression();
+      }
       consume(TokenType::RBRACKET, "Expected ']'");
     }
 
@@ -119,6 +263,8 @@ private:
 
     if (arraySize != -1) {
       finalType = LangType::Array(baseType, arraySize);
+    } else if (length) {
+      finalType = LangType::DynamicArray(baseType);
     }
 
     unique_ptr<Expr> initializer = nullptr;
@@ -129,8 +275,10 @@ private:
 
     consume(TokenType::SEMICOLON, "Expected ';' after variable declaration");
 
-    return make_unique<VarDeclStmt>(name.lexeme, finalType,
-                                    std::move(initializer));
+    auto decl = make_unique<VarDeclStmt>(name.lexeme, finalType,
+                                         std::move(initializer));
+    decl->length = std::move(length);
+    return decl;
   }
 
   // ============================================================
@@ -157,7 +305,7 @@ private:
     if (match({TokenType::VOID}))
       return LangType::Void();
 
-    throw runtime_error("Expected type");
+    throw error("Expected type");
   }
 
   // ============================================================
@@ -179,8 +327,16 @@ private:
   unique_ptr<Stmt> blockStatement() {
     auto block = make_unique<BlockStmt>();
     while (!check(TokenType::RBRACE) && !isAtEnd()) {
-      block->stmts.push_back(statement());
+      if (auto s = listedStatement())
+        block->stmts.push_back(std::move(s));
     }
+
+    // at the end of the file, keep what was parsed of the block
+    if (diag && isAtEnd()) {
+      diag->report(error("Expected '}' after block"));
+      return block;
+    }
+
     consume(TokenType::RBRACE, "Expected '}' after block");
     return block;
   }
@@ -207,8 +363,10 @@ private:
     consume(TokenType::RPAREN, "Expected ')'");
     auto thenBranch = statement();
     unique_ptr<Stmt> elseBranch = nullptr;
-    if (match({TokenType::ELSE}))
+    if (match({TokenType::ELSE})) {
+      features.add(Feature::IfElse);
       elseBranch = statement();
+    }
     return make_unique<IfStmt>(std::move(condition), std::move(thenBranch),
                                std::move(elseBranch));
   }
@@ -223,6 +381,7 @@ private:
 
   unique_ptr<Stmt> forStatement() {
 
+    features.add(Feature::For);
     consume(TokenType::LPAREN, "Expected '(' after for");
 
     unique_ptr<Stmt> init = nullptr;
@@ -251,6 +410,49 @@ private:
                                 std::move(increment), std::move(body));
   }
 
+  // ============================================================
+  // ANNOTATED FOR:  simd for | simd(N) for | parallel for
+  // ============================================================
+
+  static constexpr int MaxInterleave = 64;
+
+  // simd(N): an integer literal from 1 to MaxInterleave
+  int interleaveCount(const Token &count) {
+    const string &lex = count.lexeme;
+    bool digits = lex.find_first_not_of("0123456789") == string::npos;
+
+    // at most two digits, so stoi cannot overflow
+    if (digits && lex.size() <= 2) {
+      int n = stoi(lex);
+      if (n >= 1 && n <= MaxInterleave)
+        return n;
+    }
+
+    throw error(count, "Interleave count must be an integer from 1 to " +
+                           to_string(MaxInterleave));
+  }
+
+  unique_ptr<Stmt> annotatedFor() {
+
+    LoopHint hint = previous().type == TokenType::PARALLEL ? LoopHint::Parallel
+                                                           : LoopHint::Simd;
+    int interleave = 0;
+
+    if (hint == LoopHint::Simd && match({TokenType::LPAREN})) {
+      Token count = consume(TokenType::NUMBER, "Expected interleave count");
+      interleave = interleaveCount(count);
+      consume(TokenType::RPAREN, "Expected ')'");
+    }
+
+    consume(TokenType::FOR, "Expected 'for' after loop annotation");
+
+    auto stmt = forStatement();
+    auto *f = static_cast<ForStmt *>(stmt.get());
+    f->hint = hint;
+    f->interleave = interleave;
+    return stmt;
+  }
+
   unique_ptr<Stmt> functionStatement() {
 
     LangType returnType = parseType();
@@ -260,123 +462,147 @@ private:
     consume(TokenType::LPAREN, "Expected '(' after function name");
 
     vector<pair<string, LangType>> params;
+    unordered_set<string> seen;
 
     if (!check(TokenType::RPAREN)) {
       do {
         LangType paramType = parseType();
+
+        // int[5] a: fixed size; int[] a: any length
+        if (match({TokenType::LBRACKET})) {
+          features.add(Feature::Arrays);
+          if (check(TokenType::NUMBER)) {
+            Token sizeTok = consume(TokenType::NUMBER, "Expected array size");
+            paramType = LangType::Array(paramType, stoi(sizeTok.lexeme));
+          } else
+            paramType = LangType::DynamicArray(paramType);
+          consume(TokenType::RBRACKET, "Expected ']'");
+        }
+
         Token paramName =
             consume(TokenType::IDENTIFIER, "Expected parameter name");
+        if (!seen.insert(paramName.lexeme).second)
+          throw error(paramName,
+                      "Duplicate parameter name '" + paramName.lexeme + "'");
         params.push_back({paramName.lexeme, paramType});
       } while (match({TokenType::COMMA}));
-
-      unordered_set<string> seen;
-      for (auto &p : params) {
-        if (seen.count(p.first))
-          throw runtime_error("Duplicate parameter name '" + p.first + "'");
-        seen.insert(p.first);
-      }
     }
 
     consume(TokenType::RPAREN, "Expected ')'");
     consume(TokenType::LBRACE, "Expected '{'");
 
-    auto body = blockStatement();
+    FeatureSet outer = features;
+    features = {};
+    size_t errorsBefore = diag ? diag->count() : 0;
+
+    unique_ptr<Stmt> body;
+    if (skipBodies) {
+      skipBlock();
+      body = make_unique<BlockStmt>();
+    } else {
+      body = blockStatement();
+    }
 
-    return make_unique<FunctionStmt>(
+    auto fn = make_unique<FunctionStmt>(
         name.lexeme, returnType, std::move(params),
         unique_ptr<BlockStmt>(static_cast<BlockStmt *>(body.release())));
+    fn->features = features;
+    fn->hasSyntaxErrors = diag && diag->count() > errorsBefore;
+
+    features = outer;
+    return fn;
   }
 
   // ============================================================
   // EXPRESSIONS
   // ============================================================
 
-  unique_ptr<Expr> expression() { return assignment(); }
+  unique_ptr<Expr> expression() { return binary(0); }
 
-  unique_ptr<Expr> assignment() {
-    auto expr = logical_or();
+  // ============================================================
+  // BINARY OPERATORS (PRATT)
+  // ============================================================
 
-    if (match({TokenType::EQUAL})) {
-      auto value = assignment();
+  // Binding power of a binary operator token; 0 if it is not one.
+  // Higher binds tighter. Assignment is the only right-associative
+  // level.
+  static int infixPower(TokenType t) {
+    switch (t) {
+    case TokenType::EQUAL:
+    case TokenType::PLUS_EQUAL:
+      return 1;
+    case TokenType::OR_OR:
+      return 2;
+    case TokenType::AND_AND:
+      return 3;
+    case TokenType::EQUAL_EQUAL:
+    case TokenType::BANG_EQUAL:
+      return 4;
+    case TokenType::LESS:
+    case TokenType::LESS_EQUAL:
+    case TokenType::GREATER:
+    case TokenType::GREATER_EQUAL:
+      return 5;
+    case TokenType::PLUS:
+    case TokenType::MINUS:
+      return 6;
+    case TokenType::STAR:
+    case TokenType::SLASH:
+    case TokenType::MOD:
+      return 7;
+    default:
+      return 0;
+    }
+  }
 
-      if (dynamic_cast<VariableExpr *>(expr.get()) ||
-          dynamic_cast<IndexExpr *>(expr.get())) {
+  // Parses operators binding at least as tightly as minPower, one
+  // loop iteration per operator.
+  unique_ptr<Expr> binary(int minPower) {
 
-        return make_unique<BinaryExpr>("=", std::move(expr), std::move(value));
-      }
+    auto expr = unary();
 
-      throw runtime_error("Invalid assignment target");
-    }
+    while (!isAtEnd()) {
 
-    return expr;
-  }
+      int power = infixPower(peek().type);
+      if (power == 0 || power < minPower)
+        break;
 
-  unique_ptr<Expr> logical_or() {
-    auto expr = logical_and();
-    while (match({TokenType::OR_OR})) {
-      string op = previous().lexeme;
-      auto right = logical_and();
-      expr = make_unique<BinaryExpr>(op, std::move(expr), std::move(right));
-    }
-    return expr;
-  }
+      Token opTok = peek();
+      current++;
+      string op = opTok.lexeme;
 
-  unique_ptr<Expr> logical_and() {
-    auto expr = equality();
-    while (match({TokenType::AND_AND})) {
-      string op = previous().lexeme;
-      auto right = equality();
-      expr = make_unique<BinaryExpr>(op, std::move(expr), std::move(right));
-    }
-    return expr;
-  }
+      if (power == 1) {
+        if (op == "+=")
+          features.add(Feature::CompoundAssign);
+        auto value = binary(power); // right-associative
 
-  unique_ptr<Expr> equality() {
-    auto expr = comparison();
-    while (match({TokenType::EQUAL_EQUAL, TokenType::BANG_EQUAL})) {
-      string op = previous().lexeme;
-      auto right = comparison();
-      expr = make_unique<BinaryExpr>(op, std::move(expr), std::move(right));
-    }
-    return expr;
-  }
+        if (dynamic_cast<VariableExpr *>(expr.get()) ||
+            dynamic_cast<IndexExpr *>(expr.get())) {
+          expr = at(opTok, make_unique<BinaryExpr>(op, std::move(expr),
+                                                   std::move(value)));
+          continue;
+        }
 
-  unique_ptr<Expr> comparison() {
-    auto expr = term();
-    while (match({TokenType::LESS, TokenType::LESS_EQUAL, TokenType::GREATER,
-                  TokenType::GREATER_EQUAL})) {
-      string op = previous().lexeme;
-      auto right = term();
-      expr = make_unique<BinaryExpr>(op, std::move(expr), std::move(right));
-    }
-    return expr;
-  }
+        throw error(opTok, "Invalid assignment target");
+      }
 
-  unique_ptr<Expr> term() {
-    auto expr = factor();
-    while (match({TokenType::PLUS, TokenType::MINUS})) {
-      string op = previous().lexeme;
-      auto right = factor();
-      expr = make_unique<BinaryExpr>(op, std::move(expr), std::move(right));
+      auto right = binary(power + 1);
+      expr = at(opTok,
+                make_unique<BinaryExpr>(op, std::move(expr), std::move(right)));
     }
-    return expr;
-  }
 
-  unique_ptr<Expr> factor() {
-    auto expr = unary();
-    while (match({TokenType::STAR, TokenType::SLASH, TokenType::MOD})) {
-      string op = previous().lexeme;
-      auto right = unary();
-      expr = make_unique<BinaryExpr>(op, std::move(expr), std::move(right));
-    }
     return expr;
   }
 
   unique_ptr<Expr> unary() {
-    if (match({TokenType::BANG, TokenType::MINUS})) {
-      string op = previous().lexeme;
+    if (match({TokenType::BANG, TokenType::MINUS, TokenType::PLUS_PLUS,
+               TokenType::MINUS_MINUS})) {
+      Token opTok = previous();
+      string op = opTok.lexeme;
+      if (op == "++" || op == "--")
+        features.add(Feature::IncDec);
       auto right = unary();
-      return make_unique<UnaryExpr>(op, std::move(right));
+      return at(opTok, make_unique<UnaryExpr>(op, std::move(right)));
     }
     return postfix();
   }
@@ -393,10 +619,19 @@ private:
 
       if (match({TokenType::LBRACKET})) {
 
+        Token bracket = previous();
+        features.add(Feature::Arrays);
         auto indexExpr = expression();
         consume(TokenType::RBRACKET, "Expected ']'");
 
-        expr = make_unique<IndexExpr>(std::move(expr), std::move(indexExpr));
+        expr = at(bracket, make_unique<IndexExpr>(std::move(expr),
+                                                  std::move(indexExpr)));
+      } else if (match({TokenType::PLUS_PLUS, TokenType::MINUS_MINUS})) {
+
+        // x++ / x-- : only valid as a statement, desugared before sema
+        features.add(Feature::IncDec);
+        expr = at(previous(),
+                  make_unique<UnaryExpr>(previous().lexeme, std::move(expr)));
       } else {
         break;
       }
@@ -405,7 +640,21 @@ private:
     return expr;
   }
 
+  // Sets an expression's location to the token it was parsed at.
+  template <class T> static unique_ptr<T> at(const Token &tok, unique_ptr<T> e) {
+    e->loc = {tok.line, tok.col};
+    return e;
+  }
+
   unique_ptr<Expr> primary() {
+    Token start = peek();
+    auto expr = primaryAt();
+    if (expr->loc.line < 0)
+      expr->loc = {start.line, start.col};
+    return expr;
+  }
+
+  unique_ptr<Expr> primaryAt() {
 
     if (match({TokenType::STRING}))
       return make_unique<StringExpr>(previous().lexeme);
@@ -420,11 +669,10 @@ private:
       return make_unique<NumberExpr>(stoll(lex));
     }
 
-    if (match({TokenType::TRUE}))
-      return make_unique<BoolExpr>(true);
-
-    if (match({TokenType::FALSE}))
-      return make_unique<BoolExpr>(false);
+    if (match({TokenType::TRUE, TokenType::FALSE})) {
+      features.add(Feature::BoolLiteral);
+      return make_unique<BoolExpr>(previous().type == TokenType::TRUE);
+    }
 
     if (match({TokenType::IDENTIFIER})) {
 
@@ -442,6 +690,7 @@ private:
 
         consume(TokenType::RPAREN, "Expected ')'");
 
+        features.add(Feature::Calls);
         return make_unique<CallExpr>(name, std::move(args));
       }
 
@@ -454,6 +703,6 @@ private:
       return expr;
     }
 
-    throw runtime_error("Expected expression");
+    throw error("Expected expression");
   }
 };
@@ -1,154 +1,262 @@
 #pragma once
 
+#include "../ast/clone.h"
 #include "../ast/expr.h"
 #include "../ast/stmt.h"
 
 
+/*
+    A-normal form: every operand is an atom (literal or variable).
+
+    The rewrite is in place. Statements and expressions keep their
+    nodes; only their children are replaced, and statement lists are
+    spliced. A statement's right-hand side may stay one operation
+    over atoms (x = a + b); only nested operations get a temporary.
+
+    Temporaries are declared (VarDeclStmt::isTemp) with the type
+    TypeCheckPass gave their value, so the output resolves and lowers
+    like source code; codegen keeps them as SSA values.
+*/
 struct ANFPass {
 
   int tempCounter = 0;
 
   /* ===== ENTRY ===== */
 
+  void transformBlock(BlockStmt *b) {
+    vector<unique_ptr<Stmt>> stmts;
+    stmts.reserve(b->stmts.size());
+    for (auto &s : b->stmts)
+      lowerInto(std::move(s), stmts);
+    b->stmts = std::move(stmts);
+  }
+
   vector<unique_ptr<Stmt>> transformStmt(unique_ptr<Stmt> stmt) {
     vector<unique_ptr<Stmt>> out;
+    lowerInto(std::move(stmt), out);
+    return out;
+  }
+
+private:
+  /* ===== STATEMENT LOWERING ===== */
+
+  // Appends the statements computing `stmt` (its temporaries, then
+  // the statement itself) to `out`.
+  void lowerInto(unique_ptr<Stmt> stmt, vector<unique_ptr<Stmt>> &out) {
 
     if (auto b = dynamic_cast<BlockStmt *>(stmt.get())) {
-      auto nb = make_unique<BlockStmt>();
-      for (auto &s : b->stmts) {
-        auto lowered = transformStmt(std::move(s));
-        for (auto &x : lowered)
-          nb->stmts.push_back(std::move(x));
-      }
-      out.push_back(std::move(nb));
-      return out;
+      transformBlock(b);
     }
 
-    if (auto e = dynamic_cast<ExprStmt *>(stmt.get())) {
-      auto r = transformExpr(std::move(e->e), out);
-      out.push_back(make_unique<ExprStmt>(std::move(r)));
-      return out;
+    else if (auto e = dynamic_cast<ExprStmt *>(stmt.get())) {
+      e->e = normalize(std::move(e->e), out);
     }
 
-    if (auto p = dynamic_cast<PrintStmt *>(stmt.get())) {
-      auto r = transformExpr(std::move(p->e), out);
-      out.push_back(make_unique<PrintStmt>(std::move(r)));
-      return out;
+    else if (auto p = dynamic_cast<PrintStmt *>(stmt.get())) {
+      p->e = normalize(std::move(p->e), out);
     }
 
-    if (auto i = dynamic_cast<IfStmt *>(stmt.get())) {
-      auto cond = transformExpr(std::move(i->condition), out);
-      auto thenB = transformStmt(std::move(i->thenBranch));
-      vector<unique_ptr<Stmt>> elseB;
-      if (i->elseBranch)
-        elseB = transformStmt(std::move(i->elseBranch));
-
-      auto nb = make_unique<BlockStmt>();
-      for (auto &s : out)
-        nb->stmts.push_back(std::move(s));
-      out.clear();
-
-      nb->stmts.push_back(make_unique<IfStmt>(
-          std::move(cond),
-          thenB.size() == 1 ? std::move(thenB[0]) : wrapBlock(std::move(thenB)),
-          elseB.empty() ? nullptr
-                        : (elseB.size() == 1 ? std::move(elseB[0])
-                                             : wrapBlock(std::move(elseB)))));
-
-      out.push_back(std::move(nb));
-      return out;
+    else if (auto v = dynamic_cast<VarDeclStmt *>(stmt.get())) {
+      if (v->length)
+        v->length = atomize(std::move(v->length), out);
+      if (v->initializer)
+        v->initializer = normalize(std::move(v->initializer), out);
     }
 
-    if (auto w = dynamic_cast<WhileStmt *>(stmt.get())) {
-      auto cond = transformExpr(std::move(w->condition), out);
-      auto body = transformStmt(std::move(w->body));
-
-      auto nb = make_unique<BlockStmt>();
-      for (auto &s : out)
-        nb->stmts.push_back(std::move(s));
-      out.clear();
+    else if (auto i = dynamic_cast<IfStmt *>(stmt.get())) {
+      i->condition = atomize(std::move(i->condition), out);
+      i->thenBranch = branch(std::move(i->thenBranch));
+      if (i->elseBranch)
+        i->elseBranch = branch(std::move(i->elseBranch));
+    }
 
-      nb->stmts.push_back(make_unique<WhileStmt>(
-          std::move(cond),
-          body.size() == 1 ? std::move(body[0]) : wrapBlock(std::move(body))));
+    else if (auto w = dynamic_cast<WhileStmt *>(stmt.get())) {
+      auto again = cloneExpr(w->condition.get());
+      size_t before = out.size();
+      w->condition = atomize(std::move(w->condition), out);
+      w->body = branch(std::move(w->body));
+
+      // The condition's temporaries are computed before the loop;
+      // recompute them at the end of every iteration. The condition
+      // itself is then assigned twice and cannot stay an SSA value.
+      if (out.size() != before) {
+        if (auto d = dynamic_cast<VarDeclStmt *>(out.back().get()))
+          d->isTemp = false;
+
+        auto *body = asBlock(w->body);
+        auto next = normalize(std::move(again), body->stmts);
+        body->stmts.push_back(make_unique<ExprStmt>(make_unique<BinaryExpr>(
+            "=", cloneExpr(w->condition.get()), std::move(next))));
+      }
+    }
 
-      out.push_back(std::move(nb));
-      return out;
+    // Only hinted loops are left as for loops. Codegen matches their
+    // header as written, so only the body is normalized.
+    else if (auto f = dynamic_cast<ForStmt *>(stmt.get())) {
+      f->body = branch(std::move(f->body));
     }
 
-    if (auto r = dynamic_cast<ReturnStmt *>(stmt.get())) {
-      if (r->value) {
-        auto v = transformExpr(std::move(r->value), out);
-        out.push_back(make_unique<ReturnStmt>(std::move(v)));
-      } else {
-        out.push_back(std::move(stmt));
-      }
-      return out;
+    else if (auto r = dynamic_cast<ReturnStmt *>(stmt.get())) {
+      if (r->value)
+        r->value = normalize(std::move(r->value), out);
     }
 
     out.push_back(std::move(stmt));
-    return out;
   }
 
-private:
+  unique_ptr<Stmt> branch(unique_ptr<Stmt> stmt) {
+    auto lowered = transformStmt(std::move(stmt));
+    if (lowered.size() == 1)
+      return std::move(lowered[0]);
+    return wrapBlock(std::move(lowered));
+  }
+
+  BlockStmt *asBlock(unique_ptr<Stmt> &stmt) {
+    if (auto b = dynamic_cast<BlockStmt *>(stmt.get()))
+      return b;
+    vector<unique_ptr<Stmt>> one;
+    one.push_back(std::move(stmt));
+    stmt = wrapBlock(std::move(one));
+    return static_cast<BlockStmt *>(stmt.get());
+  }
+
   /* ===== EXPRESSION LOWERING ===== */
 
-  unique_ptr<Expr> transformExpr(unique_ptr<Expr> expr,
-                                 vector<unique_ptr<Stmt>> &out) {
+  static bool isAtom(Expr *e) {
+    return dynamic_cast<NumberExpr *>(e) || dynamic_cast<BoolExpr *>(e) ||
+           dynamic_cast<StringExpr *>(e) || dynamic_cast<VariableExpr *>(e);
+  }
 
-    // Atomic expressions
-    if (dynamic_cast<NumberExpr *>(expr.get()) ||
-        dynamic_cast<VariableExpr *>(expr.get())) {
+  // Reduces expr to a literal or variable.
+  unique_ptr<Expr> atomize(unique_ptr<Expr> expr,
+                           vector<unique_ptr<Stmt>> &out) {
+    if (isAtom(expr.get()))
       return expr;
+
+    // an assignment's value is its target
+    if (auto b = dynamic_cast<BinaryExpr *>(expr.get());
+        b && b->op == "=" && dynamic_cast<VariableExpr *>(b->left.get())) {
+      auto target = cloneExpr(b->left.get());
+      out.push_back(make_unique<ExprStmt>(normalize(std::move(expr), out)));
+      return target;
     }
 
-    // Binary expression
+    auto value = normalize(std::move(expr), out);
+    LangType type = value->type;
+
+    auto decl = make_unique<VarDeclStmt>(newTemp(), type, std::move(value));
+    decl->isTemp = true;
+
+    auto ref = make_unique<VariableExpr>(decl->name);
+    ref->type = type;
+
+    out.push_back(std::move(decl));
+    return ref;
+  }
+
+  // Reduces expr to one operation over atoms, reusing its node.
+  unique_ptr<Expr> normalize(unique_ptr<Expr> expr,
+                             vector<unique_ptr<Stmt>> &out) {
+
+    if (isAtom(expr.get()))
+      return expr;
+
+    // Binary expression (and assignment)
     if (auto b = dynamic_cast<BinaryExpr *>(expr.get())) {
-      auto l = transformExpr(std::move(b->left), out);
-      auto r = transformExpr(std::move(b->right), out);
+      if (b->op == "=") {
+        if (auto idx = dynamic_cast<IndexExpr *>(b->left.get()))
+          idx->index = atomize(std::move(idx->index), out);
+        b->right = dynamic_cast<VariableExpr *>(b->left.get())
+                       ? normalize(std::move(b->right), out)
+                       : atomize(std::move(b->right), out);
+        return expr;
+      }
 
-      auto tmp = newTemp();
-      out.push_back(make_unique<ExprStmt>(make_unique<BinaryExpr>(
-          "=", make_unique<VariableExpr>(tmp),
-          make_unique<BinaryExpr>(b->op, std::move(l), std::move(r)))));
+      if (b->op == "&&" || b->op == "||")
+        return shortCircuit(b, std::move(expr), out);
 
-      return make_unique<VariableExpr>(tmp);
+      b->left = atomize(std::move(b->left), out);
+      b->right = atomize(std::move(b->right), out);
+      return expr;
     }
 
     // Unary expression
     if (auto u = dynamic_cast<UnaryExpr *>(expr.get())) {
-      auto r = transformExpr(std::move(u->right), out);
-      auto tmp = newTemp();
-      out.push_back(make_unique<ExprStmt>(make_unique<BinaryExpr>(
-          "=", make_unique<VariableExpr>(tmp),
-          make_unique<UnaryExpr>(u->op, std::move(r)))));
-      return make_unique<VariableExpr>(tmp);
+      u->right = atomize(std::move(u->right), out);
+      return expr;
     }
 
     // Function call
     if (auto c = dynamic_cast<CallExpr *>(expr.get())) {
-      vector<unique_ptr<Expr>> args;
       for (auto &a : c->args)
-        args.push_back(transformExpr(std::move(a), out));
+        a = atomize(std::move(a), out);
+      return expr;
+    }
 
-      auto tmp = newTemp();
-      out.push_back(make_unique<ExprStmt>(make_unique<BinaryExpr>(
-          "=", make_unique<VariableExpr>(tmp),
-          make_unique<CallExpr>(c->callee, std::move(args)))));
-      return make_unique<VariableExpr>(tmp);
+    // Array read
+    if (auto i = dynamic_cast<IndexExpr *>(expr.get())) {
+      i->index = atomize(std::move(i->index), out);
+      return expr;
     }
 
     throw runtime_error("Unknown expr in ANF");
   }
 
+  // a && b / a || b. When b needs statements of its own they must
+  // only run if a does not decide the result:
+  //   bool t = false; if (a) { ...; t = b != 0; }        (&&)
+  //   bool t = true;  if (a) {} else { ...; t = b != 0; } (||)
+  unique_ptr<Expr> shortCircuit(BinaryExpr *b, unique_ptr<Expr> expr,
+                                vector<unique_ptr<Stmt>> &out) {
+    b->left = atomize(std::move(b->left), out);
+
+    vector<unique_ptr<Stmt>> rhs;
+    b->right = atomize(std::move(b->right), rhs);
+    if (rhs.empty())
+      return expr;
+
+    bool isAnd = b->op == "&&";
+    LangType type = b->type;
+
+    auto init = make_unique<BoolExpr>(!isAnd);
+    init->type = LangType::Bool();
+    auto decl = make_unique<VarDeclStmt>(newTemp(), type, std::move(init));
+    string t = decl->name;
+    out.push_back(std::move(decl));
+
+    auto result = make_unique<VariableExpr>(t);
+    result->type = type;
+    rhs.push_back(make_unique<ExprStmt>(make_unique<BinaryExpr>(
+        "=", cloneExpr(result.get()), truth(std::move(b->right)))));
+
+    auto taken = wrapBlock(std::move(rhs));
+    auto skipped = wrapBlock({});
+    out.push_back(make_unique<IfStmt>(
+        std::move(b->left), isAnd ? std::move(taken) : std::move(skipped),
+        isAnd ? std::move(skipped) : std::move(taken)));
+
+    return result;
+  }
+
+  // atom -> bool; ints are compared against zero
+  static unique_ptr<Expr> truth(unique_ptr<Expr> atom) {
+    if (!atom->type.isNumeric())
+      return atom;
+
+    auto zero = make_unique<NumberExpr>(0LL);
+    zero->type = LangType::Int(32);
+    auto ne = make_unique<BinaryExpr>("!=", std::move(atom), std::move(zero));
+    ne->type = LangType::Bool();
+    return ne;
+  }
+
   /* ===== HELPERS ===== */
 
   string newTemp() { return "_t" + to_string(tempCounter++); }
 
   unique_ptr<Stmt> wrapBlock(vector<unique_ptr<Stmt>> stmts) {
     auto b = make_unique<BlockStmt>();
-    for (auto &s : stmts)
-      b->stmts.push_back(std::move(s));
+    b->stmts = std::move(stmts);
     return b;
   }
 };
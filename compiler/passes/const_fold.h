@@ -0,0 +1,365 @@
+#pragma once
+
+#include "../ast/expr.h"
+#include "../ast/stmt.h"
+#include "rewrite_pass.h"
+#include <cstdint>
+#include <memory>
+
+using namespace std;
+
+/*
+    Folds constant arithmetic, comparisons, '!' and unary minus,
+    applies integer identities (x+0, x*1, x*0) and drops branches
+    whose condition is a known constant.
+
+    Integers fold with the same 32-bit wrap-around codegen uses.
+    Division by zero is left for runtime.
+
+    It runs twice: in lowering, before sema, and `typed` once sema has
+    set every Expr::type. Before sema the identities only apply to
+    operands that are numeric whatever their type (literals and
+    arithmetic), so a variable's x+0 waits for the typed run. That run
+    drops an operation only when its operand already has the result's
+    type, and gives each folded node the type of the one it replaces.
+*/
+struct ConstFoldPass : RewritePass {
+
+  bool typed = false;
+
+  explicit ConstFoldPass(bool typed = false) : typed(typed) {}
+
+  const char *name() const override { return "const-fold"; }
+  FeatureSet matches() const override { return FeatureSet::all(); }
+  FeatureSet produces() const override { return Feature::BoolLiteral; }
+
+  /* ===== ENTRY ===== */
+
+  unique_ptr<Stmt> transformStmt(unique_ptr<Stmt> stmt) {
+    return RewriteWalker({this}).walkStmt(std::move(stmt));
+  }
+
+  unique_ptr<Expr> transformExpr(unique_ptr<Expr> expr) {
+    return RewriteWalker({this}).walkExpr(std::move(expr));
+  }
+
+  /* ===== STATEMENT FOLDING ===== */
+
+  unique_ptr<Stmt> rewriteStmt(unique_ptr<Stmt> stmt) override {
+
+    // Statements folded away come back as empty blocks and are dropped.
+    if (auto b = dynamic_cast<BlockStmt *>(stmt.get())) {
+      vector<unique_ptr<Stmt>> kept;
+      for (auto &s : b->stmts)
+        if (!isEmptyBlock(s.get()))
+          kept.push_back(std::move(s));
+      b->stmts = std::move(kept);
+      return stmt;
+    }
+
+    if (auto i = dynamic_cast<IfStmt *>(stmt.get())) {
+      bool value;
+      if (constTruth(i->condition.get(), value)) {
+        if (value)
+          return std::move(i->thenBranch);
+        if (i->elseBranch)
+          return std::move(i->elseBranch);
+        return make_unique<BlockStmt>();
+      }
+      return stmt;
+    }
+
+    if (auto w = dynamic_cast<WhileStmt *>(stmt.get())) {
+      bool value;
+      if (constTruth(w->condition.get(), value) && !value)
+        return make_unique<BlockStmt>();
+      return stmt;
+    }
+
+    // for (init; false; inc) body  ->  { init; }
+    if (auto f = dynamic_cast<ForStmt *>(stmt.get())) {
+      bool value;
+      if (f->condition && constTruth(f->condition.get(), value) && !value) {
+        auto block = make_unique<BlockStmt>();
+        if (f->init)
+          block->stmts.push_back(std::move(f->init));
+        return block;
+      }
+      return stmt;
+    }
+
+    return stmt;
+  }
+
+  /* ===== EXPRESSION FOLDING ===== */
+
+  unique_ptr<Expr> rewriteExpr(unique_ptr<Expr> expr) override {
+    LangType type = expr->type;
+    unique_ptr<Expr> folded = foldExpr(std::move(expr));
+    if (typed && folded->type.kind == LangTypeKind::Unknown)
+      folded->type = type;
+    return folded;
+  }
+
+private:
+  unique_ptr<Expr> foldExpr(unique_ptr<Expr> expr) {
+
+    if (dynamic_cast<UnaryExpr *>(expr.get()))
+      return foldUnary(std::move(expr));
+
+    if (auto b = dynamic_cast<BinaryExpr *>(expr.get())) {
+      if (b->op == "=" || b->op == "+=")
+        return expr;
+      return foldBinary(std::move(expr));
+    }
+
+    return expr;
+  }
+
+  /* ===== UNARY ===== */
+
+  unique_ptr<Expr> foldUnary(unique_ptr<Expr> expr) {
+    auto *u = static_cast<UnaryExpr *>(expr.get());
+
+    if (u->op == "!") {
+      bool value;
+      if (constTruth(u->right.get(), value))
+        return makeBool(!value, expr->loc);
+      return expr;
+    }
+
+    if (u->op == "-") {
+      if (auto n = dynamic_cast<NumberExpr *>(u->right.get())) {
+        if (n->isFloat)
+          return makeFloat(-n->floatValue, expr->loc);
+        return makeInt(wrap32(-n->intValue), expr->loc);
+      }
+    }
+
+    return expr;
+  }
+
+  /* ===== BINARY ===== */
+
+  unique_ptr<Expr> foldBinary(unique_ptr<Expr> expr) {
+    auto *b = static_cast<BinaryExpr *>(expr.get());
+    const string &op = b->op;
+
+    // Logical operators only care about truthiness
+    if (op == "&&" || op == "||") {
+      bool l, r;
+      bool lc = constTruth(b->left.get(), l);
+      bool rc = constTruth(b->right.get(), r);
+
+      if (lc && rc)
+        return makeBool(op == "&&" ? (l && r) : (l || r), expr->loc);
+
+      // false && x  ->  false,  true || x  ->  true
+      if (lc && (op == "&&" ? !l : l))
+        return makeBool(l, expr->loc);
+
+      return expr;
+    }
+
+    auto *L = dynamic_cast<NumberExpr *>(b->left.get());
+    auto *R = dynamic_cast<NumberExpr *>(b->right.get());
+
+    if (L && R) {
+      if (L->isFloat || R->isFloat)
+        return foldFloat(std::move(expr), asDouble(L), asDouble(R));
+      return foldInt(std::move(expr), L->intValue, R->intValue);
+    }
+
+    return foldIdentity(std::move(expr));
+  }
+
+  unique_ptr<Expr> foldInt(unique_ptr<Expr> expr, long long l, long long r) {
+    const string &op = static_cast<BinaryExpr *>(expr.get())->op;
+    SourceLocation loc = expr->loc;
+
+    if (op == "+")
+      return makeInt(wrap32(l + r), loc);
+    if (op == "-")
+      return makeInt(wrap32(l - r), loc);
+    if (op == "*")
+      return makeInt(wrap32((long long)((uint64_t)l * (uint64_t)r)), loc);
+
+    if (op == "/" || op == "%") {
+      // leave traps and overflow to runtime
+      if (r == 0 || (wrap32(l) == INT32_MIN && r == -1))
+        return expr;
+      return makeInt(op == "/" ? wrap32(l) / wrap32(r)
+                               : wrap32(l) % wrap32(r),
+                     loc);
+    }
+
+    if (op == "<")
+      return makeBool(l < r, loc);
+    if (op == "<=")
+      return makeBool(l <= r, loc);
+    if (op == ">")
+      return makeBool(l > r, loc);
+    if (op == ">=")
+      return makeBool(l >= r, loc);
+    if (op == "==")
+      return makeBool(l == r, loc);
+    if (op == "!=")
+      return makeBool(l != r, loc);
+
+    return expr;
+  }
+
+  unique_ptr<Expr> foldFloat(unique_ptr<Expr> expr, double l, double r) {
+    const string &op = static_cast<BinaryExpr *>(expr.get())->op;
+    SourceLocation loc = expr->loc;
+
+    if (op == "+")
+      return makeFloat(l + r, loc);
+    if (op == "-")
+      return makeFloat(l - r, loc);
+    if (op == "*")
+      return makeFloat(l * r, loc);
+    if (op == "/")
+      return makeFloat(l / r, loc);
+
+    if (op == "<")
+      return makeBool(l < r, loc);
+    if (op == "<=")
+      return makeBool(l <= r, loc);
+    if (op == ">")
+      return makeBool(l > r, loc);
+    if (op == ">=")
+      return makeBool(l >= r, loc);
+    if (op == "==")
+      return makeBool(l == r, loc);
+    if (op == "!=")
+      return makeBool(l != r, loc);
+
+    return expr;
+  }
+
+  /* ===== ALGEBRAIC IDENTITIES ===== */
+
+  unique_ptr<Expr> foldIdentity(unique_ptr<Expr> expr) {
+    auto *b = static_cast<BinaryExpr *>(expr.get());
+    const string &op = b->op;
+
+    // x + 0, x - 0, x * 1, x / 1
+    if (isIntLit(b->right.get(), 0) && (op == "+" || op == "-") &&
+        canDrop(b->left.get(), expr.get()))
+      return std::move(b->left);
+
+    if (isIntLit(b->right.get(), 1) && (op == "*" || op == "/") &&
+        canDrop(b->left.get(), expr.get()))
+      return std::move(b->left);
+
+    // 0 + x, 1 * x
+    if (isIntLit(b->left.get(), 0) && op == "+" &&
+        canDrop(b->right.get(), expr.get()))
+      return std::move(b->right);
+
+    if (isIntLit(b->left.get(), 1) && op == "*" &&
+        canDrop(b->right.get(), expr.get()))
+      return std::move(b->right);
+
+    // x * 0, 0 * x  (32-bit ints, the type of a literal; x must not
+    // have side effects)
+    if (op == "*" && sameType(expr->type, LangType::Int())) {
+      if (isIntLit(b->right.get(), 0) && b->left->type.isInt() &&
+          isPure(b->left.get()))
+        return makeInt(0, expr->loc);
+
+      if (isIntLit(b->left.get(), 0) && b->right->type.isInt() &&
+          isPure(b->right.get()))
+        return makeInt(0, expr->loc);
+    }
+
+    return expr;
+  }
+
+  /* ===== HELPERS ===== */
+
+  static long long wrap32(long long v) { return (int32_t)(uint32_t)v; }
+
+  static double asDouble(const NumberExpr *n) {
+    return n->isFloat ? n->floatValue : (double)n->intValue;
+  }
+
+  // Truth value of a literal condition; false if not a constant.
+  static bool constTruth(const Expr *e, bool &value) {
+    if (auto b = dynamic_cast<const BoolExpr *>(e)) {
+      value = b->value;
+      return true;
+    }
+    if (auto n = dynamic_cast<const NumberExpr *>(e)) {
+      value = n->isFloat ? n->floatValue != 0.0 : n->intValue != 0;
+      return true;
+    }
+    return false;
+  }
+
+  static bool isIntLit(const Expr *e, long long v) {
+    auto n = dynamic_cast<const NumberExpr *>(e);
+    return n && !n->isFloat && n->intValue == v;
+  }
+
+  // Whether the operation `whole` can be replaced by its operand e:
+  // e must be numeric, so that dropping the operation cannot hide a
+  // type error, and after sema it must have the operation's type.
+  bool canDrop(const Expr *e, const Expr *whole) const {
+    if (typed)
+      return e->type.isNumeric() && sameType(e->type, whole->type);
+    return isKnownNumeric(e);
+  }
+
+  // Before type checking types are Unknown: only literals and
+  // arithmetic are then known to be numeric, and if the arithmetic is
+  // not, sema still reports it on the operand itself.
+  static bool isKnownNumeric(const Expr *e) {
+    if (dynamic_cast<const NumberExpr *>(e))
+      return true;
+    if (auto u = dynamic_cast<const UnaryExpr *>(e))
+      return u->op == "-";
+    if (auto b = dynamic_cast<const BinaryExpr *>(e))
+      return b->op == "+" || b->op == "-" || b->op == "*" || b->op == "/" ||
+             b->op == "%";
+    return false;
+  }
+
+  // No calls, assignments or bounds-checked loads.
+  static bool isPure(const Expr *e) {
+    if (dynamic_cast<const NumberExpr *>(e) ||
+        dynamic_cast<const BoolExpr *>(e) ||
+        dynamic_cast<const VariableExpr *>(e))
+      return true;
+    if (auto u = dynamic_cast<const UnaryExpr *>(e))
+      return isPure(u->right.get());
+    if (auto b = dynamic_cast<const BinaryExpr *>(e))
+      return b->op != "=" && b->op != "/" && b->op != "%" &&
+             isPure(b->left.get()) && isPure(b->right.get());
+    return false;
+  }
+
+  static bool isEmptyBlock(const Stmt *s) {
+    auto b = dynamic_cast<const BlockStmt *>(s);
+    return b && b->stmts.empty();
+  }
+
+  static unique_ptr<Expr> makeInt(long long v, SourceLocation loc) {
+    auto n = make_unique<NumberExpr>(v);
+    n->loc = loc;
+    return n;
+  }
+
+  static unique_ptr<Expr> makeFloat(double v, SourceLocation loc) {
+    auto n = make_unique<NumberExpr>(v);
+    n->loc = loc;
+    return n;
+  }
+
+  static unique_ptr<Expr> makeBool(bool v, SourceLocation loc) {
+    auto b = make_unique<BoolExpr>(v);
+    b->loc = loc;
+    return b;
+  }
+};
@@ -1,6 +1,10 @@
 #pragma once
+#include <algorithm>
+#include <functional>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "../ast/expr.h"
 #include "../ast/stmt.h"
@@ -8,112 +12,555 @@
 
 using namespace std;
 
+/*
+    Converts ANF function bodies to CPS.
+
+    Source variables are not CPS variables: the pass tracks the
+    current value of each one in `env` and rebinds it on assignment.
+    Control-flow joins become continuations that take, as parameters,
+    the variables in scope that the joined statement assigns (the CPS
+    counterpart of phi nodes); every other variable has the same value
+    on all incoming edges and is read directly. The shrinker drops the
+    parameters nobody reads.
+
+        if (c) A else B; R   =>   letcont j(vs) = R in
+                                  if c then A; j(vs) else B; j(vs)
+
+        while (c) B; R       =>   letcont exit(vs) = R in
+                                  letcont loop(vs) =
+                                    if c then B; loop(vs) else exit(vs)
+                                  in loop(vs)
+
+    where vs are the variables assigned in A and B, or in c and B.
+*/
 struct CPSPass {
 
-  int tempCounter = 0;
+  using Rest = function<unique_ptr<CPSExpr>()>;
+  using ValueRest = function<unique_ptr<CPSExpr>(CPSValue)>;
 
-  string freshTemp() { return "_k" + to_string(tempCounter++); }
+  CPSModule module;
+  CPSNames &names = module.names;
+
+  CPSVarId freshTemp() { return names.fresh(); }
 
   // ENTRY POINT
-  unique_ptr<CPSExpr> transformStmt(Stmt *stmt, const string &k) {
+  CPSModule convert(const vector<unique_ptr<Stmt>> &program) {
+
+    for (auto &s : program)
+      if (auto fn = dynamic_cast<FunctionStmt *>(s.get())) {
+        CPSVarId id = names.add(fn->name);
+        functions[fn->name] = id;
+        module.functionIndex[id] = module.functions.size();
+
+        CPSFunction f;
+        f.name = id;
+        f.returnType = cpsType(fn->returnType);
+        for (auto &p : fn->params)
+          f.paramTypes.push_back(cpsType(p.second));
+        module.functions.push_back(std::move(f));
+      }
+
+    for (auto &s : program)
+      if (auto fn = dynamic_cast<FunctionStmt *>(s.get()))
+        convertFunction(fn);
+
+    return std::move(module);
+  }
+
+private:
+  struct Binding {
+    string name;
+    CPSValue value;
+    bool isFloat; // declared float: assignments are converted
+  };
+
+  // source variable -> current value, innermost binding last
+  vector<Binding> env;
+
+  unordered_map<string, CPSVarId> functions;
+
+  // continuation -> positions in env of the variables it takes
+  unordered_map<CPSVarId, vector<size_t>> carried;
+
+  CPSType returnType = CPSType::Void;
+
+  void convertFunction(FunctionStmt *fn) {
+    CPSFunction &f = module.functions[module.functionIndex[functions[fn->name]]];
+
+    env.clear();
+    scanUnbind(0);
+    joinAssigned.clear();
+    for (size_t i = 0; i < fn->params.size(); i++) {
+      CPSVarId v = names.add(fn->params[i].first);
+      f.params.push_back(v);
+      env.push_back({fn->params[i].first, CPSValue::variable(v),
+                     f.paramTypes[i] == CPSType::Float});
+      scanBind(fn->params[i].first);
+    }
+    vector<string> params;
+    scanJoins(fn->body.get(), params);
+
+    returnType = f.returnType;
+
+    f.body = transformStmt(fn->body.get(), [&]() -> unique_ptr<CPSExpr> {
+      vector<CPSValue> result;
+      if (returnType == CPSType::Float)
+        result.push_back(CPSValue::floating(0.0));
+      else if (returnType == CPSType::Int)
+        result.push_back(CPSValue::integer(0));
+      return make_unique<CPSCall>(CPSNames::Return, std::move(result));
+    });
+  }
+
+  static CPSType cpsType(const LangType &t) {
+    if (t.kind == LangTypeKind::Void)
+      return CPSType::Void;
+    if (t.kind == LangTypeKind::Floating)
+      return CPSType::Float;
+    if (t.kind == LangTypeKind::Integer || t.kind == LangTypeKind::Bool ||
+        t.kind == LangTypeKind::Char)
+      return CPSType::Int;
+    throw runtime_error("CPS error: unsupported type");
+  }
+
+  /* ================= STATEMENTS ================= */
+
+  unique_ptr<CPSExpr> transformStmt(Stmt *stmt, const Rest &rest) {
 
     if (auto s = dynamic_cast<ExprStmt *>(stmt)) {
-      return transformExpr(s->e.get(), k);
+      return transformExpr(s->e.get(), [&](CPSValue) { return rest(); });
+    }
+
+    if (auto s = dynamic_cast<VarDeclStmt *>(stmt)) {
+      bool isFloat = s->type.kind == LangTypeKind::Floating;
+      auto declare = [&](CPSValue v) {
+        env.push_back({s->name, v, isFloat});
+        return rest();
+      };
+
+      if (!s->initializer)
+        return declare(isFloat ? CPSValue::floating(0.0)
+                               : CPSValue::integer(0));
+      return transformExpr(s->initializer.get(), [&](CPSValue v) {
+        return isFloat ? toFloat(v, declare) : declare(v);
+      });
     }
 
     if (auto s = dynamic_cast<PrintStmt *>(stmt)) {
-      vector<string> args = {"_print", "_dummy"};
-      return transformExpr(s->e.get(), "_print");
+      return transformExpr(s->e.get(), [&](CPSValue v) {
+        return make_unique<CPSLet>(
+            freshTemp(), make_unique<CPSPrim>(CPSPrimOp::Print, vector{v}),
+            rest());
+      });
     }
 
     if (auto s = dynamic_cast<BlockStmt *>(stmt)) {
-      unique_ptr<CPSExpr> cur = nullptr;
-      for (auto &st : s->stmts)
-        cur = transformStmt(st.get(), k);
-      return cur;
+      size_t scope = env.size();
+      return sequence(s->stmts, 0, [&]() {
+        env.erase(env.begin() + scope, env.end());
+        return rest();
+      });
     }
 
     if (auto s = dynamic_cast<IfStmt *>(stmt)) {
+      return transformExpr(s->condition.get(), [&](CPSValue cond) {
+        return join(joinAssigned[s], rest, [&](CPSVarId j) {
+          auto saved = save(j);
 
-      string cond = getName(s->condition.get());
+          auto thenCPS = transformStmt(s->thenBranch.get(),
+                                       [&]() { return jump(j); });
+          restore(j, saved);
 
-      auto thenCPS = transformStmt(s->thenBranch.get(), k);
+          auto elseCPS = s->elseBranch
+                             ? transformStmt(s->elseBranch.get(),
+                                             [&]() { return jump(j); })
+                             : jump(j);
+          restore(j, saved);
 
-      unique_ptr<CPSExpr> elseCPS = nullptr;
-      if (s->elseBranch)
-        elseCPS = transformStmt(s->elseBranch.get(), k);
-      else
-        elseCPS = make_unique<CPSCall>(k, vector<string>{"0"});
+          return make_unique<CPSIf>(cond, std::move(thenCPS),
+                                    std::move(elseCPS));
+        });
+      });
+    }
+
+    if (auto s = dynamic_cast<WhileStmt *>(stmt)) {
+      auto &assigned = joinAssigned[s];
+
+      return join(assigned, rest, [&](CPSVarId exit) {
+        CPSVarId loop = names.add("loop");
+        carry(loop, assigned);
+        auto saved = save(loop);
 
-      return make_unique<CPSIf>(cond, std::move(thenCPS), std::move(elseCPS));
+        auto params = rebindEnv(loop);
+
+        auto header = transformExpr(s->condition.get(), [&](CPSValue cond) {
+          auto top = env;
+          auto bodyCPS =
+              transformStmt(s->body.get(), [&]() { return jump(loop); });
+          env = top;
+          return make_unique<CPSIf>(cond, std::move(bodyCPS), jump(exit));
+        });
+        restore(loop, saved);
+
+        return make_unique<CPSLetCont>(loop, std::move(params),
+                                       std::move(header), jump(loop));
+      });
+    }
+
+    if (auto s = dynamic_cast<ReturnStmt *>(stmt)) {
+      if (!s->value)
+        return make_unique<CPSCall>(CPSNames::Return, vector<CPSValue>{});
+      return transformExpr(s->value.get(), [&](CPSValue v) {
+        auto ret = [&](CPSValue r) -> unique_ptr<CPSExpr> {
+          return make_unique<CPSCall>(CPSNames::Return, vector{r});
+        };
+        return returnType == CPSType::Float ? toFloat(v, ret) : ret(v);
+      });
     }
 
     throw runtime_error("Unsupported stmt in CPS");
   }
 
-  // ================= EXPRESSIONS =================
-  unique_ptr<CPSExpr> transformExpr(Expr *expr, const string &k) {
+  unique_ptr<CPSExpr> sequence(vector<unique_ptr<Stmt>> &stmts, size_t i,
+                               const Rest &rest) {
+    if (i == stmts.size())
+      return rest();
+    return transformStmt(stmts[i].get(),
+                         [&]() { return sequence(stmts, i + 1, rest); });
+  }
+
+  // letcont j(vs) = rest in body(j), vs the variables in assigned
+  unique_ptr<CPSExpr> join(const unordered_set<string> &assigned,
+                           const Rest &rest,
+                           const function<unique_ptr<CPSExpr>(CPSVarId)> &body) {
+    CPSVarId j = freshTemp();
+    carry(j, assigned);
+    auto saved = save(j);
+
+    auto bodyCPS = body(j);
+
+    restore(j, saved);
+    auto params = rebindEnv(j);
+    auto contCPS = rest();
+
+    return make_unique<CPSLetCont>(j, std::move(params), std::move(contCPS),
+                                   std::move(bodyCPS));
+  }
+
+  // k takes the innermost binding of each name in assigned, the only
+  // one an assignment can reach. Inner scopes only push and pop above
+  // it, so its position in env stays valid while k can be jumped to.
+  void carry(CPSVarId k, const unordered_set<string> &assigned) {
+    auto &positions = carried[k];
+    for (auto &name : assigned)
+      if (Binding *b = find(name))
+        positions.push_back(b - env.data());
+    sort(positions.begin(), positions.end());
+  }
+
+  // The part of env a statement joined by k can change: the values
+  // of the variables k takes, and the bindings its scopes push.
+  struct Saved {
+    size_t size;
+    vector<CPSValue> values;
+  };
+
+  Saved save(CPSVarId k) {
+    Saved saved{env.size(), {}};
+    for (size_t i : carried[k])
+      saved.values.push_back(env[i].value);
+    return saved;
+  }
+
+  void restore(CPSVarId k, const Saved &saved) {
+    env.erase(env.begin() + saved.size, env.end());
+    auto &positions = carried[k];
+    for (size_t i = 0; i < positions.size(); i++)
+      env[positions[i]].value = saved.values[i];
+  }
 
-    // ----- NUMBER -----
-    if (auto e = dynamic_cast<NumberExpr *>(expr)) {
-      return make_unique<CPSCall>(k, vector<string>{to_string((int)e->value)});
+  // Jump passing the current value of each variable k takes.
+  unique_ptr<CPSExpr> jump(CPSVarId k) {
+    vector<CPSValue> args;
+    for (size_t i : carried[k])
+      args.push_back(env[i].value);
+    return make_unique<CPSCall>(k, std::move(args));
+  }
+
+  // Binds each variable k takes to a fresh continuation parameter.
+  vector<CPSVarId> rebindEnv(CPSVarId k) {
+    vector<CPSVarId> params;
+    for (size_t i : carried[k]) {
+      CPSVarId p = names.add(env[i].name);
+      params.push_back(p);
+      env[i].value = CPSValue::variable(p);
     }
+    return params;
+  }
+
+  /* ================= JOINS ================= */
 
-    // ----- VARIABLE -----
-    if (auto e = dynamic_cast<VariableExpr *>(expr)) {
-      return make_unique<CPSCall>(k, vector<string>{e->name});
+  // If/while statement -> the variables bound where it starts that it
+  // may assign. By name, so an assignment to a local that shadows one
+  // of them counts too.
+  unordered_map<Stmt *, unordered_set<string>> joinAssigned;
+
+  // The bindings scanJoins sees, following the scoping rules of
+  // transformStmt: innermost last, and the count per name.
+  vector<string> scanScope;
+  unordered_map<string, size_t> scanBound;
+
+  void scanBind(const string &name) {
+    scanScope.push_back(name);
+    scanBound[name]++;
+  }
+
+  void scanUnbind(size_t mark) {
+    for (; scanScope.size() > mark; scanScope.pop_back())
+      scanBound[scanScope.back()]--;
+  }
+
+  // Moves the names in inner that are still bound, i.e. were bound
+  // before the statement started, to the statement's entry and out.
+  void scanJoin(Stmt *stmt, const vector<string> &inner, vector<string> &out) {
+    auto &assigned = joinAssigned[stmt];
+    for (auto &name : inner)
+      if (scanBound[name] && assigned.insert(name).second)
+        out.push_back(name);
+  }
+
+  // Fills joinAssigned for the statements in stmt in one pass; out
+  // gets the bound variables stmt may assign.
+  void scanJoins(Stmt *stmt, vector<string> &out) {
+    if (auto s = dynamic_cast<ExprStmt *>(stmt))
+      scanJoins(s->e.get(), out);
+    else if (auto s = dynamic_cast<PrintStmt *>(stmt))
+      scanJoins(s->e.get(), out);
+    else if (auto s = dynamic_cast<ReturnStmt *>(stmt))
+      scanJoins(s->value.get(), out);
+    else if (auto s = dynamic_cast<VarDeclStmt *>(stmt)) {
+      scanJoins(s->initializer.get(), out);
+      scanBind(s->name);
+    } else if (auto s = dynamic_cast<BlockStmt *>(stmt)) {
+      size_t mark = scanScope.size();
+      vector<string> inner;
+      for (auto &inside : s->stmts)
+        scanJoins(inside.get(), inner);
+      scanUnbind(mark);
+      for (auto &name : inner)
+        if (scanBound[name])
+          out.push_back(name);
+    } else if (auto s = dynamic_cast<IfStmt *>(stmt)) {
+      scanJoins(s->condition.get(), out);
+      size_t mark = scanScope.size();
+      vector<string> inner;
+      scanJoins(s->thenBranch.get(), inner);
+      scanUnbind(mark);
+      if (s->elseBranch)
+        scanJoins(s->elseBranch.get(), inner);
+      scanUnbind(mark);
+      scanJoin(s, inner, out);
+    } else if (auto s = dynamic_cast<WhileStmt *>(stmt)) {
+      size_t mark = scanScope.size();
+      vector<string> inner;
+      scanJoins(s->condition.get(), inner);
+      scanJoins(s->body.get(), inner);
+      scanUnbind(mark);
+      scanJoin(s, inner, out);
+    }
+  }
+
+  // Assigning an unbound name binds it, as in transformExpr.
+  void scanJoins(Expr *expr, vector<string> &out) {
+    if (auto e = dynamic_cast<BinaryExpr *>(expr)) {
+      auto *target = dynamic_cast<VariableExpr *>(e->left.get());
+      if (!target || e->op != "=")
+        scanJoins(e->left.get(), out);
+      scanJoins(e->right.get(), out);
+      if (target && e->op == "=") {
+        if (scanBound[target->name])
+          out.push_back(target->name);
+        else
+          scanBind(target->name);
+      }
+    } else if (auto u = dynamic_cast<UnaryExpr *>(expr)) {
+      scanJoins(u->right.get(), out);
+    } else if (auto c = dynamic_cast<CallExpr *>(expr)) {
+      for (auto &arg : c->args)
+        scanJoins(arg.get(), out);
+    }
+  }
+
+  // ================= EXPRESSIONS =================
+  unique_ptr<CPSExpr> transformExpr(Expr *expr, const ValueRest &k) {
+
+    // ----- ATOMS -----
+    if (dynamic_cast<NumberExpr *>(expr) || dynamic_cast<BoolExpr *>(expr) ||
+        dynamic_cast<VariableExpr *>(expr)) {
+      return k(atom(expr));
     }
 
     // ----- BINARY -----
     if (auto e = dynamic_cast<BinaryExpr *>(expr)) {
 
-      // 🔥 FIX: skip assignment
+      // assignment rebinds the variable; nothing is emitted
       if (e->op == "=") {
-        return transformExpr(e->right.get(), k);
+        auto *target = dynamic_cast<VariableExpr *>(e->left.get());
+        if (!target)
+          throw runtime_error("CPS error: arrays are not supported");
+
+        return transformExpr(e->right.get(), [&](CPSValue v) {
+          Binding *b = find(target->name);
+          if (!b) {
+            env.push_back({target->name, v, false});
+            return k(v);
+          }
+          if (!b->isFloat) {
+            b->value = v;
+            return k(v);
+          }
+          return toFloat(v, [&](CPSValue f) {
+            find(target->name)->value = f;
+            return k(f);
+          });
+        });
       }
 
-      string t = freshTemp();
+      return transformExpr(e->left.get(), [&](CPSValue l) {
+        return transformExpr(e->right.get(), [&](CPSValue r) {
+          // let t = l op r in k(t)
+          CPSVarId t = freshTemp();
+          auto rhs = make_unique<CPSPrim>(binaryOp(e->op), vector{l, r});
+          return make_unique<CPSLet>(t, std::move(rhs),
+                                     k(CPSValue::variable(t)));
+        });
+      });
+    }
+
+    //------UNARY------
+    if (auto u = dynamic_cast<UnaryExpr *>(expr)) {
+      return transformExpr(u->right.get(), [&](CPSValue v) {
+        // -a  →  let t = neg(a) in k(t)
+        CPSVarId t = freshTemp();
+        auto rhs = make_unique<CPSPrim>(
+            u->op == "-" ? CPSPrimOp::Neg : CPSPrimOp::Not, vector{v});
+        return make_unique<CPSLet>(t, std::move(rhs), k(CPSValue::variable(t)));
+      });
+    }
 
-      // k(x op y)
-      auto body = make_unique<CPSCall>(k, vector<string>{t});
+    //------CALL------
+    if (auto c = dynamic_cast<CallExpr *>(expr)) {
+      auto it = functions.find(c->callee);
+      if (it == functions.end())
+        throw runtime_error("CPS error: unknown function '" + c->callee + "'");
 
-      // let t = x op y
-      auto rhs =
-          make_unique<CPSCall>(e->op, vector<string>{getName(e->left.get()),
-                                                     getName(e->right.get())});
+      auto &callee = module.functions[module.functionIndex[it->second]];
 
-      return make_unique<CPSLet>(t, std::move(rhs), std::move(body));
+      return arguments(c, 0, {}, [&](vector<CPSValue> args) {
+        return convertArgs(it->second, callee, std::move(args), 0, k);
+      });
     }
 
-    //------UNARY------
-    else if (auto u = dynamic_cast<UnaryExpr *>(expr)) {
-      // convert -a  →  call neg(a)
-      string tmp = freshTemp();
-      return make_unique<CPSLet>(
-          tmp,
-          make_unique<CPSCall>(u->op == "-" ? "neg" : "not",
-                               vector<string>{getName(u->right.get())}),
-          make_unique<CPSCall>(k, vector<string>{tmp}));
+    throw runtime_error("Unsupported expr in CPS");
+  }
+
+  // let t = f(args) in k(t), converting int arguments passed to float
+  // parameters from index i on.
+  unique_ptr<CPSExpr> convertArgs(CPSVarId f, const CPSFunction &callee,
+                                  vector<CPSValue> args, size_t i,
+                                  const ValueRest &k) {
+    for (; i < args.size(); i++) {
+      if (callee.paramTypes[i] != CPSType::Float)
+        continue;
+      if (!args[i].isVar()) {
+        args[i] = CPSValue::floating(args[i].kind == CPSValue::Kind::Int
+                                         ? (double)args[i].intValue
+                                         : args[i].floatValue);
+        continue;
+      }
+      return toFloat(args[i], [&, i](CPSValue v) {
+        auto converted = args;
+        converted[i] = v;
+        return convertArgs(f, callee, std::move(converted), i + 1, k);
+      });
     }
 
-    throw runtime_error("Unsupported expr in CPS");
+    CPSVarId t = freshTemp();
+    auto rhs = make_unique<CPSCall>(f, std::move(args));
+    return make_unique<CPSLet>(t, std::move(rhs), k(CPSValue::variable(t)));
+  }
+
+  // Continues with v as a float: literals convert in place, variables
+  // through a tofloat primitive (a no-op on floats).
+  unique_ptr<CPSExpr> toFloat(CPSValue v, const ValueRest &k) {
+    if (v.kind == CPSValue::Kind::Float)
+      return k(v);
+    if (v.kind == CPSValue::Kind::Int)
+      return k(CPSValue::floating((double)v.intValue));
+
+    CPSVarId t = freshTemp();
+    return make_unique<CPSLet>(
+        t, make_unique<CPSPrim>(CPSPrimOp::ToFloat, vector{v}),
+        k(CPSValue::variable(t)));
   }
 
-  string getName(Expr *e) {
+  unique_ptr<CPSExpr>
+  arguments(CallExpr *c, size_t i, vector<CPSValue> done,
+            const function<unique_ptr<CPSExpr>(vector<CPSValue>)> &k) {
+    if (i == c->args.size())
+      return k(std::move(done));
+    return transformExpr(c->args[i].get(), [&](CPSValue v) {
+      done.push_back(v);
+      return arguments(c, i + 1, done, k);
+    });
+  }
+
+  static CPSPrimOp binaryOp(const string &op) {
+    static const unordered_map<string, CPSPrimOp> ops = {
+        {"+", CPSPrimOp::Add},  {"-", CPSPrimOp::Sub},  {"*", CPSPrimOp::Mul},
+        {"/", CPSPrimOp::Div},  {"%", CPSPrimOp::Mod},  {"<", CPSPrimOp::Lt},
+        {"<=", CPSPrimOp::Le},  {">", CPSPrimOp::Gt},   {">=", CPSPrimOp::Ge},
+        {"==", CPSPrimOp::Eq},  {"!=", CPSPrimOp::Ne},  {"&&", CPSPrimOp::And},
+        {"||", CPSPrimOp::Or}};
+
+    auto it = ops.find(op);
+    if (it == ops.end())
+      throw runtime_error("CPS error: unknown operator '" + op + "'");
+    return it->second;
+  }
+
+  /* ================= VARIABLES ================= */
+
+  // ANF temporaries are assigned without a declaration, so a
+  // missing binding is not an error on assignment.
+  Binding *find(const string &name) {
+    for (auto it = env.rbegin(); it != env.rend(); ++it)
+      if (it->name == name)
+        return &*it;
+    return nullptr;
+  }
+
+  CPSValue lookup(const string &name) {
+    if (Binding *b = find(name))
+      return b->value;
+    throw runtime_error("CPS error: unknown variable '" + name + "'");
+  }
+
+  static CPSValue literal(NumberExpr *n) {
+    return n->isFloat ? CPSValue::floating(n->floatValue)
+                      : CPSValue::integer(n->intValue);
+  }
+
+  CPSValue atom(Expr *e) {
 
     if (auto v = dynamic_cast<VariableExpr *>(e))
-      return v->name;
+      return lookup(v->name);
 
     if (auto n = dynamic_cast<NumberExpr *>(e))
-      return to_string((int)n->value);
+      return literal(n);
 
-    // TEMP bridge: unary expressions must have been ANF'd
-    if (auto u = dynamic_cast<UnaryExpr *>(e)) {
-      if (u->op == "-")
-        return "-" + getName(u->right.get());
-      if (u->op == "!")
-        return "!" + getName(u->right.get());
-    }
+    if (auto b = dynamic_cast<BoolExpr *>(e))
+      return CPSValue::integer(b->value);
 
     throw runtime_error(
         "CPS error: expected variable or literal (ANF violation)");
@@ -0,0 +1,466 @@
+#pragma once
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "../ir/cps.h"
+
+using namespace std;
+
+/*
+    Shrinking reductions over CPS (Appel & Jim, "Shrinking Lambda
+    Expressions in Linear Time").
+
+    Each round takes a census of variable uses, then rewrites the
+    tree once:
+
+      - dead let:       a pure let whose variable is unused is dropped
+      - constant fold:  a primitive on literals becomes its result
+      - dead letcont:   an unused continuation is dropped
+      - beta:           a non-recursive continuation used once is
+                        inlined at its call site
+      - eta:            letcont k(xs) = j(xs) makes k an alias of j
+      - copies:         a continuation parameter that receives the
+                        same value at every call site is replaced by
+                        that value; unused parameters are removed
+      - known if:       if on a literal keeps one branch
+      - tail call:      let t = f(xs) in return(t) becomes f(xs)
+
+    Rounds repeat until nothing changes. Every change removes a node
+    or a parameter, so that point is always reached.
+
+    The census tables are indexed by variable and sized for the whole
+    module once; a round only resets the entries the previous round
+    touched, so its cost follows the size of the function.
+*/
+struct CPSShrinkPass {
+
+  void run(CPSModule &m) {
+    for (auto &f : m.functions)
+      run(f, m);
+  }
+
+  void run(CPSFunction &f, const CPSModule &m) {
+    module = &m;
+    do {
+      census(f);
+      changed = false;
+      f.body = shrink(std::move(f.body));
+    } while (changed);
+    module = nullptr;
+  }
+
+private:
+  const CPSModule *module = nullptr;
+  bool changed = false;
+
+  // ----- census -----
+  vector<uint32_t> uses;
+  vector<bool> recursive;
+  vector<bool> inside; // currently inside the continuation's body
+
+  // continuation parameter -> the single value it receives, if any
+  enum class ArgState : uint8_t { None, One, Many };
+  vector<ArgState> argState;
+  vector<CPSValue> argValue;
+
+  unordered_map<CPSVarId, vector<CPSVarId>> contParams;
+
+  // the variables the last census saw, bound or used
+  vector<CPSVarId> touched;
+
+  // ----- rewrite -----
+  vector<CPSValue> subst;
+
+  struct Pending {
+    vector<CPSVarId> params;
+    unique_ptr<CPSExpr> body;
+  };
+  unordered_map<CPSVarId, Pending> pending;
+  unordered_map<CPSVarId, vector<bool>> keep;
+
+  /* ================= CENSUS ================= */
+
+  void census(CPSFunction &f) {
+    size_t n = module->names.size();
+    if (subst.size() != n) {
+      uses.assign(n, 0);
+      recursive.assign(n, false);
+      inside.assign(n, false);
+      argState.assign(n, ArgState::None);
+      argValue.assign(n, CPSValue::integer(0));
+      subst.clear();
+      for (CPSVarId v = 0; v < n; v++)
+        subst.push_back(CPSValue::variable(v));
+      touched.clear();
+    }
+
+    // The rewrite only substitutes variables its function binds, all
+    // of which the census saw.
+    for (CPSVarId v : touched) {
+      uses[v] = 0;
+      recursive[v] = false;
+      inside[v] = false;
+      argState[v] = ArgState::None;
+      argValue[v] = CPSValue::integer(0);
+      subst[v] = CPSValue::variable(v);
+    }
+    touched.clear();
+    contParams.clear();
+    pending.clear();
+    keep.clear();
+
+    count(f.body.get());
+  }
+
+  void use(const CPSValue &v) {
+    if (v.isVar()) {
+      uses[v.var]++;
+      touched.push_back(v.var);
+    }
+  }
+
+  void count(CPSExpr *e) {
+
+    if (auto x = dynamic_cast<CPSCall *>(e)) {
+      use(CPSValue::variable(x->func));
+      if (inside[x->func])
+        recursive[x->func] = true;
+
+      auto it = contParams.find(x->func);
+      for (size_t i = 0; i < x->args.size(); i++) {
+        const CPSValue &a = x->args[i];
+
+        if (it == contParams.end()) {
+          use(a);
+          continue;
+        }
+
+        // passing a loop variable back to itself is not a use
+        CPSVarId p = it->second[i];
+        if (a.isVar() && a.var == p)
+          continue;
+
+        use(a);
+        mergeArg(p, a);
+      }
+      return;
+    }
+
+    if (auto x = dynamic_cast<CPSPrim *>(e)) {
+      for (auto &a : x->args)
+        use(a);
+      return;
+    }
+
+    if (auto x = dynamic_cast<CPSLet *>(e)) {
+      touched.push_back(x->var);
+      count(x->rhs.get());
+      count(x->body.get());
+      return;
+    }
+
+    if (auto x = dynamic_cast<CPSIf *>(e)) {
+      use(x->cond);
+      count(x->thenE.get());
+      count(x->elseE.get());
+      return;
+    }
+
+    if (auto x = dynamic_cast<CPSLetCont *>(e)) {
+      touched.push_back(x->k);
+      touched.insert(touched.end(), x->params.begin(), x->params.end());
+      contParams[x->k] = x->params;
+      inside[x->k] = true;
+      count(x->contBody.get());
+      inside[x->k] = false;
+      count(x->body.get());
+      return;
+    }
+  }
+
+  void mergeArg(CPSVarId p, const CPSValue &a) {
+    switch (argState[p]) {
+    case ArgState::None:
+      argState[p] = ArgState::One;
+      argValue[p] = a;
+      break;
+    case ArgState::One:
+      if (!same(argValue[p], a))
+        argState[p] = ArgState::Many;
+      break;
+    case ArgState::Many:
+      break;
+    }
+  }
+
+  static bool same(const CPSValue &a, const CPSValue &b) {
+    if (a.kind != b.kind)
+      return false;
+    switch (a.kind) {
+    case CPSValue::Kind::Var:
+      return a.var == b.var;
+    case CPSValue::Kind::Int:
+      return a.intValue == b.intValue;
+    case CPSValue::Kind::Float:
+      return a.floatValue == b.floatValue;
+    }
+    return false;
+  }
+
+  /* ================= REWRITE ================= */
+
+  // Substitutions may chain (a parameter replaced by a variable that
+  // is itself folded later), so follow them to the end.
+  CPSValue resolve(CPSValue v) const {
+    while (v.isVar() && !same(subst[v.var], v))
+      v = subst[v.var];
+    return v;
+  }
+
+  void resolveAll(vector<CPSValue> &args) const {
+    for (auto &a : args)
+      a = resolve(a);
+  }
+
+  unique_ptr<CPSExpr> shrink(unique_ptr<CPSExpr> e) {
+
+    if (auto x = dynamic_cast<CPSCall *>(e.get()))
+      return shrinkCall(x, std::move(e));
+
+    if (auto x = dynamic_cast<CPSLet *>(e.get())) {
+
+      if (auto prim = dynamic_cast<CPSPrim *>(x->rhs.get())) {
+        resolveAll(prim->args);
+
+        if (prim->op != CPSPrimOp::Print && uses[x->var] == 0) {
+          changed = true;
+          return shrink(std::move(x->body));
+        }
+
+        CPSValue folded = CPSValue::integer(0);
+        if (fold(prim, folded)) {
+          subst[x->var] = folded;
+          changed = true;
+          return shrink(std::move(x->body));
+        }
+      }
+
+      if (auto call = dynamic_cast<CPSCall *>(x->rhs.get())) {
+        resolveAll(call->args);
+        x->body = shrink(std::move(x->body));
+
+        // let t = f(xs) in return(t)  =>  f(xs)
+        auto *ret = dynamic_cast<CPSCall *>(x->body.get());
+        if (ret && ret->func == CPSNames::Return && ret->args.size() == 1 &&
+            ret->args[0].isVar() && ret->args[0].var == x->var) {
+          changed = true;
+          return std::move(x->rhs);
+        }
+        return e;
+      }
+
+      x->body = shrink(std::move(x->body));
+      return e;
+    }
+
+    if (auto x = dynamic_cast<CPSIf *>(e.get())) {
+      x->cond = resolve(x->cond);
+
+      if (!x->cond.isVar()) {
+        changed = true;
+        bool taken = x->cond.kind == CPSValue::Kind::Float
+                         ? x->cond.floatValue != 0.0
+                         : x->cond.intValue != 0;
+        return shrink(std::move(taken ? x->thenE : x->elseE));
+      }
+
+      x->thenE = shrink(std::move(x->thenE));
+      x->elseE = shrink(std::move(x->elseE));
+      return e;
+    }
+
+    if (auto x = dynamic_cast<CPSLetCont *>(e.get()))
+      return shrinkLetCont(x, std::move(e));
+
+    return e;
+  }
+
+  unique_ptr<CPSExpr> shrinkLetCont(CPSLetCont *x, unique_ptr<CPSExpr> e) {
+    CPSVarId k = x->k;
+
+    if (uses[k] == 0 || (recursive[k] && uses[k] == 1)) {
+      changed = true;
+      return shrink(std::move(x->body));
+    }
+
+    // letcont k(xs) = j(xs)  =>  k := j
+    if (auto call = dynamic_cast<CPSCall *>(x->contBody.get())) {
+      CPSVarId j = resolve(CPSValue::variable(call->func)).var;
+      if (j != k && !pending.count(j) && forwardsParams(x, call)) {
+        subst[k] = CPSValue::variable(j);
+        changed = true;
+        return shrink(std::move(x->body));
+      }
+    }
+
+    // beta: inline at the single call site
+    if (uses[k] == 1 && !recursive[k]) {
+      pending[k] = Pending{x->params, std::move(x->contBody)};
+      changed = true;
+      auto body = shrink(std::move(x->body));
+      pending.erase(k);
+      return body;
+    }
+
+    // parameters fed one value everywhere become that value
+    vector<bool> mask(x->params.size(), true);
+    vector<CPSVarId> kept;
+    for (size_t i = 0; i < x->params.size(); i++) {
+      CPSVarId p = x->params[i];
+
+      if (argState[p] == ArgState::One) {
+        subst[p] = resolve(argValue[p]);
+        mask[i] = false;
+      } else if (uses[p] == 0) {
+        mask[i] = false;
+      }
+
+      if (mask[i])
+        kept.push_back(p);
+      else
+        changed = true;
+    }
+
+    x->params = std::move(kept);
+    keep[k] = std::move(mask);
+
+    // The body first: a substituted parameter may name a variable
+    // the body defines, and its replacement must be known here.
+    x->body = shrink(std::move(x->body));
+    x->contBody = shrink(std::move(x->contBody));
+    return e;
+  }
+
+  unique_ptr<CPSExpr> shrinkCall(CPSCall *x, unique_ptr<CPSExpr> e) {
+    resolveAll(x->args);
+
+    CPSValue f = resolve(CPSValue::variable(x->func));
+    x->func = f.var;
+
+    auto p = pending.find(x->func);
+    if (p != pending.end()) {
+      for (size_t i = 0; i < x->args.size(); i++)
+        subst[p->second.params[i]] = x->args[i];
+      auto body = std::move(p->second.body);
+      pending.erase(p);
+      return shrink(std::move(body));
+    }
+
+    auto m = keep.find(x->func);
+    if (m != keep.end()) {
+      vector<CPSValue> args;
+      for (size_t i = 0; i < x->args.size(); i++)
+        if (m->second[i])
+          args.push_back(x->args[i]);
+      x->args = std::move(args);
+    }
+
+    return e;
+  }
+
+  static bool forwardsParams(CPSLetCont *k, CPSCall *call) {
+    if (call->args.size() != k->params.size())
+      return false;
+    for (size_t i = 0; i < call->args.size(); i++)
+      if (!call->args[i].isVar() || call->args[i].var != k->params[i])
+        return false;
+    return true;
+  }
+
+  /* ================= FOLDING ================= */
+
+  static int32_t wrap32(long long v) { return (int32_t)(uint32_t)v; }
+
+  static bool fold(CPSPrim *p, CPSValue &out) {
+    for (auto &a : p->args)
+      if (a.isVar())
+        return false;
+
+    if (p->args.size() == 1) {
+      const CPSValue &a = p->args[0];
+      bool isFloat = a.kind == CPSValue::Kind::Float;
+
+      if (p->op == CPSPrimOp::Neg) {
+        out = isFloat ? CPSValue::floating(-a.floatValue)
+                      : CPSValue::integer(wrap32(-a.intValue));
+        return true;
+      }
+      if (p->op == CPSPrimOp::ToFloat) {
+        out = isFloat ? a : CPSValue::floating((double)a.intValue);
+        return true;
+      }
+      if (p->op == CPSPrimOp::Not) {
+        out = CPSValue::integer(isFloat ? a.floatValue == 0.0
+                                        : a.intValue == 0);
+        return true;
+      }
+      return false;
+    }
+
+    if (p->args.size() != 2)
+      return false;
+
+    const CPSValue &l = p->args[0];
+    const CPSValue &r = p->args[1];
+
+    if (l.kind == CPSValue::Kind::Int && r.kind == CPSValue::Kind::Int)
+      return foldInt(p->op, l.intValue, r.intValue, out);
+
+    double a = l.kind == CPSValue::Kind::Float ? l.floatValue : l.intValue;
+    double b = r.kind == CPSValue::Kind::Float ? r.floatValue : r.intValue;
+    return foldFloat(p->op, a, b, out);
+  }
+
+  static bool foldInt(CPSPrimOp op, long long a, long long b, CPSValue &out) {
+    switch (op) {
+    case CPSPrimOp::Add: out = CPSValue::integer(wrap32(a + b)); return true;
+    case CPSPrimOp::Sub: out = CPSValue::integer(wrap32(a - b)); return true;
+    case CPSPrimOp::Mul: out = CPSValue::integer(wrap32(a * b)); return true;
+    case CPSPrimOp::Div:
+    case CPSPrimOp::Mod:
+      // leave traps to run time
+      if (b == 0 || (a == INT_MIN && b == -1))
+        return false;
+      out = CPSValue::integer(op == CPSPrimOp::Div ? a / b : a % b);
+      return true;
+    case CPSPrimOp::Lt: out = CPSValue::integer(a < b); return true;
+    case CPSPrimOp::Le: out = CPSValue::integer(a <= b); return true;
+    case CPSPrimOp::Gt: out = CPSValue::integer(a > b); return true;
+    case CPSPrimOp::Ge: out = CPSValue::integer(a >= b); return true;
+    case CPSPrimOp::Eq: out = CPSValue::integer(a == b); return true;
+    case CPSPrimOp::Ne: out = CPSValue::integer(a != b); return true;
+    case CPSPrimOp::And: out = CPSValue::integer(a && b); return true;
+    case CPSPrimOp::Or: out = CPSValue::integer(a || b); return true;
+    default: return false;
+    }
+  }
+
+  static bool foldFloat(CPSPrimOp op, double a, double b, CPSValue &out) {
+    switch (op) {
+    case CPSPrimOp::Add: out = CPSValue::floating(a + b); return true;
+    case CPSPrimOp::Sub: out = CPSValue::floating(a - b); return true;
+    case CPSPrimOp::Mul: out = CPSValue::floating(a * b); return true;
+    case CPSPrimOp::Div: out = CPSValue::floating(a / b); return true;
+    case CPSPrimOp::Lt: out = CPSValue::integer(a < b); return true;
+    case CPSPrimOp::Le: out = CPSValue::integer(a <= b); return true;
+    case CPSPrimOp::Gt: out = CPSValue::integer(a > b); return true;
+    case CPSPrimOp::Ge: out = CPSValue::integer(a >= b); return true;
+    case CPSPrimOp::Eq: out = CPSValue::integer(a == b); return true;
+    case CPSPrimOp::Ne: out = CPSValue::integer(a != b); return true;
+    default: return false;
+    }
+  }
+};
@@ -1,89 +1,48 @@
 #pragma once
 #include "../ast/expr.h"
 #include "../ast/stmt.h"
+#include "rewrite_pass.h"
 #include <memory>
 
 using namespace std;
 
-struct DesugarBoolPass {
+struct DesugarBoolPass : RewritePass {
+
+  const char *name() const override { return "desugar-bool"; }
+  FeatureSet matches() const override { return Feature::BoolLiteral; }
+
+  unique_ptr<Expr> transformExpr(unique_ptr<Expr> e) {
+    return RewriteWalker({this}).walkExpr(std::move(e));
+  }
+
+  unique_ptr<Stmt> transformStmt(unique_ptr<Stmt> s) {
+    return RewriteWalker({this}).walkStmt(std::move(s));
+  }
 
   // ======================================================
   // BOOL → INT (EXPRESSION LEVEL)
   // ======================================================
-  unique_ptr<Expr> transformExpr(unique_ptr<Expr> e) {
+  unique_ptr<Expr> rewriteExpr(unique_ptr<Expr> e) override {
 
     // 1️⃣ REAL boolean literal node → number
-    if (auto b = dynamic_cast<BoolExpr *>(e.get())) {
-      return make_unique<NumberExpr>(b->value ? 1 : 0);
-    }
+    if (auto b = dynamic_cast<BoolExpr *>(e.get()))
+      return number(b->value, b->loc);
 
     // 2️⃣ Legacy case: "true"/"false" parsed as identifiers
     if (auto v = dynamic_cast<VariableExpr *>(e.get())) {
       if (v->name == "true")
-        return make_unique<NumberExpr>(1);
+        return number(true, v->loc);
       if (v->name == "false")
-        return make_unique<NumberExpr>(0);
-      return e;
-    }
-
-    // 3️⃣ Binary expression
-    if (auto b = dynamic_cast<BinaryExpr *>(e.get())) {
-      b->left = transformExpr(std::move(b->left));
-      b->right = transformExpr(std::move(b->right));
-      return e;
-    }
-
-    // 4️⃣ Unary expression
-    if (auto u = dynamic_cast<UnaryExpr *>(e.get())) {
-      u->right = transformExpr(std::move(u->right));
-      return e;
-    }
-
-    // 5️⃣ Function call
-    if (auto c = dynamic_cast<CallExpr *>(e.get())) {
-      for (auto &a : c->args)
-        a = transformExpr(std::move(a));
-      return e;
+        return number(false, v->loc);
     }
 
     return e;
   }
 
-  // ======================================================
-  // STATEMENT LEVEL
-  // ======================================================
-  unique_ptr<Stmt> transformStmt(unique_ptr<Stmt> s) {
-
-    if (auto e = dynamic_cast<ExprStmt *>(s.get())) {
-      e->e = transformExpr(std::move(e->e));
-      return s;
-    }
-
-    if (auto p = dynamic_cast<PrintStmt *>(s.get())) {
-      p->e = transformExpr(std::move(p->e));
-      return s;
-    }
-
-    if (auto i = dynamic_cast<IfStmt *>(s.get())) {
-      i->condition = transformExpr(std::move(i->condition));
-      i->thenBranch = transformStmt(std::move(i->thenBranch));
-      if (i->elseBranch)
-        i->elseBranch = transformStmt(std::move(i->elseBranch));
-      return s;
-    }
-
-    if (auto w = dynamic_cast<WhileStmt *>(s.get())) {
-      w->condition = transformExpr(std::move(w->condition));
-      w->body = transformStmt(std::move(w->body));
-      return s;
-    }
-
-    if (auto b = dynamic_cast<BlockStmt *>(s.get())) {
-      for (auto &x : b->stmts)
-        x = transformStmt(std::move(x));
-      return s;
-    }
-
-    return s;
+private:
+  static unique_ptr<Expr> number(bool value, SourceLocation loc) {
+    auto n = make_unique<NumberExpr>(value ? 1LL : 0LL);
+    n->loc = loc;
+    return n;
   }
 };
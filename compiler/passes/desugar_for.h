@@ -2,44 +2,40 @@
 
 #include "../ast/expr.h"
 #include "../ast/stmt.h"
-#include "../lexer/lexer.h"
-#include <cctype> // for isdigit, isalpha, isalnum
-#include <iostream>
+#include "../common/error.h"
+#include "rewrite_pass.h"
 #include <memory>
-#include <stdexcept> // for runtime_error
-#include <string>
-#include <unordered_map>
-#include <vector>
 
 using namespace std;
 
 //======PASS 1 : FOR -> WHILE DESUGARING========//
-struct DesugarForPass {
+struct DesugarForPass : RewritePass {
 
-  unique_ptr<Stmt> transform(unique_ptr<Stmt> stmt) {
-    if (auto f = dynamic_cast<ForStmt *>(stmt.get())) {
-      return desugarFor(f);
-    }
+  // A while loop cannot carry a `parallel`/`simd` hint. Hinted loops
+  // are kept when the consumer lowers for loops itself (ANF before
+  // LLVM codegen) and rejected otherwise, rather than run plain.
+  bool keepHinted;
 
-    if (auto b = dynamic_cast<BlockStmt *>(stmt.get())) {
-      auto nb = make_unique<BlockStmt>();
-      for (auto &s : b->stmts)
-        nb->stmts.push_back(transform(std::move(s)));
-      return nb;
-    }
+  explicit DesugarForPass(bool keepHinted = false) : keepHinted(keepHinted) {}
 
-    if (auto w = dynamic_cast<WhileStmt *>(stmt.get())) {
-      return make_unique<WhileStmt>(std::move(w->condition),
-                                    transform(std::move(w->body)));
-    }
+  const char *name() const override { return "desugar-for"; }
+  FeatureSet matches() const override { return Feature::For; }
 
-    if (auto i = dynamic_cast<IfStmt *>(stmt.get())) {
-      return make_unique<IfStmt>(
-          std::move(i->condition), transform(std::move(i->thenBranch)),
-          i->elseBranch ? transform(std::move(i->elseBranch)) : nullptr);
-    }
+  unique_ptr<Stmt> transform(unique_ptr<Stmt> stmt) {
+    return RewriteWalker({this}).walkStmt(std::move(stmt));
+  }
 
-    // all other statements stay unchanged
+  // Children are already desugared when the walker gets here.
+  unique_ptr<Stmt> rewriteStmt(unique_ptr<Stmt> stmt) override {
+    if (auto f = dynamic_cast<ForStmt *>(stmt.get())) {
+      if (f->hint == LoopHint::None)
+        return desugarFor(f);
+      if (!keepHinted)
+        throw CompileError(string(f->hint == LoopHint::Parallel ? "'parallel for'"
+                                                                : "'simd for'") +
+                               " is only supported by the default backend",
+                           f->loc.line, f->loc.col);
+    }
     return stmt;
   }
 
@@ -59,25 +55,27 @@ private:
     */
 
     auto block = make_unique<BlockStmt>();
+    block->loc = f->loc;
 
     if (f->init)
-      block->stmts.push_back(transform(std::move(f->init)));
+      block->stmts.push_back(std::move(f->init));
 
     unique_ptr<Stmt> newBody;
 
     if (f->increment) {
       auto bodyBlock = make_unique<BlockStmt>();
-      bodyBlock->stmts.push_back(transform(std::move(f->body)));
+      bodyBlock->stmts.push_back(std::move(f->body));
       bodyBlock->stmts.push_back(
           make_unique<ExprStmt>(std::move(f->increment)));
       newBody = std::move(bodyBlock);
     } else {
-      newBody = transform(std::move(f->body));
+      newBody = std::move(f->body);
     }
 
     auto whileStmt = make_unique<WhileStmt>(
-        f->condition ? std::move(f->condition) : make_unique<NumberExpr>(1),
+        f->condition ? std::move(f->condition) : make_unique<NumberExpr>(1LL),
         std::move(newBody));
+    whileStmt->loc = f->loc;
 
     block->stmts.push_back(std::move(whileStmt));
     return block;
@@ -1,64 +1,24 @@
 #pragma once
 
+#include "../ast/clone.h"
 #include "../ast/expr.h"
 #include "../ast/stmt.h"
+#include "rewrite_pass.h"
 
 
-struct DesugarIfElsePass {
+struct DesugarIfElsePass : RewritePass {
 
-  unique_ptr<Stmt> transform(unique_ptr<Stmt> stmt) {
-
-    if (auto b = dynamic_cast<BlockStmt *>(stmt.get())) {
-      auto nb = make_unique<BlockStmt>();
-      for (auto &s : b->stmts)
-        nb->stmts.push_back(transform(std::move(s)));
-      return nb;
-    }
-
-    if (auto i = dynamic_cast<IfStmt *>(stmt.get())) {
-      return desugarIf(std::move(stmt));
-    }
-
-    if (auto w = dynamic_cast<WhileStmt *>(stmt.get())) {
-      w->condition = transformExpr(std::move(w->condition));
-      w->body = transform(std::move(w->body));
-      return stmt;
-    }
-
-    if (auto e = dynamic_cast<ExprStmt *>(stmt.get())) {
-      e->e = transformExpr(std::move(e->e));
-      return stmt;
-    }
-
-    if (auto p = dynamic_cast<PrintStmt *>(stmt.get())) {
-      p->e = transformExpr(std::move(p->e));
-      return stmt;
-    }
-
-    if (auto r = dynamic_cast<ReturnStmt *>(stmt.get())) {
-      if (r->value)
-        r->value = transformExpr(std::move(r->value));
-      return stmt;
-    }
+  const char *name() const override { return "desugar-if-else"; }
+  FeatureSet matches() const override { return Feature::IfElse; }
 
-    return stmt;
+  unique_ptr<Stmt> transform(unique_ptr<Stmt> stmt) {
+    return RewriteWalker({this}).walkStmt(std::move(stmt));
   }
 
-private:
-  unique_ptr<Stmt> desugarIf(unique_ptr<Stmt> stmt) {
-    auto *ifs = static_cast<IfStmt *>(stmt.get());
-
-    // First recursively transform children
-    auto cond = transformExpr(std::move(ifs->condition));
-    auto thenB = transform(std::move(ifs->thenBranch));
-
-    // If there is NO else → just normalize children
-    if (!ifs->elseBranch) {
-      return make_unique<IfStmt>(std::move(cond), std::move(thenB), nullptr);
-    }
-
-    // else exists → desugar
-    auto elseB = transform(std::move(ifs->elseBranch));
+  unique_ptr<Stmt> rewriteStmt(unique_ptr<Stmt> stmt) override {
+    auto *ifs = dynamic_cast<IfStmt *>(stmt.get());
+    if (!ifs || !ifs->elseBranch)
+      return stmt;
 
     /*
         if (c) T else E
@@ -70,68 +30,20 @@ private:
     */
 
     auto block = make_unique<BlockStmt>();
+    block->loc = ifs->loc;
+
+    // the condition is needed twice
+    auto negated = make_unique<UnaryExpr>("!", cloneExpr(ifs->condition.get()));
+    negated->loc = ifs->condition->loc;
 
     // if (c) T
     block->stmts.push_back(make_unique<IfStmt>(
-        make_unique<BinaryExpr>("", nullptr, nullptr), // placeholder
-        nullptr, nullptr));
-
-    block->stmts.back() =
-        make_unique<IfStmt>(cloneExpr(cond.get()), std::move(thenB), nullptr);
+        std::move(ifs->condition), std::move(ifs->thenBranch), nullptr));
 
     // if (!c) E
-    block->stmts.push_back(
-        make_unique<IfStmt>(make_unique<UnaryExpr>("!", cloneExpr(cond.get())),
-                            std::move(elseB), nullptr));
+    block->stmts.push_back(make_unique<IfStmt>(
+        std::move(negated), std::move(ifs->elseBranch), nullptr));
 
     return block;
   }
-
-  /* -------- Expression utilities -------- */
-
-  unique_ptr<Expr> transformExpr(unique_ptr<Expr> expr) {
-    if (auto b = dynamic_cast<BinaryExpr *>(expr.get())) {
-      b->left = transformExpr(std::move(b->left));
-      b->right = transformExpr(std::move(b->right));
-      return expr;
-    }
-
-    if (auto u = dynamic_cast<UnaryExpr *>(expr.get())) {
-      u->right = transformExpr(std::move(u->right));
-      return expr;
-    }
-
-    if (auto c = dynamic_cast<CallExpr *>(expr.get())) {
-      for (auto &a : c->args)
-        a = transformExpr(std::move(a));
-      return expr;
-    }
-
-    return expr;
-  }
-
-  // Needed because we reuse condition twice
-  unique_ptr<Expr> cloneExpr(const Expr *e) {
-    if (auto n = dynamic_cast<const NumberExpr *>(e))
-      return make_unique<NumberExpr>(n->value);
-
-    if (auto v = dynamic_cast<const VariableExpr *>(e))
-      return make_unique<VariableExpr>(v->name);
-
-    if (auto u = dynamic_cast<const UnaryExpr *>(e))
-      return make_unique<UnaryExpr>(u->op, cloneExpr(u->right.get()));
-
-    if (auto b = dynamic_cast<const BinaryExpr *>(e))
-      return make_unique<BinaryExpr>(b->op, cloneExpr(b->left.get()),
-                                     cloneExpr(b->right.get()));
-
-    if (auto c = dynamic_cast<const CallExpr *>(e)) {
-      vector<unique_ptr<Expr>> args;
-      for (auto &a : c->args)
-        args.push_back(cloneExpr(a.get()));
-      return make_unique<CallExpr>(c->callee, std::move(args));
-    }
-
-    throw runtime_error("Unsupported expr clone");
-  }
 };
@@ -1,48 +1,38 @@
 #pragma once
 
+#include "../ast/clone.h"
 #include "../ast/expr.h"
 #include "../ast/stmt.h"
+#include "../common/error.h"
+#include "rewrite_pass.h"
 
 
-struct DesugarIncDecPass {
+struct DesugarIncDecPass : RewritePass {
+
+  const char *name() const override { return "desugar-inc-dec"; }
+  FeatureSet matches() const override { return Feature::IncDec; }
 
   /* ===== ENTRY ===== */
 
   unique_ptr<Stmt> transformStmt(unique_ptr<Stmt> stmt) {
+    return RewriteWalker({this}).walkStmt(std::move(stmt));
+  }
 
-    if (auto b = dynamic_cast<BlockStmt *>(stmt.get())) {
-      auto nb = make_unique<BlockStmt>();
-      for (auto &s : b->stmts)
-        nb->stmts.push_back(transformStmt(std::move(s)));
-      return nb;
-    }
-
-    if (auto e = dynamic_cast<ExprStmt *>(stmt.get())) {
-      return desugarExprStmt(std::move(stmt));
-    }
-
-    if (auto p = dynamic_cast<PrintStmt *>(stmt.get())) {
-      p->e = transformExpr(std::move(p->e));
-      return stmt;
-    }
+  /* ===== STATEMENT-LEVEL DESUGARING ===== */
 
-    if (auto i = dynamic_cast<IfStmt *>(stmt.get())) {
-      i->condition = transformExpr(std::move(i->condition));
-      i->thenBranch = transformStmt(std::move(i->thenBranch));
-      if (i->elseBranch)
-        i->elseBranch = transformStmt(std::move(i->elseBranch));
-      return stmt;
-    }
+  // Only statement-level ++ / -- is desugared: an expression statement,
+  // or the increment of a for loop.
+  unique_ptr<Stmt> rewriteStmt(unique_ptr<Stmt> stmt) override {
 
-    if (auto w = dynamic_cast<WhileStmt *>(stmt.get())) {
-      w->condition = transformExpr(std::move(w->condition));
-      w->body = transformStmt(std::move(w->body));
+    if (auto es = dynamic_cast<ExprStmt *>(stmt.get())) {
+      if (isIncDec(es->e.get()))
+        es->e = desugar(std::move(es->e));
       return stmt;
     }
 
-    if (auto r = dynamic_cast<ReturnStmt *>(stmt.get())) {
-      if (r->value)
-        r->value = transformExpr(std::move(r->value));
+    if (auto f = dynamic_cast<ForStmt *>(stmt.get())) {
+      if (f->increment && isIncDec(f->increment.get()))
+        f->increment = desugar(std::move(f->increment));
       return stmt;
     }
 
@@ -50,57 +40,41 @@ struct DesugarIncDecPass {
   }
 
 private:
-  /* ===== STATEMENT-LEVEL DESUGARING ===== */
-
-  unique_ptr<Stmt> desugarExprStmt(unique_ptr<Stmt> stmt) {
-    auto *es = static_cast<ExprStmt *>(stmt.get());
-
-    // Only desugar top-level ++ / --
-    if (auto u = dynamic_cast<UnaryExpr *>(es->e.get())) {
-
-      if (u->op == "++" || u->op == "--") {
-
-        auto *var = dynamic_cast<VariableExpr *>(u->right.get());
-        if (!var)
-          throw runtime_error("++/-- requires variable");
-
-        string name = var->name;
-        string op = (u->op == "++") ? "+" : "-";
-
-        // x++  ->  x = x + 1
-        return make_unique<ExprStmt>(make_unique<BinaryExpr>(
-            "=", make_unique<VariableExpr>(name),
-            make_unique<BinaryExpr>(op, make_unique<VariableExpr>(name),
-                                    make_unique<NumberExpr>(1))));
-      }
-    }
-
-    // Otherwise just recurse
-    es->e = transformExpr(std::move(es->e));
-    return stmt;
+  static bool isIncDec(const Expr *e) {
+    auto u = dynamic_cast<const UnaryExpr *>(e);
+    return u && (u->op == "++" || u->op == "--");
   }
 
-  /* ===== EXPRESSION TRANSFORM ===== */
+  // x++  ->  x = x + 1,  a[i]++  ->  a[i] = a[i] + 1
+  unique_ptr<Expr> desugar(unique_ptr<Expr> expr) {
+    auto *u = static_cast<UnaryExpr *>(expr.get());
+    Expr *target = u->right.get();
 
-  unique_ptr<Expr> transformExpr(unique_ptr<Expr> expr) {
+    if (!assignable(target))
+      throw CompileError("'" + u->op +
+                             "' needs a variable or an array element whose "
+                             "index has no calls or assignments",
+                         u->loc.line, u->loc.col);
 
-    if (auto b = dynamic_cast<BinaryExpr *>(expr.get())) {
-      b->left = transformExpr(std::move(b->left));
-      b->right = transformExpr(std::move(b->right));
-      return expr;
-    }
+    string op = (u->op == "++") ? "+" : "-";
 
-    if (auto u = dynamic_cast<UnaryExpr *>(expr.get())) {
-      u->right = transformExpr(std::move(u->right));
-      return expr;
-    }
+    auto one = make_unique<NumberExpr>(1LL);
+    one->loc = u->loc;
+    auto value = make_unique<BinaryExpr>(op, cloneExpr(target), std::move(one));
+    value->loc = u->loc;
 
-    if (auto c = dynamic_cast<CallExpr *>(expr.get())) {
-      for (auto &a : c->args)
-        a = transformExpr(std::move(a));
-      return expr;
-    }
+    auto out =
+        make_unique<BinaryExpr>("=", std::move(u->right), std::move(value));
+    out->loc = u->loc;
+    return out;
+  }
 
-    return expr;
+  // the target is read once more, so its index must be pure
+  static bool assignable(const Expr *e) {
+    if (dynamic_cast<const VariableExpr *>(e))
+      return true;
+    auto i = dynamic_cast<const IndexExpr *>(e);
+    return i && dynamic_cast<const VariableExpr *>(i->array.get()) &&
+           isPure(i->index.get());
   }
 };
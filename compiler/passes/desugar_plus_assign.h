@@ -1,109 +1,48 @@
 #pragma once
 
+#include "../ast/clone.h"
 #include "../ast/expr.h"
 #include "../ast/stmt.h"
+#include "../common/error.h"
+#include "rewrite_pass.h"
 
 
-struct DesugarPlusAssignPass {
+struct DesugarPlusAssignPass : RewritePass {
+
+  const char *name() const override { return "desugar-plus-assign"; }
+  FeatureSet matches() const override { return Feature::CompoundAssign; }
 
   /* ========= ENTRY ========= */
 
   unique_ptr<Stmt> transformStmt(unique_ptr<Stmt> stmt) {
-
-    if (auto b = dynamic_cast<BlockStmt *>(stmt.get())) {
-      auto nb = make_unique<BlockStmt>();
-      for (auto &s : b->stmts)
-        nb->stmts.push_back(transformStmt(std::move(s)));
-      return nb;
-    }
-
-    if (auto e = dynamic_cast<ExprStmt *>(stmt.get())) {
-      e->e = transformExpr(std::move(e->e));
-      return stmt;
-    }
-
-    if (auto p = dynamic_cast<PrintStmt *>(stmt.get())) {
-      p->e = transformExpr(std::move(p->e));
-      return stmt;
-    }
-
-    if (auto i = dynamic_cast<IfStmt *>(stmt.get())) {
-      i->condition = transformExpr(std::move(i->condition));
-      i->thenBranch = transformStmt(std::move(i->thenBranch));
-      if (i->elseBranch)
-        i->elseBranch = transformStmt(std::move(i->elseBranch));
-      return stmt;
-    }
-
-    if (auto w = dynamic_cast<WhileStmt *>(stmt.get())) {
-      w->condition = transformExpr(std::move(w->condition));
-      w->body = transformStmt(std::move(w->body));
-      return stmt;
-    }
-
-    if (auto f = dynamic_cast<ForStmt *>(stmt.get())) {
-      if (f->init)
-        f->init = transformStmt(std::move(f->init));
-      if (f->condition)
-        f->condition = transformExpr(std::move(f->condition));
-      if (f->increment)
-        f->increment = transformExpr(std::move(f->increment));
-      f->body = transformStmt(std::move(f->body));
-      return stmt;
-    }
-
-    if (auto r = dynamic_cast<ReturnStmt *>(stmt.get())) {
-      if (r->value)
-        r->value = transformExpr(std::move(r->value));
-      return stmt;
-    }
-
-    return stmt;
+    return RewriteWalker({this}).walkStmt(std::move(stmt));
   }
 
-private:
   /* ========= EXPRESSION TRANSFORM ========= */
 
-  unique_ptr<Expr> transformExpr(unique_ptr<Expr> expr) {
-
-    if (auto b = dynamic_cast<BinaryExpr *>(expr.get())) {
-
-      // Recursively transform children first
-      b->left = transformExpr(std::move(b->left));
-      b->right = transformExpr(std::move(b->right));
-
-      // Desugar +=
-      if (b->op == "+=") {
-        // lhs must be variable
-        auto *var = dynamic_cast<VariableExpr *>(b->left.get());
-        if (!var)
-          throw runtime_error("Left side of += must be a variable");
-
-        string name = var->name;
-
-        // a += b  -->  a = a + b
-        auto newRight = make_unique<BinaryExpr>(
-            "+", make_unique<VariableExpr>(name), std::move(b->right));
-
-        return make_unique<BinaryExpr>("=", make_unique<VariableExpr>(name),
-                                       std::move(newRight));
-      }
+  unique_ptr<Expr> rewriteExpr(unique_ptr<Expr> expr) override {
 
+    auto *b = dynamic_cast<BinaryExpr *>(expr.get());
+    if (!b || b->op != "+=")
       return expr;
-    }
 
-    if (auto u = dynamic_cast<UnaryExpr *>(expr.get())) {
-      u->right = transformExpr(std::move(u->right));
-      return expr;
-    }
-
-    if (auto c = dynamic_cast<CallExpr *>(expr.get())) {
-      for (auto &a : c->args)
-        a = transformExpr(std::move(a));
-      return expr;
-    }
-
-    // NumberExpr, VariableExpr → unchanged
-    return expr;
+    // the target is read once more, so an index must be pure
+    Expr *target = b->left.get();
+    auto *idx = dynamic_cast<IndexExpr *>(target);
+    if (!dynamic_cast<VariableExpr *>(target) &&
+        !(idx && isPure(idx->index.get())))
+      throw CompileError("Left side of += must be a variable or an array "
+                         "element whose index has no calls or assignments",
+                         b->loc.line, b->loc.col);
+
+    // a += b  -->  a = a + b,  a[i] += b  -->  a[i] = a[i] + b
+    auto newRight =
+        make_unique<BinaryExpr>("+", cloneExpr(target), std::move(b->right));
+    newRight->loc = b->loc;
+
+    auto out = make_unique<BinaryExpr>("=", std::move(b->left),
+                                       std::move(newRight));
+    out->loc = b->loc;
+    return out;
   }
 };
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "../ir/ir.h"
+
+using namespace std;
+
+/*
+    Cleanup passes over the mid-level IR, run per function:
+
+      - unreachable blocks are emptied and dropped from the CFG
+      - copies and trivial phis are forwarded to their source
+      - pure instructions are value-numbered along the dominator
+        tree (a repeat of a dominating computation becomes a copy)
+      - instructions whose result is never used are removed
+
+    Dominators follow Cooper, Harvey and Kennedy, "A Simple, Fast
+    Dominance Algorithm".
+*/
+struct IROptimizer {
+
+  void run(IRModule &m) {
+    for (auto &f : m.functions)
+      run(f);
+  }
+
+  void run(IRFunction &f) {
+    removeUnreachableBlocks(f);
+    propagateCopies(f);
+    eliminateCommonSubexpressions(f);
+    propagateCopies(f);
+    eliminateDeadCode(f);
+  }
+
+private:
+  /* ================= UNREACHABLE BLOCKS ================= */
+
+  static void removeUnreachableBlocks(IRFunction &f) {
+    vector<bool> reachable(f.blocks.size(), false);
+    for (BlockId b : f.reversePostOrder())
+      reachable[b] = true;
+
+    for (BlockId b = 0; b < f.blocks.size(); b++) {
+      IRBlock &blk = f.blocks[b];
+
+      if (!reachable[b]) {
+        blk.phis.clear();
+        blk.instrs.clear();
+        blk.preds.clear();
+        continue;
+      }
+
+      erase_if(blk.preds, [&](BlockId p) { return !reachable[p]; });
+
+      for (ValueId phi : blk.phis) {
+        IRInstr &i = f.instrs[phi];
+        if (i.op != IROp::Phi)
+          continue;
+
+        uint32_t kept = 0;
+        for (uint32_t k = 0; k < i.b; k++) {
+          IRPhiOperand op = f.phiOperands[i.a + k];
+          if (reachable[op.block])
+            f.phiOperands[i.a + kept++] = op;
+        }
+        i.b = kept;
+      }
+    }
+  }
+
+  /* ================= COPY PROPAGATION ================= */
+
+  static ValueId resolve(const IRFunction &f, ValueId v) {
+    while (v != NoValue && f.instrs[v].op == IROp::Assign)
+      v = f.instrs[v].a;
+    return v;
+  }
+
+  static void propagateCopies(IRFunction &f) {
+    bool changed = true;
+
+    while (changed) {
+      changed = false;
+
+      for (auto &blk : f.blocks) {
+        for (ValueId phi : blk.phis)
+          f.forEachOperand(phi, [&](ValueId &op) { op = resolve(f, op); });
+        for (ValueId v : blk.instrs)
+          f.forEachOperand(v, [&](ValueId &op) { op = resolve(f, op); });
+
+        for (ValueId phi : blk.phis) {
+          IRInstr &i = f.instrs[phi];
+          if (i.op != IROp::Phi)
+            continue;
+
+          ValueId same = NoValue;
+          bool trivial = true;
+          for (uint32_t k = 0; k < i.b && trivial; k++) {
+            ValueId op = f.phiOperands[i.a + k].value;
+            if (op == same || op == phi)
+              continue;
+            if (same != NoValue)
+              trivial = false;
+            same = op;
+          }
+
+          if (trivial && same != NoValue) {
+            i.op = IROp::Assign;
+            i.a = same;
+            i.b = NoValue;
+            changed = true;
+          }
+        }
+      }
+    }
+
+    // every use now names the source directly
+    for (auto &blk : f.blocks) {
+      erase_if(blk.phis,
+               [&](ValueId v) { return f.instrs[v].op == IROp::Assign; });
+      erase_if(blk.instrs,
+               [&](ValueId v) { return f.instrs[v].op == IROp::Assign; });
+    }
+  }
+
+  /* ================= DOMINATORS ================= */
+
+  static vector<BlockId> dominators(const IRFunction &f,
+                                    const vector<BlockId> &rpo) {
+    vector<uint32_t> order(f.blocks.size(), NoValue);
+    for (uint32_t k = 0; k < rpo.size(); k++)
+      order[rpo[k]] = k;
+
+    vector<BlockId> idom(f.blocks.size(), NoValue);
+    idom[0] = 0;
+
+    auto intersect = [&](BlockId a, BlockId b) {
+      while (a != b) {
+        while (order[a] > order[b])
+          a = idom[a];
+        while (order[b] > order[a])
+          b = idom[b];
+      }
+      return a;
+    };
+
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t k = 1; k < rpo.size(); k++) {
+        BlockId b = rpo[k];
+        BlockId newIdom = NoValue;
+
+        for (BlockId p : f.blocks[b].preds) {
+          if (idom[p] == NoValue)
+            continue;
+          newIdom = newIdom == NoValue ? p : intersect(p, newIdom);
+        }
+
+        if (idom[b] != newIdom) {
+          idom[b] = newIdom;
+          changed = true;
+        }
+      }
+    }
+
+    return idom;
+  }
+
+  /* ================= VALUE NUMBERING ================= */
+
+  static bool isPure(IROp op) {
+    switch (op) {
+    case IROp::Add:
+    case IROp::Sub:
+    case IROp::Mul:
+    case IROp::Div:
+    case IROp::Mod:
+    case IROp::Neg:
+    case IROp::Not:
+    case IROp::And:
+    case IROp::Or:
+    case IROp::Lt:
+    case IROp::Le:
+    case IROp::Gt:
+    case IROp::Ge:
+    case IROp::Eq:
+    case IROp::Ne:
+    case IROp::IToF:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  static bool isCommutative(IROp op) {
+    return op == IROp::Add || op == IROp::Mul || op == IROp::And ||
+           op == IROp::Or || op == IROp::Eq || op == IROp::Ne;
+  }
+
+  struct ExprKey {
+    IROp op;
+    IRType type;
+    ValueId a, b;
+
+    bool operator==(const ExprKey &o) const {
+      return op == o.op && type == o.type && a == o.a && b == o.b;
+    }
+  };
+
+  struct ExprKeyHash {
+    size_t operator()(const ExprKey &k) const {
+      uint64_t h = ((uint64_t)k.a << 32) ^ k.b;
+      h ^= ((uint64_t)k.op << 8 | (uint64_t)k.type) * 0x9e3779b97f4a7c15ull;
+      return (size_t)h;
+    }
+  };
+
+  static void eliminateCommonSubexpressions(IRFunction &f) {
+    auto rpo = f.reversePostOrder();
+    auto idom = dominators(f, rpo);
+
+    vector<vector<BlockId>> children(f.blocks.size());
+    for (BlockId b : rpo)
+      if (b != 0)
+        children[idom[b]].push_back(b);
+
+    unordered_map<ExprKey, ValueId, ExprKeyHash> available;
+
+    // Each block's entries are removed once its dominator subtree
+    // has been visited.
+    vector<pair<BlockId, size_t>> stack{{0, 0}};
+    vector<vector<ExprKey>> added(f.blocks.size());
+
+    auto enter = [&](BlockId b) {
+      for (ValueId v : f.blocks[b].instrs) {
+        IRInstr &i = f.instrs[v];
+        if (!isPure(i.op))
+          continue;
+
+        f.forEachOperand(v, [&](ValueId &op) { op = resolve(f, op); });
+
+        ExprKey key{i.op, i.type, i.a, i.b};
+        if (isCommutative(i.op) && key.b < key.a)
+          swap(key.a, key.b);
+
+        auto it = available.find(key);
+        if (it != available.end()) {
+          i.op = IROp::Assign;
+          i.a = it->second;
+          i.b = NoValue;
+          continue;
+        }
+
+        available.emplace(key, v);
+        added[b].push_back(key);
+      }
+    };
+
+    enter(0);
+    while (!stack.empty()) {
+      auto &[b, next] = stack.back();
+      if (next < children[b].size()) {
+        BlockId c = children[b][next++];
+        enter(c);
+        stack.push_back({c, 0});
+        continue;
+      }
+      for (auto &key : added[b])
+        available.erase(key);
+      stack.pop_back();
+    }
+  }
+
+  /* ================= DEAD CODE ================= */
+
+  static void eliminateDeadCode(IRFunction &f) {
+    vector<bool> live(f.instrs.size(), false);
+    vector<ValueId> worklist;
+
+    for (auto &blk : f.blocks)
+      for (ValueId v : blk.instrs)
+        if (f.instrs[v].hasSideEffects()) {
+          live[v] = true;
+          worklist.push_back(v);
+        }
+
+    while (!worklist.empty()) {
+      ValueId v = worklist.back();
+      worklist.pop_back();
+
+      f.forEachOperand(v, [&](ValueId &op) {
+        if (op != NoValue && !live[op]) {
+          live[op] = true;
+          worklist.push_back(op);
+        }
+      });
+    }
+
+    for (auto &blk : f.blocks) {
+      erase_if(blk.phis, [&](ValueId v) { return !live[v]; });
+      erase_if(blk.instrs, [&](ValueId v) { return !live[v]; });
+    }
+  }
+};
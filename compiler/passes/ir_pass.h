@@ -0,0 +1,616 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../ast/flat_ast.h"
+#include "../common/error.h"
+#include "../ir/ir.h"
+
+using namespace std;
+
+/*
+    Builds the mid-level IR from the ANF form of a program, read from
+    its flat AST: one pass over index-linked nodes, dispatching on the
+    tag, with names interned to ids.
+
+    Variables never reach the IR: SSA values are built directly,
+    following Braun et al., "Simple and Efficient Construction of
+    Static Single Assignment Form". A block is sealed once all of
+    its predecessors are known; reads in unsealed blocks create
+    placeholder phis that are completed on sealing.
+
+    ANF turns && and || into control flow unless the right operand is
+    an atom (ANFPass::shortCircuit). Evaluating an atom has no effect,
+    so what is left becomes plain and/or here; any other operand is
+    rejected rather than evaluated eagerly. Arrays are not supported
+    on this path.
+*/
+struct IRPass {
+
+  IRModule build(const FlatAST &flat) {
+    IRModule m;
+    ast = &flat;
+
+    // Signatures first, so calls can refer to functions defined later.
+    for (uint32_t n : flat.roots) {
+      if (flat.tags[n] != NodeTag::Function)
+        continue;
+
+      IRFunction f;
+      f.name = flat.text(n);
+      f.returnType = irType(flat.type(n));
+      const uint32_t *params = &flat.extra[flat.rhs[n]];
+      for (uint32_t i = 0; i < params[0]; i++)
+        f.params.push_back(irType(flat.typeTable[params[2 + 2 * i]]));
+
+      m.functionIndex[f.name] = (uint32_t)m.functions.size();
+      m.functions.push_back(std::move(f));
+    }
+
+    module = &m;
+
+    for (uint32_t n : flat.roots)
+      if (flat.tags[n] == NodeTag::Function)
+        lowerFunction(n, m.functions[m.functionIndex[flat.text(n)]]);
+
+    module = nullptr;
+    ast = nullptr;
+    return m;
+  }
+
+  static IRType irType(const LangType &t) {
+    switch (t.kind) {
+    case LangTypeKind::Integer:
+    case LangTypeKind::Char:
+      return IRType::I32;
+    case LangTypeKind::Floating:
+      return IRType::F64;
+    case LangTypeKind::Bool:
+      return IRType::I1;
+    case LangTypeKind::String:
+      return IRType::Str;
+    case LangTypeKind::Void:
+      return IRType::Void;
+    default:
+      throw runtime_error("IR: unsupported type");
+    }
+  }
+
+private:
+  const FlatAST *ast = nullptr;
+  IRModule *module = nullptr;
+  IRFunction *fn = nullptr;
+  BlockId cur = 0;
+
+  // ----- variables -----
+  vector<IRType> varTypes;
+  vector<unordered_map<uint32_t, uint32_t>> scopes; // name id -> variable
+
+  // ----- SSA construction state -----
+  unordered_map<uint64_t, ValueId> currentDef;
+  vector<vector<pair<uint32_t, ValueId>>> incompletePhis;
+  vector<bool> sealed;
+
+  // ----- interned constants -----
+  unordered_map<uint64_t, ValueId> intConsts[2];
+  unordered_map<uint64_t, ValueId> floatConsts;
+
+  /* ================= FUNCTION ================= */
+
+  void lowerFunction(uint32_t node, IRFunction &f) {
+    fn = &f;
+    varTypes.clear();
+    scopes.assign(1, {});
+    currentDef.clear();
+    incompletePhis.clear();
+    sealed.clear();
+    intConsts[0].clear();
+    intConsts[1].clear();
+    floatConsts.clear();
+
+    cur = newBlock();
+    seal(cur);
+
+    const uint32_t *params = &ast->extra[ast->rhs[node]];
+    for (uint32_t i = 0; i < f.params.size(); i++) {
+      uint32_t var = declare(params[1 + 2 * i], f.params[i]);
+      IRInstr p(IROp::Param, f.params[i]);
+      p.a = i;
+      writeVariable(var, cur, emit(p));
+    }
+
+    lowerStmt(ast->lhs[node]);
+
+    if (!isTerminated(cur)) {
+      IRInstr r(IROp::Return, IRType::Void);
+      if (f.returnType != IRType::Void)
+        r.a = zero(f.returnType);
+      emit(r);
+    }
+
+    fn = nullptr;
+  }
+
+  /* ================= STATEMENTS ================= */
+
+  void lowerStmt(uint32_t n) {
+    const FlatAST &a = *ast;
+
+    switch (a.tags[n]) {
+    case NodeTag::Block:
+      scopes.emplace_back();
+      for (uint32_t k = 0; k < a.rhs[n]; k++)
+        lowerStmt(a.extra[a.lhs[n] + k]);
+      scopes.pop_back();
+      return;
+
+    case NodeTag::VarDecl:
+    case NodeTag::TempDecl: {
+      IRType t = irType(a.type(n));
+      ValueId init = a.lhs[n] != FlatAST::None
+                         ? coerce(lowerExpr(a.lhs[n]), t)
+                         : zero(t);
+      writeVariable(declare(a.main[n], t), cur, init);
+      return;
+    }
+
+    case NodeTag::ExprStmt:
+      lowerExpr(a.lhs[n]);
+      return;
+
+    case NodeTag::Print: {
+      IRInstr p(IROp::Print, IRType::Void);
+      p.a = lowerExpr(a.lhs[n]);
+      emit(p);
+      return;
+    }
+
+    case NodeTag::Return: {
+      IRInstr r(IROp::Return, IRType::Void);
+      if (a.lhs[n] != FlatAST::None)
+        r.a = coerce(lowerExpr(a.lhs[n]), fn->returnType);
+      else if (fn->returnType != IRType::Void)
+        r.a = zero(fn->returnType);
+      emit(r);
+      return;
+    }
+
+    case NodeTag::If: {
+      uint32_t thenS = a.extra[a.rhs[n]];
+      uint32_t elseS = a.extra[a.rhs[n] + 1];
+      bool hasElse = elseS != FlatAST::None;
+
+      ValueId cond = truth(lowerExpr(a.lhs[n]));
+
+      BlockId thenB = newBlock();
+      BlockId elseB = hasElse ? newBlock() : NoValue;
+      BlockId mergeB = newBlock();
+
+      branch(cond, thenB, hasElse ? elseB : mergeB);
+
+      seal(thenB);
+      cur = thenB;
+      lowerStmt(thenS);
+      jumpIfOpen(mergeB);
+
+      if (hasElse) {
+        seal(elseB);
+        cur = elseB;
+        lowerStmt(elseS);
+        jumpIfOpen(mergeB);
+      }
+
+      seal(mergeB);
+      cur = mergeB;
+      return;
+    }
+
+    case NodeTag::While:
+      lowerLoop(FlatAST::None, a.lhs[n], FlatAST::None, a.rhs[n]);
+      return;
+
+    case NodeTag::For: {
+      // the IR has no parallel/simd loops; see DesugarForPass
+      auto hint = LoopHint(a.main[n] & 0xff);
+      if (hint != LoopHint::None)
+        throw CompileError(string(hint == LoopHint::Parallel ? "'parallel for'"
+                                                             : "'simd for'") +
+                               " is only supported by the default backend",
+                           a.locs[n].line, a.locs[n].col);
+      const uint32_t *parts = &a.extra[a.lhs[n]];
+      scopes.emplace_back();
+      lowerLoop(parts[0], parts[1], parts[2], parts[3]);
+      scopes.pop_back();
+      return;
+    }
+
+    default:
+      throw runtime_error("IR: unsupported statement");
+    }
+  }
+
+  // init, condition and increment may be None
+  void lowerLoop(uint32_t init, uint32_t condition, uint32_t increment,
+                 uint32_t body) {
+    if (init != FlatAST::None)
+      lowerStmt(init);
+
+    BlockId header = newBlock();
+    BlockId bodyB = newBlock();
+    BlockId exitB = newBlock();
+
+    jump(header);
+
+    // the back edge is not known yet: header stays unsealed
+    cur = header;
+    ValueId cond = condition != FlatAST::None ? truth(lowerExpr(condition))
+                                              : constant(IRType::I1, 1);
+    branch(cond, bodyB, exitB);
+
+    seal(bodyB);
+    cur = bodyB;
+    lowerStmt(body);
+    if (!isTerminated(cur) && increment != FlatAST::None)
+      lowerExpr(increment);
+    jumpIfOpen(header);
+
+    seal(header);
+    seal(exitB);
+    cur = exitB;
+  }
+
+  /* ================= EXPRESSIONS ================= */
+
+  bool isAtom(uint32_t n) const {
+    switch (ast->tags[n]) {
+    case NodeTag::Int:
+    case NodeTag::Float:
+    case NodeTag::Bool:
+    case NodeTag::String:
+    case NodeTag::Var:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  ValueId lowerExpr(uint32_t n) {
+    const FlatAST &a = *ast;
+
+    switch (a.tags[n]) {
+    case NodeTag::Int:
+      return constant(IRType::I32, (int32_t)a.intValue(n));
+
+    case NodeTag::Float:
+      return constantF(a.floatValue(n));
+
+    case NodeTag::Bool:
+      return constant(IRType::I1, a.lhs[n]);
+
+    case NodeTag::String: {
+      IRInstr c(IROp::Const, IRType::Str);
+      c.a = module->internString(a.text(n));
+      return fn->add(c);
+    }
+
+    case NodeTag::Var:
+      return readVariable(lookup(a.main[n]), cur);
+
+    case NodeTag::Unary: {
+      const string &op = a.text(n);
+      ValueId v = lowerExpr(a.lhs[n]);
+
+      if (op == "!")
+        return unary(IROp::Not, IRType::I1, truth(v));
+      if (op == "-")
+        return unary(IROp::Neg, typeOf(v), v);
+
+      throw runtime_error("IR: unsupported unary operator '" + op + "'");
+    }
+
+    case NodeTag::Binary:
+      return lowerBinary(n);
+
+    case NodeTag::Call: {
+      auto it = module->functionIndex.find(a.text(n));
+      if (it == module->functionIndex.end())
+        throw runtime_error("IR: call to unknown function '" + a.text(n) +
+                            "'");
+
+      const IRFunction &callee = module->functions[it->second];
+
+      vector<ValueId> args;
+      for (uint32_t k = 0; k < a.rhs[n]; k++)
+        args.push_back(
+            coerce(lowerExpr(a.extra[a.lhs[n] + k]), callee.params[k]));
+
+      IRInstr c(IROp::Call, callee.returnType);
+      c.a = it->second;
+      c.b = (uint32_t)fn->operands.size();
+      c.c = (uint32_t)args.size();
+      fn->operands.insert(fn->operands.end(), args.begin(), args.end());
+      return emit(c);
+    }
+
+    case NodeTag::Index:
+      throw runtime_error("IR: arrays are not supported");
+
+    default:
+      throw runtime_error("IR: unsupported expression");
+    }
+  }
+
+  ValueId lowerBinary(uint32_t n) {
+    const FlatAST &a = *ast;
+    const string &op = a.text(n);
+
+    if (op == "=") {
+      uint32_t target = a.lhs[n];
+      if (a.tags[target] != NodeTag::Var)
+        throw runtime_error("IR: arrays are not supported");
+
+      ValueId v = lowerExpr(a.rhs[n]);
+      uint32_t var = lookup(a.main[target]);
+      v = coerce(v, varTypes[var]);
+      writeVariable(var, cur, v);
+      return v;
+    }
+
+    if ((op == "&&" || op == "||") && !isAtom(a.rhs[n]))
+      throw runtime_error("IR: '" + op +
+                          "' with a non-atomic right operand (not in ANF)");
+
+    ValueId l = lowerExpr(a.lhs[n]);
+    ValueId r = lowerExpr(a.rhs[n]);
+
+    if (op == "&&")
+      return binary(IROp::And, IRType::I1, truth(l), truth(r));
+    if (op == "||")
+      return binary(IROp::Or, IRType::I1, truth(l), truth(r));
+
+    // int op double  ->  double op double
+    IRType t = typeOf(l) == IRType::F64 || typeOf(r) == IRType::F64
+                   ? IRType::F64
+                   : typeOf(l);
+    l = coerce(l, t);
+    r = coerce(r, t);
+
+    static const unordered_map<string, IROp> arith = {
+        {"+", IROp::Add}, {"-", IROp::Sub}, {"*", IROp::Mul},
+        {"/", IROp::Div}, {"%", IROp::Mod}};
+    static const unordered_map<string, IROp> compare = {
+        {"<", IROp::Lt},  {"<=", IROp::Le}, {">", IROp::Gt},
+        {">=", IROp::Ge}, {"==", IROp::Eq}, {"!=", IROp::Ne}};
+
+    if (auto it = arith.find(op); it != arith.end())
+      return binary(it->second, t, l, r);
+    if (auto it = compare.find(op); it != compare.end())
+      return binary(it->second, IRType::I1, l, r);
+
+    throw runtime_error("IR: unsupported binary operator '" + op + "'");
+  }
+
+  /* ================= SSA CONSTRUCTION ================= */
+
+  static uint64_t defKey(uint32_t var, BlockId b) {
+    return ((uint64_t)var << 32) | b;
+  }
+
+  void writeVariable(uint32_t var, BlockId b, ValueId v) {
+    currentDef[defKey(var, b)] = v;
+  }
+
+  ValueId readVariable(uint32_t var, BlockId b) {
+    auto it = currentDef.find(defKey(var, b));
+    if (it != currentDef.end())
+      return it->second;
+    return readVariableRecursive(var, b);
+  }
+
+  ValueId readVariableRecursive(uint32_t var, BlockId b) {
+    ValueId v;
+    auto &preds = fn->blocks[b].preds;
+
+    if (!sealed[b]) {
+      v = newPhi(b, varTypes[var]);
+      incompletePhis[b].push_back({var, v});
+    } else if (preds.size() == 1) {
+      v = readVariable(var, preds[0]);
+    } else if (preds.empty()) {
+      // entry or unreachable block: the variable was never assigned
+      v = zero(varTypes[var]);
+    } else {
+      v = newPhi(b, varTypes[var]);
+      writeVariable(var, b, v); // breaks cycles through loops
+      v = addPhiOperands(var, v);
+    }
+
+    writeVariable(var, b, v);
+    return v;
+  }
+
+  ValueId newPhi(BlockId b, IRType t) {
+    ValueId v = fn->add(IRInstr(IROp::Phi, t));
+    fn->instrs[v].a = 0;
+    fn->instrs[v].b = 0;
+    fn->instrs[v].c = b;
+    fn->blocks[b].phis.push_back(v);
+    return v;
+  }
+
+  ValueId addPhiOperands(uint32_t var, ValueId phi) {
+    // Reads may create further phis; collect first so this phi's
+    // operands end up contiguous.
+    BlockId b = fn->instrs[phi].c;
+    vector<IRPhiOperand> ops;
+    for (BlockId p : fn->blocks[b].preds)
+      ops.push_back({p, readVariable(var, p)});
+
+    fn->instrs[phi].a = (uint32_t)fn->phiOperands.size();
+    fn->instrs[phi].b = (uint32_t)ops.size();
+    fn->phiOperands.insert(fn->phiOperands.end(), ops.begin(), ops.end());
+
+    return tryRemoveTrivialPhi(phi);
+  }
+
+  // A phi whose operands are all the same value (or itself) is
+  // replaced by that value; copy propagation removes the Assign.
+  ValueId tryRemoveTrivialPhi(ValueId phi) {
+    ValueId same = NoValue;
+    IRInstr &i = fn->instrs[phi];
+
+    for (uint32_t k = 0; k < i.b; k++) {
+      ValueId op = fn->phiOperands[i.a + k].value;
+      if (op == same || op == phi)
+        continue;
+      if (same != NoValue)
+        return phi;
+      same = op;
+    }
+
+    if (same == NoValue)
+      same = zero(i.type);
+
+    IRInstr &p = fn->instrs[phi];
+    p.op = IROp::Assign;
+    p.a = same;
+    p.b = NoValue;
+    return same;
+  }
+
+  void seal(BlockId b) {
+    auto pending = std::move(incompletePhis[b]);
+    incompletePhis[b].clear();
+    for (auto &[var, phi] : pending)
+      addPhiOperands(var, phi);
+    sealed[b] = true;
+  }
+
+  /* ================= HELPERS ================= */
+
+  uint32_t declare(uint32_t name, IRType t) {
+    varTypes.push_back(t);
+    uint32_t var = (uint32_t)varTypes.size() - 1;
+    scopes.back()[name] = var;
+    return var;
+  }
+
+  uint32_t lookup(uint32_t name) {
+    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+      auto f = it->find(name);
+      if (f != it->end())
+        return f->second;
+    }
+    throw runtime_error("IR: unknown variable '" + ast->strings[name] + "'");
+  }
+
+  IRType typeOf(ValueId v) const { return fn->instrs[v].type; }
+
+  BlockId newBlock() {
+    sealed.push_back(false);
+    incompletePhis.emplace_back();
+    return fn->newBlock();
+  }
+
+  bool isTerminated(BlockId b) const {
+    ValueId t = fn->blocks[b].terminator();
+    return t != NoValue && fn->instrs[t].isTerminator();
+  }
+
+  // Code after a return lands in a fresh block with no predecessors.
+  ValueId emit(IRInstr i) {
+    if (isTerminated(cur)) {
+      cur = newBlock();
+      seal(cur);
+    }
+    ValueId v = fn->add(i);
+    fn->blocks[cur].instrs.push_back(v);
+    return v;
+  }
+
+  void jump(BlockId target) {
+    IRInstr j(IROp::Jump, IRType::Void);
+    j.a = target;
+    emit(j);
+    fn->blocks[target].preds.push_back(cur);
+  }
+
+  void jumpIfOpen(BlockId target) {
+    if (!isTerminated(cur))
+      jump(target);
+  }
+
+  void branch(ValueId cond, BlockId t, BlockId f) {
+    IRInstr br(IROp::Branch, IRType::Void);
+    br.a = cond;
+    br.b = t;
+    br.c = f;
+    emit(br);
+    fn->blocks[t].preds.push_back(cur);
+    fn->blocks[f].preds.push_back(cur);
+  }
+
+  ValueId unary(IROp op, IRType t, ValueId a) {
+    IRInstr i(op, t);
+    i.a = a;
+    return emit(i);
+  }
+
+  ValueId binary(IROp op, IRType t, ValueId a, ValueId b) {
+    IRInstr i(op, t);
+    i.a = a;
+    i.b = b;
+    return emit(i);
+  }
+
+  ValueId coerce(ValueId v, IRType t) {
+    if (typeOf(v) == IRType::I32 && t == IRType::F64)
+      return unary(IROp::IToF, IRType::F64, v);
+    return v;
+  }
+
+  ValueId truth(ValueId v) {
+    switch (typeOf(v)) {
+    case IRType::I1:
+      return v;
+    case IRType::F64:
+      return binary(IROp::Ne, IRType::I1, v, constantF(0.0));
+    default:
+      return binary(IROp::Ne, IRType::I1, v, constant(typeOf(v), 0));
+    }
+  }
+
+  ValueId constant(IRType t, int64_t value) {
+    auto &table = intConsts[t == IRType::I1 ? 0 : 1];
+    auto it = table.find((uint64_t)value);
+    if (it != table.end())
+      return it->second;
+
+    IRInstr c(IROp::Const, t);
+    c.imm = value;
+    return table[(uint64_t)value] = fn->add(c);
+  }
+
+  ValueId constantF(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    auto it = floatConsts.find(bits);
+    if (it != floatConsts.end())
+      return it->second;
+
+    IRInstr c(IROp::Const, IRType::F64);
+    c.fimm = value;
+    return floatConsts[bits] = fn->add(c);
+  }
+
+  ValueId zero(IRType t) {
+    if (t == IRType::F64)
+      return constantF(0.0);
+    return constant(t, 0);
+  }
+};
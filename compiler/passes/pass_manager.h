@@ -0,0 +1,121 @@
+#pragma once
+
+#include "../ast/expr.h"
+#include "../ast/features.h"
+#include "../ast/stmt.h"
+#include "../common/diagnostics.h"
+#include "const_fold.h"
+#include "desugar_bool.h"
+#include "desugar_for.h"
+#include "desugar_if_else.h"
+#include "desugar_inc_dec.h"
+#include "desugar_plus_assign.h"
+#include "rewrite_pass.h"
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+/*
+    Runs rewrite passes in the order they were added.
+
+    Adjacent passes share one tree walk unless one of them can
+    introduce a construct another one rewrites: the walker visits
+    each node once, so a rewrite that appears below the current
+    node would be missed. Those passes start a new walk.
+
+    Per function, a walk only runs the passes whose features the
+    parser recorded for that function (FunctionStmt::features);
+    a walk with no such pass is skipped.
+*/
+class PassManager {
+  vector<unique_ptr<RewritePass>> passes;
+  vector<vector<RewritePass *>> groups;
+
+public:
+  PassManager &add(unique_ptr<RewritePass> pass) {
+    RewritePass *p = pass.get();
+    passes.push_back(std::move(pass));
+
+    if (groups.empty() || interacts(groups.back(), p))
+      groups.emplace_back();
+    groups.back().push_back(p);
+
+    return *this;
+  }
+
+  // Number of tree walks a function containing every feature needs.
+  size_t walkCount() const { return groups.size(); }
+
+  // With an engine, a function a pass rejects is reported and marked
+  // like one with a syntax error, and the others are still rewritten.
+  void run(vector<unique_ptr<Stmt>> &program, DiagnosticEngine *diag = nullptr) {
+    for (auto &s : program)
+      if (auto fn = dynamic_cast<FunctionStmt *>(s.get()))
+        run(fn, diag);
+  }
+
+  void run(FunctionStmt *fn, DiagnosticEngine *diag) {
+    if (!fn->hasSyntaxErrors && !recover(diag, [&] { run(fn); }))
+      fn->hasSyntaxErrors = true;
+  }
+
+  void run(FunctionStmt *fn) {
+    FeatureSet present = fn->features;
+
+    for (auto &group : groups) {
+      vector<RewritePass *> active;
+      for (auto *p : group)
+        if (p->appliesTo(present))
+          active.push_back(p);
+
+      if (active.empty())
+        continue;
+
+      fn->body = RewriteWalker(active).walkBlock(std::move(fn->body));
+
+      for (auto *p : active)
+        present |= p->produces();
+    }
+  }
+
+  /* ===== PIPELINES ===== */
+
+  // Everything codegen cannot lower directly.
+  static PassManager lowering() {
+    PassManager pm;
+    pm.add(make_unique<DesugarIncDecPass>())
+        .add(make_unique<DesugarPlusAssignPass>())
+        .add(make_unique<ConstFoldPass>());
+    return pm;
+  }
+
+  // Folding that needs the types sema sets.
+  static PassManager typedFolding() {
+    PassManager pm;
+    pm.add(make_unique<ConstFoldPass>(true));
+    return pm;
+  }
+
+  // Reduces the tree to the core ANF/CPS understand.
+  static PassManager cpsLowering() {
+    PassManager pm;
+    pm.add(make_unique<DesugarIncDecPass>())
+        .add(make_unique<DesugarPlusAssignPass>())
+        .add(make_unique<ConstFoldPass>())
+        .add(make_unique<DesugarForPass>())
+        .add(make_unique<DesugarBoolPass>());
+    return pm;
+  }
+
+private:
+  static bool interacts(const vector<RewritePass *> &group, RewritePass *p) {
+    FeatureSet groupMatches, groupProduces;
+    for (auto *g : group) {
+      groupMatches |= g->matches();
+      groupProduces |= g->produces();
+    }
+    return p->matches().intersects(groupProduces) ||
+           p->produces().intersects(groupMatches);
+  }
+};
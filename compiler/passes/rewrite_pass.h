@@ -0,0 +1,143 @@
+#pragma once
+
+#include "../ast/expr.h"
+#include "../ast/features.h"
+#include "../ast/stmt.h"
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+/*
+    A rewrite pass only says what to do at a single node.
+    The walk itself is shared: RewriteWalker visits children
+    first, then gives every pass in its list a chance to
+    replace the node. Several passes therefore cost one walk.
+*/
+struct RewritePass {
+  virtual ~RewritePass() = default;
+
+  virtual const char *name() const = 0;
+
+  // Constructs this pass rewrites. Nothing to do if none are present.
+  virtual FeatureSet matches() const = 0;
+
+  // Constructs this pass may introduce into the tree.
+  virtual FeatureSet produces() const { return {}; }
+
+  // A pass matching FeatureSet::all() runs on every tree.
+  bool appliesTo(FeatureSet present) const {
+    FeatureSet m = matches();
+    return m.bits == FeatureSet::all().bits || m.intersects(present);
+  }
+
+  virtual unique_ptr<Stmt> rewriteStmt(unique_ptr<Stmt> stmt) { return stmt; }
+  virtual unique_ptr<Expr> rewriteExpr(unique_ptr<Expr> expr) { return expr; }
+};
+
+struct RewriteWalker {
+
+  vector<RewritePass *> passes;
+
+  RewriteWalker(vector<RewritePass *> p) : passes(std::move(p)) {}
+
+  /* ===== STATEMENTS ===== */
+
+  unique_ptr<Stmt> walkStmt(unique_ptr<Stmt> stmt) {
+
+    if (auto b = dynamic_cast<BlockStmt *>(stmt.get())) {
+      for (auto &s : b->stmts)
+        s = walkStmt(std::move(s));
+    }
+
+    else if (auto e = dynamic_cast<ExprStmt *>(stmt.get()))
+      e->e = walkExpr(std::move(e->e));
+
+    else if (auto p = dynamic_cast<PrintStmt *>(stmt.get()))
+      p->e = walkExpr(std::move(p->e));
+
+    else if (auto v = dynamic_cast<VarDeclStmt *>(stmt.get())) {
+      if (v->length)
+        v->length = walkExpr(std::move(v->length));
+      if (v->initializer)
+        v->initializer = walkExpr(std::move(v->initializer));
+    }
+
+    else if (auto i = dynamic_cast<IfStmt *>(stmt.get())) {
+      i->condition = walkExpr(std::move(i->condition));
+      i->thenBranch = walkStmt(std::move(i->thenBranch));
+      if (i->elseBranch)
+        i->elseBranch = walkStmt(std::move(i->elseBranch));
+    }
+
+    else if (auto w = dynamic_cast<WhileStmt *>(stmt.get())) {
+      w->condition = walkExpr(std::move(w->condition));
+      w->body = walkStmt(std::move(w->body));
+    }
+
+    else if (auto f = dynamic_cast<ForStmt *>(stmt.get())) {
+      if (f->init)
+        f->init = walkStmt(std::move(f->init));
+      if (f->condition)
+        f->condition = walkExpr(std::move(f->condition));
+      if (f->increment)
+        f->increment = walkExpr(std::move(f->increment));
+      f->body = walkStmt(std::move(f->body));
+    }
+
+    else if (auto r = dynamic_cast<ReturnStmt *>(stmt.get())) {
+      if (r->value)
+        r->value = walkExpr(std::move(r->value));
+    }
+
+    else if (auto fn = dynamic_cast<FunctionStmt *>(stmt.get()))
+      fn->body = walkBlock(std::move(fn->body));
+
+    for (auto *p : passes)
+      stmt = p->rewriteStmt(std::move(stmt));
+
+    return stmt;
+  }
+
+  // Function bodies must stay blocks even if a pass replaces them.
+  unique_ptr<BlockStmt> walkBlock(unique_ptr<BlockStmt> block) {
+    auto r = walkStmt(std::move(block));
+
+    if (auto b = dynamic_cast<BlockStmt *>(r.get())) {
+      r.release();
+      return unique_ptr<BlockStmt>(b);
+    }
+
+    auto nb = make_unique<BlockStmt>();
+    nb->stmts.push_back(std::move(r));
+    return nb;
+  }
+
+  /* ===== EXPRESSIONS ===== */
+
+  unique_ptr<Expr> walkExpr(unique_ptr<Expr> expr) {
+
+    if (auto u = dynamic_cast<UnaryExpr *>(expr.get()))
+      u->right = walkExpr(std::move(u->right));
+
+    else if (auto b = dynamic_cast<BinaryExpr *>(expr.get())) {
+      b->left = walkExpr(std::move(b->left));
+      b->right = walkExpr(std::move(b->right));
+    }
+
+    else if (auto idx = dynamic_cast<IndexExpr *>(expr.get())) {
+      idx->array = walkExpr(std::move(idx->array));
+      idx->index = walkExpr(std::move(idx->index));
+    }
+
+    else if (auto c = dynamic_cast<CallExpr *>(expr.get())) {
+      for (auto &a : c->args)
+        a = walkExpr(std::move(a));
+    }
+
+    for (auto *p : passes)
+      expr = p->rewriteExpr(std::move(expr));
+
+    return expr;
+  }
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+/*
+===========================================
+NANO RUNTIME
+===========================================
+Entry points called by generated code.
+Output is formatted into a per-thread buffer
+and written to stdout in large chunks.
+Parallel loops run on a work-stealing
+thread pool started on first use.
+Heap arrays come from per-thread
+size-class free lists.
+*/
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void __nano_print_i32(int32_t v);
+void __nano_print_f64(double v);
+void __nano_print_bool(int32_t v);
+void __nano_print_str(const char *s);
+
+// Writes out the calling thread's pending output.
+void __nano_flush(void);
+
+// Outlined body of a `parallel for`: runs iterations [begin, end)
+// with the loop's captured variables in env.
+typedef void (*NanoLoopBody)(int32_t begin, int32_t end, void *env);
+
+// Runs body over [begin, end) on the thread pool and returns once
+// every iteration is done. Nested calls run serially.
+void __nano_parallel_for(int32_t begin, int32_t end, NanoLoopBody body,
+                         void *env);
+
+// Zero-filled storage for an int[n] array. Aborts when out of memory.
+void *__nano_alloc(int64_t bytes);
+
+// Returns an array from __nano_alloc; bytes is the size it was
+// allocated with.
+void __nano_free(void *p, int64_t bytes);
+
+#ifdef __cplusplus
+}
+#endif
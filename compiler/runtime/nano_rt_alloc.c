@@ -0,0 +1,88 @@
+#include "nano_rt.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ================= ARRAY POOL =================
+   Heap arrays are allocated and freed in scope order, so the sizes
+   that come back are the sizes asked for next. Every thread keeps a
+   free list per power-of-two size class; a block goes back to the
+   list it came from and is reused without touching malloc. New small
+   blocks are carved from 1 MiB slabs. Slabs are never returned.
+*/
+
+#define NANO_MIN_CLASS 4  // 16 B
+#define NANO_MAX_CLASS 18 // 256 KiB
+#define NANO_SLAB_BYTES (1 << 20)
+
+typedef struct NanoBlock {
+  struct NanoBlock *next;
+} NanoBlock;
+
+typedef struct {
+  NanoBlock *free[NANO_MAX_CLASS + 1];
+  char *slab, *slabEnd;
+} NanoPool;
+
+static _Thread_local NanoPool pool;
+
+static void outOfMemory(int64_t bytes) {
+  fprintf(stderr, "nano: out of memory allocating %lld bytes\n",
+          (long long)bytes);
+  abort();
+}
+
+static int sizeClass(int64_t bytes) {
+  int c = NANO_MIN_CLASS;
+  while (((int64_t)1 << c) < bytes)
+    c++;
+  return c;
+}
+
+void *__nano_alloc(int64_t bytes) {
+  if (bytes > ((int64_t)1 << NANO_MAX_CLASS)) {
+    void *p = calloc(1, (size_t)bytes);
+    if (!p)
+      outOfMemory(bytes);
+    return p;
+  }
+
+  int c = sizeClass(bytes);
+  size_t size = (size_t)1 << c;
+
+  NanoBlock *b = pool.free[c];
+  if (b) {
+    pool.free[c] = b->next;
+    memset(b, 0, size);
+    return b;
+  }
+
+  if (pool.slabEnd - pool.slab < (ptrdiff_t)size) {
+    // slab memory is fresh from calloc, so carved blocks start zeroed
+    pool.slab = calloc(1, NANO_SLAB_BYTES);
+    if (!pool.slab)
+      outOfMemory(bytes);
+    pool.slabEnd = pool.slab + NANO_SLAB_BYTES;
+  }
+
+  void *p = pool.slab;
+  pool.slab += size;
+  return p;
+}
+
+void __nano_free(void *p, int64_t bytes) {
+  if (!p)
+    return;
+
+  if (bytes > ((int64_t)1 << NANO_MAX_CLASS)) {
+    free(p);
+    return;
+  }
+
+  int c = sizeClass(bytes);
+  NanoBlock *b = p;
+  b->next = pool.free[c];
+  pool.free[c] = b;
+}
@@ -0,0 +1,206 @@
+#include "nano_rt.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* ================= SCHEDULER =================
+   Work stealing over iteration ranges. Every participant (the pool
+   workers and the calling thread) starts with an equal slice of the
+   loop and runs it front to back, one chunk at a time. A participant
+   whose slice runs dry steals the back half of another one's remaining
+   range. Each slice has its own lock; the owner takes it once per
+   chunk, so it is only contended while stealing.
+*/
+
+#define NANO_MAX_THREADS 256
+
+// chunks per participant: small enough to balance, large enough that
+// the per-chunk lock and flush are noise
+#define NANO_CHUNKS_PER_THREAD 8
+
+typedef struct {
+  _Alignas(64) pthread_mutex_t lock;
+  int64_t lo, hi; // remaining iterations [lo, hi)
+} NanoSlice;
+
+typedef struct {
+  NanoLoopBody body;
+  void *env;
+  int64_t grain;
+  int participants;
+  int active; // workers still inside the job (poolLock)
+} NanoJob;
+
+static NanoSlice slices[NANO_MAX_THREADS];
+static NanoJob job;
+
+static int poolSize; // workers, not counting the calling thread
+static unsigned long generation;
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+
+// set while a thread runs loop iterations: nested loops run serially
+static _Thread_local int inParallel;
+
+/* ================= CHUNKS ================= */
+
+static int takeChunk(NanoSlice *s, int64_t *b, int64_t *e) {
+  pthread_mutex_lock(&s->lock);
+
+  int ok = s->lo < s->hi;
+  if (ok) {
+    *b = s->lo;
+    *e = s->hi - s->lo > job.grain ? s->lo + job.grain : s->hi;
+    s->lo = *e;
+  }
+
+  pthread_mutex_unlock(&s->lock);
+  return ok;
+}
+
+// Moves part of another participant's range into `mine`.
+static int steal(int self, NanoSlice *mine) {
+  for (int k = 1; k < job.participants; k++) {
+    NanoSlice *victim = &slices[(self + k) % job.participants];
+
+    pthread_mutex_lock(&victim->lock);
+
+    int64_t left = victim->hi - victim->lo;
+    if (left <= 0) {
+      pthread_mutex_unlock(&victim->lock);
+      continue;
+    }
+
+    int64_t hi = victim->hi;
+    int64_t lo = left > job.grain ? victim->lo + left / 2 : victim->lo;
+    victim->hi = lo;
+
+    pthread_mutex_unlock(&victim->lock);
+
+    pthread_mutex_lock(&mine->lock);
+    mine->lo = lo;
+    mine->hi = hi;
+    pthread_mutex_unlock(&mine->lock);
+    return 1;
+  }
+
+  return 0;
+}
+
+static void participate(int self) {
+  NanoSlice *mine = &slices[self];
+  int64_t b, e;
+
+  do {
+    while (takeChunk(mine, &b, &e)) {
+      job.body((int32_t)b, (int32_t)e, job.env);
+      __nano_flush();
+    }
+  } while (steal(self, mine));
+}
+
+/* ================= POOL ================= */
+
+static void *workerMain(void *arg) {
+  int self = (int)(intptr_t)arg;
+  unsigned long seen = 0;
+
+  inParallel = 1;
+
+  pthread_mutex_lock(&poolLock);
+  for (;;) {
+    while (generation == seen)
+      pthread_cond_wait(&wake, &poolLock);
+    seen = generation;
+    pthread_mutex_unlock(&poolLock);
+
+    participate(self);
+
+    pthread_mutex_lock(&poolLock);
+    if (--job.active == 0)
+      pthread_cond_signal(&done);
+  }
+
+  return NULL;
+}
+
+// NANO_NUM_THREADS overrides the number of online processors.
+static void startPool(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  const char *env = getenv("NANO_NUM_THREADS");
+  if (env && atoi(env) > 0)
+    n = atoi(env);
+
+  if (n < 1)
+    n = 1;
+  if (n > NANO_MAX_THREADS)
+    n = NANO_MAX_THREADS;
+
+  for (int i = 0; i < NANO_MAX_THREADS; i++)
+    pthread_mutex_init(&slices[i].lock, NULL);
+
+  for (long i = 1; i < n; i++) {
+    pthread_t t;
+    if (pthread_create(&t, NULL, workerMain, (void *)(intptr_t)i) != 0)
+      break;
+    pthread_detach(t);
+    poolSize++;
+  }
+}
+
+/* ================= ENTRY POINT ================= */
+
+void __nano_parallel_for(int32_t begin, int32_t end, NanoLoopBody body,
+                         void *env) {
+  if (begin >= end)
+    return;
+
+  pthread_once(&poolOnce, startPool);
+
+  int64_t n = (int64_t)end - begin;
+  int participants = poolSize + 1;
+
+  if (inParallel || poolSize == 0 || n < participants) {
+    body(begin, end, env);
+    return;
+  }
+
+  inParallel = 1;
+
+  // output printed before the loop must come out first
+  __nano_flush();
+
+  pthread_mutex_lock(&poolLock);
+
+  job.body = body;
+  job.env = env;
+  job.participants = participants;
+  job.active = poolSize;
+  job.grain = n / ((int64_t)participants * NANO_CHUNKS_PER_THREAD);
+  if (job.grain < 1)
+    job.grain = 1;
+
+  for (int i = 0; i < participants; i++) {
+    slices[i].lo = begin + n * i / participants;
+    slices[i].hi = begin + n * (i + 1) / participants;
+  }
+
+  generation++;
+  pthread_cond_broadcast(&wake);
+  pthread_mutex_unlock(&poolLock);
+
+  participate(0);
+
+  pthread_mutex_lock(&poolLock);
+  while (job.active > 0)
+    pthread_cond_wait(&done, &poolLock);
+  pthread_mutex_unlock(&poolLock);
+
+  inParallel = 0;
+}
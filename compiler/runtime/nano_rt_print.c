@@ -0,0 +1,159 @@
+#include "nano_rt.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* ================= BUFFER ================= */
+
+#define NANO_OUT_CAPACITY (64 * 1024)
+
+// room for the longest single formatted value ("%f" of a huge double)
+#define NANO_OUT_SLACK 512
+
+typedef struct {
+  char data[NANO_OUT_CAPACITY];
+  size_t len;
+  int registered;
+} NanoOutBuffer;
+
+static _Thread_local NanoOutBuffer outBuf;
+
+static pthread_key_t flushKey;
+static pthread_once_t flushKeyOnce = PTHREAD_ONCE_INIT;
+
+static void writeAll(const char *p, size_t n) {
+  while (n > 0) {
+    ssize_t w = write(STDOUT_FILENO, p, n);
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    p += w;
+    n -= (size_t)w;
+  }
+}
+
+static void flushBuffer(NanoOutBuffer *b) {
+  if (b->len == 0)
+    return;
+  writeAll(b->data, b->len);
+  b->len = 0;
+}
+
+/* ================= REGISTRATION ================= */
+
+// Thread exit: pthread key destructors run for every thread but main.
+static void flushOnThreadExit(void *p) { flushBuffer((NanoOutBuffer *)p); }
+
+// Process exit: covers the main thread.
+static void flushOnExit(void) { __nano_flush(); }
+
+static void createFlushKey(void) {
+  pthread_key_create(&flushKey, flushOnThreadExit);
+  atexit(flushOnExit);
+}
+
+static NanoOutBuffer *reserve(size_t n) {
+  NanoOutBuffer *b = &outBuf;
+
+  if (!b->registered) {
+    pthread_once(&flushKeyOnce, createFlushKey);
+    pthread_setspecific(flushKey, b);
+    b->registered = 1;
+  }
+
+  if (b->len + n > NANO_OUT_CAPACITY)
+    flushBuffer(b);
+
+  return b;
+}
+
+/* ================= INTEGER FORMATTING ================= */
+
+static const char digitPairs[201] = "00010203040506070809"
+                                    "10111213141516171819"
+                                    "20212223242526272829"
+                                    "30313233343536373839"
+                                    "40414243444546474849"
+                                    "50515253545556575859"
+                                    "60616263646566676869"
+                                    "70717273747576777879"
+                                    "80818283848586878889"
+                                    "90919293949596979899";
+
+// Writes v in decimal ending right before `end`; returns the first char.
+static char *formatU32(uint32_t v, char *end) {
+  char *p = end;
+
+  while (v >= 100) {
+    uint32_t r = (v % 100) * 2;
+    v /= 100;
+    *--p = digitPairs[r + 1];
+    *--p = digitPairs[r];
+  }
+
+  if (v >= 10) {
+    *--p = digitPairs[v * 2 + 1];
+    *--p = digitPairs[v * 2];
+  } else {
+    *--p = (char)('0' + v);
+  }
+
+  return p;
+}
+
+/* ================= ENTRY POINTS ================= */
+
+void __nano_print_i32(int32_t v) {
+  char tmp[12];
+  char *end = tmp + sizeof(tmp);
+
+  uint32_t mag = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+  char *p = formatU32(mag, end);
+  if (v < 0)
+    *--p = '-';
+
+  size_t n = (size_t)(end - p);
+  NanoOutBuffer *b = reserve(n + 1);
+  memcpy(b->data + b->len, p, n);
+  b->data[b->len + n] = '\n';
+  b->len += n + 1;
+}
+
+void __nano_print_f64(double v) {
+  NanoOutBuffer *b = reserve(NANO_OUT_SLACK);
+  int n = snprintf(b->data + b->len, NANO_OUT_SLACK, "%f\n", v);
+  if (n > 0)
+    b->len += (size_t)n < NANO_OUT_SLACK ? (size_t)n : NANO_OUT_SLACK - 1;
+}
+
+void __nano_print_bool(int32_t v) {
+  NanoOutBuffer *b = reserve(2);
+  b->data[b->len++] = v ? '1' : '0';
+  b->data[b->len++] = '\n';
+}
+
+void __nano_print_str(const char *s) {
+  size_t n = strlen(s);
+
+  // strings that would not fit go straight through
+  if (n + 1 > NANO_OUT_CAPACITY) {
+    NanoOutBuffer *b = reserve(NANO_OUT_CAPACITY);
+    flushBuffer(b);
+    writeAll(s, n);
+    writeAll("\n", 1);
+    return;
+  }
+
+  NanoOutBuffer *b = reserve(n + 1);
+  memcpy(b->data + b->len, s, n);
+  b->data[b->len + n] = '\n';
+  b->len += n + 1;
+}
+
+void __nano_flush(void) { flushBuffer(&outBuf); }
@@ -5,6 +5,7 @@
 
 #include "../ast/expr.h"
 #include "../ast/stmt.h"
+#include "../common/diagnostics.h"
 #include "../common/error.h"
 #include "symbol_table.h"
 
@@ -13,10 +14,28 @@ using namespace std;
 class ResolveScopesPass {
   SymbolTable table;
 
+  // errors are reported here and resolution goes on with the next
+  // statement of the block
+  DiagnosticEngine *diag;
+
 public:
+  explicit ResolveScopesPass(DiagnosticEngine *diag = nullptr) : diag(diag) {}
+
+  // Top-level signatures are declared first, so a function may call
+  // one defined after it.
   void resolve(const vector<unique_ptr<Stmt>> &program) {
     for (auto &s : program)
-      resolveStmt(s.get());
+      if (auto fn = dynamic_cast<FunctionStmt *>(s.get()))
+        recover(diag, [&] { declareFunction(fn); });
+
+    for (auto &s : program) {
+      if (auto fn = dynamic_cast<FunctionStmt *>(s.get())) {
+        if (!fn->hasSyntaxErrors)
+          recover(diag, [&] { resolveBody(fn); });
+      } else {
+        recover(diag, [&] { resolveStmt(s.get()); });
+      }
+    }
   }
 
 private:
@@ -28,7 +47,7 @@ private:
     if (auto s = dynamic_cast<BlockStmt *>(stmt)) {
       table.enterScope();
       for (auto &st : s->stmts)
-        resolveStmt(st.get());
+        recover(diag, [&] { resolveStmt(st.get()); });
       table.exitScope();
       return;
     }
@@ -41,10 +60,14 @@ private:
                            s->loc.line, s->loc.col);
       }
 
+      if (s->length)
+        resolveExpr(s->length.get());
+
       table.declare(s->name, SymbolKind::Variable);
 
       auto sym = table.lookup(s->name);
       sym->type = s->type;
+      s->symbol = sym;
 
       if (s->initializer)
         resolveExpr(s->initializer.get());
@@ -54,31 +77,8 @@ private:
 
     // ---------------- FUNCTION ----------------
     if (auto s = dynamic_cast<FunctionStmt *>(stmt)) {
-
-      if (table.isDeclaredInCurrentScope(s->name)) {
-        throw CompileError("Redeclaration of function '" + s->name + "'",
-                           s->loc.line, s->loc.col);
-      }
-
-      table.declare(s->name, SymbolKind::Function);
-
-      auto fnSymbol = table.lookup(s->name);
-      fnSymbol->type = s->returnType;
-      fnSymbol->paramTypes.clear();
-
-      for (auto &p : s->params)
-        fnSymbol->paramTypes.push_back(p.second);
-
-      table.enterScope();
-
-      for (auto &p : s->params) {
-        table.declare(p.first, SymbolKind::Variable);
-        auto sym = table.lookup(p.first);
-        sym->type = p.second;
-      }
-
-      resolveStmt(s->body.get());
-      table.exitScope();
+      declareFunction(s);
+      resolveBody(s);
       return;
     }
 
@@ -102,14 +102,17 @@ private:
     if (auto s = dynamic_cast<ForStmt *>(stmt)) {
       table.enterScope();
 
-      if (s->init)
-        resolveStmt(s->init.get());
-      if (s->condition)
-        resolveExpr(s->condition.get());
-      if (s->increment)
-        resolveExpr(s->increment.get());
-
-      resolveStmt(s->body.get());
+      // the scope is closed even if the header fails to resolve
+      recover(diag, [&] {
+        if (s->init)
+          resolveStmt(s->init.get());
+        if (s->condition)
+          resolveExpr(s->condition.get());
+        if (s->increment)
+          resolveExpr(s->increment.get());
+
+        resolveStmt(s->body.get());
+      });
       table.exitScope();
       return;
     }
@@ -134,6 +137,43 @@ private:
     }
   }
 
+  // ---------------- Functions ----------------
+
+  void declareFunction(FunctionStmt *s) {
+
+    if (table.isDeclaredInCurrentScope(s->name)) {
+      throw CompileError("Redeclaration of function '" + s->name + "'",
+                         s->loc.line, s->loc.col);
+    }
+
+    table.declare(s->name, SymbolKind::Function);
+
+    auto fnSymbol = table.lookup(s->name);
+    fnSymbol->paramTypes.clear();
+
+    for (auto &p : s->params)
+      fnSymbol->paramTypes.push_back(p.second);
+
+    // calls read the return type from here
+    fnSymbol->type = LangType::Function(fnSymbol->paramTypes, s->returnType);
+  }
+
+  void resolveBody(FunctionStmt *s) {
+
+    table.enterScope();
+
+    s->paramSymbols.clear();
+    for (auto &p : s->params) {
+      table.declare(p.first, SymbolKind::Variable);
+      auto sym = table.lookup(p.first);
+      sym->type = p.second;
+      s->paramSymbols.push_back(sym);
+    }
+
+    resolveStmt(s->body.get());
+    table.exitScope();
+  }
+
   // ---------------- Expressions ----------------
 
   void resolveExpr(Expr *expr) {
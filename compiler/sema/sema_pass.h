@@ -0,0 +1,240 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "../ast/expr.h"
+#include "../ast/stmt.h"
+#include "../common/diagnostics.h"
+#include "../common/error.h"
+#include "../common/large_stack.h"
+#include "symbol_table.h"
+#include "type_check.h"
+
+using namespace std;
+
+/*
+    ResolveScopesPass and TypeCheckPass fused into one walk.
+
+    Each node is bound to its symbols on the way down and then handed
+    to the TypeCheckPass rule for it, whose recursion into children
+    comes back here. The AST is traversed once instead of twice, and a
+    node is typed while it is still in cache from being resolved.
+
+    Scopes and error messages are those of ResolveScopesPass. The two
+    separate passes stay available (--split-sema) for debugging.
+
+    check() runs in two phases. Top-level function signatures are
+    declared first, so a function may call one defined after it. The
+    bodies then only read the global scope, and they are checked on
+    worker threads. Each body gets its own SemaPass whose table sees
+    the globals through SymbolTable::outer, and its own
+    DiagnosticEngine. The bodies' errors are merged in source order,
+    whatever the thread timing.
+*/
+class SemaPass : public TypeCheckPass {
+  SymbolTable table;
+
+  // one per checked body; their tables own the bodies' symbols
+  vector<unique_ptr<SemaPass>> bodies;
+
+public:
+  explicit SemaPass(DiagnosticEngine *diag = nullptr) { this->diag = diag; }
+
+  SemaPass(const SymbolTable *globals, DiagnosticEngine *diag)
+      : table(globals) {
+    this->diag = diag;
+  }
+
+  /* ================= PROGRAM ================= */
+
+  // A function whose signature fails to declare, or whose body the
+  // parser had to recover in, is not checked.
+  void check(const vector<unique_ptr<Stmt>> &program) {
+
+    vector<FunctionStmt *> functions;
+
+    for (auto &s : program) {
+      if (auto fn = dynamic_cast<FunctionStmt *>(s.get())) {
+        if (recover(diag, [&] { declareFunction(fn); }) &&
+            !fn->hasSyntaxErrors)
+          functions.push_back(fn);
+      } else {
+        recover(diag, [&] { checkStmt(s.get()); });
+      }
+    }
+
+    checkBodies(functions);
+    recover(diag, [&] { checkMain(program); });
+  }
+
+  /* ================= STATEMENTS ================= */
+
+  void checkStmt(Stmt *stmt) override {
+
+    // ---------------- BLOCK ----------------
+    if (dynamic_cast<BlockStmt *>(stmt)) {
+      scoped([&] { TypeCheckPass::checkStmt(stmt); });
+      return;
+    }
+
+    // ---------------- VARIABLE DECLARATION ----------------
+    // the length is resolved before the name is declared, the
+    // initializer after
+    if (auto s = dynamic_cast<VarDeclStmt *>(stmt)) {
+
+      if (table.isDeclaredInCurrentScope(s->name))
+        throw CompileError("Redeclaration of variable '" + s->name + "'",
+                           s->loc.line, s->loc.col);
+
+      if (s->length &&
+          checkExpr(s->length.get()).kind != LangTypeKind::Integer)
+        throw CompileError("Array length must be integer", s->loc.line,
+                           s->loc.col);
+
+      table.declare(s->name, SymbolKind::Variable);
+      s->symbol = table.lookup(s->name);
+      s->symbol->type = s->type;
+
+      if (s->initializer &&
+          !isAssignable(s->type, checkExpr(s->initializer.get())))
+        throw CompileError("Type mismatch in variable declaration",
+                           s->loc.line, s->loc.col);
+      return;
+    }
+
+    // ---------------- FUNCTION ----------------
+    if (auto s = dynamic_cast<FunctionStmt *>(stmt)) {
+      declareFunction(s);
+      checkBody(s);
+      return;
+    }
+
+    // ---------------- FOR ----------------
+    if (dynamic_cast<ForStmt *>(stmt)) {
+      scoped([&] { TypeCheckPass::checkStmt(stmt); });
+      return;
+    }
+
+    TypeCheckPass::checkStmt(stmt);
+  }
+
+  /* ================= FUNCTIONS ================= */
+
+  void declareFunction(FunctionStmt *s) {
+
+    if (table.isDeclaredInCurrentScope(s->name))
+      throw CompileError("Redeclaration of function '" + s->name + "'",
+                         s->loc.line, s->loc.col);
+
+    table.declare(s->name, SymbolKind::Function);
+
+    auto fnSymbol = table.lookup(s->name);
+    for (auto &p : s->params)
+      fnSymbol->paramTypes.push_back(p.second);
+    fnSymbol->type = LangType::Function(fnSymbol->paramTypes, s->returnType);
+  }
+
+  void checkBody(FunctionStmt *s) {
+
+    // parameters, then the body's own scope
+    table.enterScope();
+    s->paramSymbols.clear();
+    for (auto &p : s->params) {
+      table.declare(p.first, SymbolKind::Variable);
+      s->paramSymbols.push_back(table.lookup(p.first));
+      s->paramSymbols.back()->type = p.second;
+    }
+
+    scoped([&] { TypeCheckPass::checkStmt(s); });
+
+    table.exitScope();
+  }
+
+  // Checks fn's body against the functions declared in this pass. The
+  // returned pass owns the symbols the body now points to.
+  unique_ptr<SemaPass> checkFunction(FunctionStmt *fn, DiagnosticEngine *d) {
+    auto body = make_unique<SemaPass>(&table, d);
+    body->checkBody(fn);
+    return body;
+  }
+
+  void checkBodies(const vector<FunctionStmt *> &functions) {
+
+    size_t n = functions.size();
+    size_t first = bodies.size();
+    bodies.resize(first + n);
+    vector<DiagnosticEngine> found(n);
+    vector<exception_ptr> errors(n);
+    atomic<size_t> next{0};
+
+    auto work = [&] {
+      for (size_t i; (i = next++) < n;) {
+        try {
+          bodies[first + i] =
+              checkFunction(functions[i], diag ? &found[i] : nullptr);
+        } catch (...) {
+          errors[i] = current_exception();
+        }
+      }
+    };
+
+    // workers need the same stack depth as the calling thread
+    size_t threads = min<size_t>(thread::hardware_concurrency(), n);
+    vector<unique_ptr<LargeStackThread>> pool;
+    for (size_t t = 1; t < threads; t++)
+      pool.push_back(make_unique<LargeStackThread>(work));
+    work();
+    for (auto &t : pool)
+      t->join();
+
+    for (size_t i = 0; i < n; i++) {
+      if (diag)
+        diag->merge(found[i]);
+      if (errors[i])
+        rethrow_exception(errors[i]);
+    }
+  }
+
+  // Runs f in a new scope, which is closed again even if f fails.
+  template <class F> void scoped(F &&f) {
+    table.enterScope();
+    recover(diag, f);
+    table.exitScope();
+  }
+
+  /* ================= EXPRESSIONS ================= */
+
+  LangType checkExpr(Expr *expr) override {
+
+    // ---------------- VARIABLE ----------------
+    if (auto e = dynamic_cast<VariableExpr *>(expr)) {
+      e->symbol = table.lookup(e->name);
+      return TypeCheckPass::checkExpr(expr);
+    }
+
+    // ---------------- ASSIGNMENT ----------------
+    if (auto e = dynamic_cast<BinaryExpr *>(expr); e && e->op == "=") {
+      auto var = dynamic_cast<VariableExpr *>(e->left.get());
+      if (var && !table.lookup(var->name))
+        throw CompileError("Assignment to undeclared variable '" + var->name +
+                               "'",
+                           e->loc.line, e->loc.col);
+      return TypeCheckPass::checkExpr(expr);
+    }
+
+    // ---------------- CALL ----------------
+    if (auto e = dynamic_cast<CallExpr *>(expr)) {
+      e->symbol = table.lookup(e->callee);
+      if (!e->symbol)
+        throw CompileError("Call to undeclared function '" + e->callee + "'",
+                           e->loc.line, e->loc.col);
+      return TypeCheckPass::checkExpr(expr);
+    }
+
+    return TypeCheckPass::checkExpr(expr);
+  }
+};
@@ -7,6 +7,8 @@ using namespace std;
 
 enum class SymbolKind { Variable, Function };
 
+struct VarInfo; // codegen/llvm_codegen.h
+
 struct Symbol {
   string name;
   SymbolKind kind;
@@ -16,6 +18,9 @@ struct Symbol {
   // Function-specific metadata
   vector<LangType> paramTypes;
 
+  // codegen: the variable's binding while its declaration is in scope
+  VarInfo *var = nullptr;
+
   Symbol(string n, SymbolKind k, int d, LangType t = LangType::Unknown())
       : name(std::move(n)), kind(k), depth(d), type(t) {}
 };
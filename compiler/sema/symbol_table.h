@@ -1,4 +1,5 @@
 #pragma once
+#include <deque>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
@@ -10,13 +11,23 @@
 using namespace std;
 
 class SymbolTable {
-  vector<unordered_map<string, Symbol>> scopes;
+  // AST nodes keep Symbol pointers after their scope is exited, so
+  // symbols live as long as the table (deque: stable addresses).
+  deque<Symbol> symbols;
+  vector<unordered_map<string, Symbol *>> scopes;
+
+  // names not found here are looked up in outer (read-only)
+  const SymbolTable *outer = nullptr;
 
 public:
   SymbolTable() {
     enterScope(); // global scope
   }
 
+  explicit SymbolTable(const SymbolTable *outer) : outer(outer) {
+    enterScope();
+  }
+
   // ---------------- Scope management ----------------
 
   void enterScope() { scopes.push_back({}); }
@@ -38,16 +49,17 @@ public:
       throw CompileError("Redeclaration of symbol '" + name + "'", 0, 0);
     }
 
-    scope.emplace(name, Symbol(name, kind, currentDepth()));
+    symbols.emplace_back(name, kind, currentDepth());
+    scope.emplace(name, &symbols.back());
   }
 
-  Symbol *lookup(const string &name) {
+  Symbol *lookup(const string &name) const {
     for (int i = (int)scopes.size() - 1; i >= 0; --i) {
       auto it = scopes[i].find(name);
       if (it != scopes[i].end())
-        return &it->second;
+        return it->second;
     }
-    return nullptr;
+    return outer ? outer->lookup(name) : nullptr;
   }
 
   bool isDeclaredInCurrentScope(const string &name) {
@@ -21,7 +21,7 @@ struct LangType {
   int bitWidth = 0;
   bool isUnsigned = false;
 
-  // Array
+  // Array (arraySize 0: length known only at run time)
   std::shared_ptr<LangType> element;
   int arraySize = 0;
 
@@ -114,6 +114,11 @@ struct LangType {
     return t;
   }
 
+  // int[n] x / int[] param: heap storage, carries its length
+  static LangType DynamicArray(LangType elem) {
+    return Array(std::move(elem), 0);
+  }
+
   static LangType Function(std::vector<LangType> ps, LangType r) {
     LangType t(LangTypeKind::Function);
     t.params = std::move(ps);
@@ -135,6 +140,8 @@ struct LangType {
 
   bool isArray() const { return kind == LangTypeKind::Array; }
 
+  bool isDynamicArray() const { return isArray() && arraySize == 0; }
+
   bool isFunction() const { return kind == LangTypeKind::Function; }
 
   bool isNumeric() const {
@@ -7,6 +7,7 @@
 
 #include "../ast/expr.h"
 #include "../ast/stmt.h"
+#include "../common/diagnostics.h"
 #include "../common/error.h"
 #include "symbol.h"
 #include "type.h"
@@ -19,12 +20,26 @@ struct TypeCheckPass {
   LangType currentFunctionReturnType;
   bool hasReturn = false;
 
+  // errors are reported here and checking goes on with the next
+  // statement of the block
+  DiagnosticEngine *diag = nullptr;
+
+  virtual ~TypeCheckPass() = default;
+
   /* ================= PROGRAM ================= */
 
   void check(const vector<unique_ptr<Stmt>> &program) {
 
-    for (auto &s : program)
-      checkStmt(s.get());
+    for (auto &s : program) {
+      auto fn = dynamic_cast<FunctionStmt *>(s.get());
+      if (!fn || !fn->hasSyntaxErrors)
+        recover(diag, [&] { checkStmt(s.get()); });
+    }
+
+    recover(diag, [&] { checkMain(program); });
+  }
+
+  void checkMain(const vector<unique_ptr<Stmt>> &program) {
 
     bool foundMain = false;
 
@@ -45,7 +60,7 @@ struct TypeCheckPass {
 
   /* ================= STATEMENTS ================= */
 
-  void checkStmt(Stmt *stmt) {
+  virtual void checkStmt(Stmt *stmt) {
 
     if (auto s = dynamic_cast<ExprStmt *>(stmt))
       checkExpr(s->e.get());
@@ -55,10 +70,15 @@ struct TypeCheckPass {
 
     else if (auto s = dynamic_cast<BlockStmt *>(stmt))
       for (auto &x : s->stmts)
-        checkStmt(x.get());
+        recover(diag, [&] { checkStmt(x.get()); });
 
     else if (auto s = dynamic_cast<VarDeclStmt *>(stmt)) {
 
+      if (s->length &&
+          checkExpr(s->length.get()).kind != LangTypeKind::Integer)
+        throw CompileError("Array length must be integer", s->loc.line,
+                           s->loc.col);
+
       if (s->initializer) {
         LangType initType = checkExpr(s->initializer.get());
 
@@ -92,6 +112,26 @@ struct TypeCheckPass {
       checkStmt(s->body.get());
     }
 
+    else if (auto s = dynamic_cast<ForStmt *>(stmt)) {
+
+      if (s->init)
+        checkStmt(s->init.get());
+
+      if (s->condition) {
+        LangType cond = checkExpr(s->condition.get());
+
+        if (cond.kind != LangTypeKind::Bool &&
+            cond.kind != LangTypeKind::Integer)
+          throw CompileError("For condition must be bool or int",
+                             s->condition->loc.line, s->condition->loc.col);
+      }
+
+      if (s->increment)
+        checkExpr(s->increment.get());
+
+      checkStmt(s->body.get());
+    }
+
     else if (auto s = dynamic_cast<ReturnStmt *>(stmt)) {
 
       hasReturn = true;
@@ -114,7 +154,7 @@ struct TypeCheckPass {
       hasReturn = false;
 
       for (auto &b : s->body->stmts)
-        checkStmt(b.get());
+        recover(diag, [&] { checkStmt(b.get()); });
 
       if (s->returnType.kind != LangTypeKind::Void && !hasReturn)
         throw CompileError("Non-void function must return a value", s->loc.line,
@@ -124,7 +164,7 @@ struct TypeCheckPass {
 
   /* ================= EXPRESSIONS ================= */
 
-  LangType checkExpr(Expr *expr) {
+  virtual LangType checkExpr(Expr *expr) {
 
     /* ===== NUMBER ===== */
     if (auto *n = dynamic_cast<NumberExpr *>(expr)) {
@@ -189,9 +229,14 @@ struct TypeCheckPass {
 
         return expr->type = rt;
       }
+
+      if (u->op == "++" || u->op == "--")
+        throw CompileError("'" + u->op + "' is only allowed as a statement",
+                           u->loc.line, u->loc.col);
     }
 
     /* ===== BINARY ===== */
+    // each operand is checked once; the result stays on its Expr::type
     if (auto *b = dynamic_cast<BinaryExpr *>(expr)) {
 
       LangType L = checkExpr(b->left.get());
@@ -206,8 +251,10 @@ struct TypeCheckPass {
                              b->loc.col);
         }
 
-        LangType L = checkExpr(b->left.get());
-        LangType R = checkExpr(b->right.get());
+        // arrays are references to storage owned by their declaration
+        if (L.isDynamicArray())
+          throw CompileError("Cannot assign to an array", b->loc.line,
+                             b->loc.col);
 
         if (!isAssignable(L, R))
           throw CompileError("Assignment type mismatch", b->loc.line,
@@ -216,7 +263,8 @@ struct TypeCheckPass {
         return expr->type = L;
       }
 
-      if (b->op == "+" || b->op == "-" || b->op == "*" || b->op == "/") {
+      if (b->op == "+" || b->op == "-" || b->op == "*" || b->op == "/" ||
+          b->op == "%") {
 
         if ((L.kind != LangTypeKind::Integer &&
              L.kind != LangTypeKind::Floating) ||
@@ -277,6 +325,10 @@ struct TypeCheckPass {
         value.kind == LangTypeKind::Integer)
       return true;
 
+    // any array can be passed as an int[]-style parameter
+    if (target.isDynamicArray() && value.isArray())
+      return sameType(*target.element, *value.element);
+
     return false;
   }
 };